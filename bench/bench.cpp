@@ -0,0 +1,40 @@
+/*
+  Copyright 2017 Kaan Genç
+
+  This file is part of DagBox.
+
+  DagBox is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  DagBox is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with DagBox.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "message.hpp"
+#include "embedded.hpp"
+#include "client.hpp"
+#include "datastore.hpp"
+
+
+/*! \file bench.cpp
+ * Micro-benchmarks for the hot paths of DagBox.
+ *
+ * These are not run as a part of the tests. Build and run the
+ * `bench-build` target to see the results.
+ */
+
+
+auto main() -> int
+{
+    bench_message();
+    bench_embedded();
+    bench_client();
+    bench_datastore();
+    return 0;
+}
@@ -0,0 +1,64 @@
+/*
+  Copyright 2017 Kaan Genç
+
+  This file is part of DagBox.
+
+  DagBox is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  DagBox is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with DagBox.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <future>
+#include "helpers.hpp"
+#include "../src/client.hpp"
+#include "../src/broker.hpp"
+#include "../src/assistant.hpp"
+#include "../src/worker/lock.hpp"
+
+
+auto bench_client = [](){
+    std::size_t const iterations = 1000;
+    std::size_t const in_flight = 64;
+
+    std::cout << in_flight << " lock requests in flight" << std::endl;
+
+    lock::detail::lock_request lreq = {"bench_key", true};
+    auto const request_data = dumps(lreq);
+
+    zmq::context_t ctx;
+    std::string const addr = "inproc://bench-client";
+    component<broker> b(ctx, addr, std::chrono::milliseconds{1000});
+    component<assistant<lock::lock>> l(ctx, addr, 500);
+
+    auto round = [&](dagbox::client & c) {
+        std::vector<std::future<msg::reply>> replies;
+        for (std::size_t i = 0; i < in_flight; ++i) {
+            replies.push_back(c.request(msg::request::make(
+                                            "lock", {}, msg_vec({request_data}))));
+        }
+        for (auto & reply : replies) {
+            reply.get();
+        }
+    };
+
+    dagbox::client separate(ctx, addr);
+    measure("separate requests", iterations, [&](){ round(separate); });
+
+    dagbox::client coalesced(ctx, addr);
+    coalesced.coalesce("lock", in_flight);
+    measure("coalesced requests", iterations, [&](){ round(coalesced); });
+
+    dagbox::client lingering(ctx, addr);
+    lingering.coalesce("lock", in_flight, std::chrono::microseconds{20});
+    measure("coalesced requests, waiting 20us", iterations, [&](){ round(lingering); });
+};
@@ -0,0 +1,111 @@
+/*
+  Copyright 2017 Kaan Genç
+
+  This file is part of DagBox.
+
+  DagBox is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  DagBox is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with DagBox.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <map>
+#include "helpers.hpp"
+#include "../src/worker/datastore.hpp"
+
+
+auto bench_datastore = [](){
+    std::size_t const iterations = 100000;
+
+    std::cout << "datastore small key read" << std::endl;
+
+    auto read_latency = [&](std::string const & name,
+                            unsigned int flags,
+                            std::chrono::milliseconds max_staleness) {
+        auto dir = filesystem::temp_directory_path() / filesystem::unique_path("DagBox-bench-%%%%-%%%%-%%%%-%%%%");
+        {
+            data::storage store(dir, 0, flags);
+            data::writer writer(store);
+            data::reader reader(store, max_staleness);
+
+            data::detail::write_request wreq = {"bench", "small value"};
+            auto written = msg::read(writer(msg::request::make(
+                                                "datastore writer", {},
+                                                msg_vec({dumps(wreq)}))));
+            auto & reply = boost::get<msg::reply>(written);
+            std::string key(reply.data()[0].data<char>(), reply.data()[0].size());
+            msgpack::object_handle key_obj = msgpack::unpack(key.data(), key.size());
+
+            data::detail::read_request rreq = {
+                "bench", key_obj.get().as<std::string>(), boost::none, {}};
+            auto const request_data = dumps(rreq);
+            measure(name, iterations, [&](){
+                reader(msg::request::make("datastore reader", {}, msg_vec({request_data})));
+            });
+        }
+        filesystem::remove_all(dir);
+    };
+
+    read_latency("new transaction per request", 0, std::chrono::milliseconds{0});
+    read_latency("renewed transaction", MDB_NOTLS, std::chrono::milliseconds{0});
+    read_latency("snapshot kept for 10ms", MDB_NOTLS, std::chrono::milliseconds{10});
+
+
+    std::cout << "datastore insert, 100 records per request" << std::endl;
+
+    auto insert = [&](std::string const & name, data::key_mode keys,
+                      std::vector<std::string> const & indexes) {
+        auto dir = filesystem::temp_directory_path() / filesystem::unique_path("DagBox-bench-%%%%-%%%%-%%%%-%%%%");
+        {
+            // Without syncing, only the cost of updating the tree is measured
+            data::storage store(dir, std::size_t{1} << 30, MDB_NOSYNC);
+            data::bucket_options options;
+            options.keys = keys;
+            options.indexes = indexes;
+            store.configure_bucket("bench", options);
+            data::writer writer(store);
+
+            // Records with distinct values, so that indexes grow as a
+            // real one would
+            std::vector<std::string> requests;
+            for (std::size_t i = 0; i < iterations / 100; ++i) {
+                data::detail::multi_put_request put;
+                for (std::size_t j = 0; j < 100; ++j) {
+                    auto n = std::to_string(i * 100 + j);
+                    std::map<std::string, std::string> record = {
+                        {"email", "user" + n + "@example.com"},
+                        {"name", "User " + n},
+                        {"bio", std::string(32, 'b')},
+                    };
+                    put.records.push_back({"bench", dumps(record)});
+                }
+                requests.push_back(dumps(put));
+            }
+            std::size_t next = 0;
+            measure(name, iterations / 100, [&](){
+                auto & request_data = requests[next++ % requests.size()];
+                writer(msg::request::make("datastore writer", {}, msg_vec({request_data})));
+            });
+            std::cout << std::left << std::setw(48) << "    database size"
+                      << std::right << std::setw(12)
+                      << filesystem::file_size(dir / "data.mdb") / 1024
+                      << " KiB" << std::endl;
+        }
+        filesystem::remove_all(dir);
+    };
+
+    insert("random uuid keys", data::key_mode::uuid, {});
+    insert("ulid keys, appended", data::key_mode::ulid, {});
+    insert("sequence keys, appended", data::key_mode::sequence, {});
+    insert("ulid keys, 1 index", data::key_mode::ulid, {"email"});
+    insert("ulid keys, 2 indexes", data::key_mode::ulid, {"email", "name"});
+};
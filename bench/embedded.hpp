@@ -0,0 +1,53 @@
+/*
+  Copyright 2017 Kaan Genç
+
+  This file is part of DagBox.
+
+  DagBox is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  DagBox is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with DagBox.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include "helpers.hpp"
+#include "../src/embedded.hpp"
+#include "../src/broker.hpp"
+#include "../src/assistant.hpp"
+#include "../src/worker/lock.hpp"
+
+
+auto bench_embedded = [](){
+    std::size_t const iterations = 100000;
+
+    std::cout << "lock request round trip" << std::endl;
+
+    lock::detail::lock_request lreq = {"bench_key", true};
+    auto const request_data = dumps(lreq);
+
+    embedded::dispatcher db;
+    db.add<lock::lock>(1);
+    measure("embedded dispatcher", iterations, [&](){
+        auto reply = db.call("lock", msg_vec({request_data}));
+    });
+
+    zmq::context_t ctx;
+    std::string const addr = "inproc://bench-embedded";
+    component<broker> b(ctx, addr, std::chrono::milliseconds{1000});
+    component<assistant<lock::lock>> l(ctx, addr, 500);
+    class socket client(ctx, zmq::socket_type::dealer);
+    client.connect(addr);
+    measure("inproc broker and assistant", iterations, [&](){
+        client.send_multimsg(msg::send(msg::request::make(
+                                           "lock", {}, msg_vec({request_data}))));
+        auto reply = client.recv_multimsg();
+    });
+};
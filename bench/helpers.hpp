@@ -0,0 +1,57 @@
+/*
+  Copyright 2017 Kaan Genç
+
+  This file is part of DagBox.
+
+  DagBox is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  DagBox is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with DagBox.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include "../src/helpers.hpp"
+#include "../test/message_helpers.hpp"
+
+
+
+/*! \brief Run `operation` repeatedly and report the average time it took.
+ *
+ * The operation is run a few times before the measurement starts, so
+ * that one-time costs such as opening buckets are not counted.
+ */
+template <class F>
+auto measure(std::string const & name, std::size_t iterations, F && operation)
+    -> void
+{
+    std::size_t const warmup = iterations / 10 + 1;
+    for (std::size_t i = 0; i < warmup; ++i) {
+        operation();
+    }
+
+    auto start = detail_time::time_now();
+    for (std::size_t i = 0; i < iterations; ++i) {
+        operation();
+    }
+    auto elapsed = detail_time::time_now() - start;
+
+    auto total_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        elapsed).count();
+    std::cout << std::left << std::setw(48) << name
+              << std::right << std::setw(12)
+              << static_cast<double>(total_ns) / iterations
+              << " ns/op" << std::endl;
+}
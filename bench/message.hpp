@@ -0,0 +1,70 @@
+/*
+  Copyright 2017 Kaan Genç
+
+  This file is part of DagBox.
+
+  DagBox is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  DagBox is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with DagBox.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include "helpers.hpp"
+#include "../src/message.hpp"
+
+
+auto bench_message = [](){
+    std::size_t const iterations = 1000000;
+
+    std::cout << "message construction" << std::endl;
+
+    measure("copied protocol header part", iterations, [](){
+        auto const & header = msg::detail::protocol::header;
+        msg::part p(header.data(), header.size());
+    });
+
+    measure("registration make + send", iterations, [](){
+        auto parts = msg::send(msg::registration::make("service"));
+    });
+
+    measure("ping make + send", iterations, [](){
+        auto parts = msg::send(msg::ping::make());
+    });
+
+    measure("pong make + send", iterations, [](){
+        auto parts = msg::send(msg::pong::make(msg::ping::make()));
+    });
+
+    measure("reconnect make + send", iterations, [](){
+        auto parts = msg::send(msg::reconnect::make(msg::ping::make()));
+    });
+
+    measure("request make + send", iterations, [](){
+        auto parts = msg::send(msg::request::make("service",
+                                                  msg_vec({"meta"}),
+                                                  msg_vec({"data"})));
+    });
+
+    measure("reply make + send", iterations, [](){
+        auto parts = msg::send(msg::reply::make(
+                                   msg::request::make("service",
+                                                      msg_vec({"meta"}),
+                                                      msg_vec({"data"}))));
+    });
+
+    measure("request send + read", iterations, [](){
+        auto parts = msg::send(msg::request::make("service",
+                                                  msg_vec({"meta"}),
+                                                  msg_vec({"data"})));
+        auto message = msg::read(std::move(parts));
+    });
+};
@@ -0,0 +1,160 @@
+/*
+  Copyright 2017 Kaan Genç
+
+  This file is part of DagBox.
+
+  DagBox is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  DagBox is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with DagBox.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "config.hpp"
+#include <fstream>
+#include <sstream>
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/ini_parser.hpp>
+using namespace dagboxd;
+
+namespace ptree = boost::property_tree;
+
+
+namespace
+{
+    auto split_words(std::string const & words) -> std::vector<std::string>
+    {
+        std::vector<std::string> result;
+        std::stringstream stream(words);
+        std::string word;
+        while (stream >> word) {
+            result.push_back(word);
+        }
+        return result;
+    }
+
+
+    // Unlike ptree's own get with a default, fails on values that
+    // can't be converted instead of silently using the default
+    template <class T>
+    auto get(ptree::ptree const & tree, std::string const & path, T fallback) -> T
+    {
+        auto child = tree.get_child_optional(path);
+        if (!child) {
+            return fallback;
+        }
+        try {
+            return child->get_value<T>();
+        } catch (ptree::ptree_bad_data &) {
+            throw dagboxd::exception::invalid_config(path + " has an invalid value");
+        }
+    }
+
+
+    auto get_milliseconds(ptree::ptree const & tree, std::string const & path,
+                          std::chrono::milliseconds fallback)
+        -> std::chrono::milliseconds
+    {
+        auto count = get<long>(tree, path, fallback.count());
+        if (count < 0) {
+            throw dagboxd::exception::invalid_config(path + " can't be negative");
+        }
+        return std::chrono::milliseconds{count};
+    }
+}
+
+
+auto dagboxd::read_config(std::istream & input) -> config
+{
+    ptree::ptree tree;
+    config conf;
+    try {
+        ptree::read_ini(input, tree);
+
+        auto bind = tree.get_optional<std::string>("broker.bind");
+        if (bind) {
+            conf.broker_bind = split_words(*bind);
+        }
+        conf.broker_connect = get(tree, "broker.connect", conf.broker_connect);
+        conf.worker_timeout = get_milliseconds(tree, "broker.worker_timeout",
+                                               conf.worker_timeout);
+
+        conf.storage_directory = get(tree, "storage.directory", conf.storage_directory);
+        conf.map_size = get(tree, "storage.map_size", conf.map_size);
+        conf.notls = get(tree, "storage.notls", conf.notls);
+
+        conf.readers = get(tree, "workers.readers", conf.readers);
+        conf.read_staleness = get_milliseconds(tree, "workers.read_staleness",
+                                               conf.read_staleness);
+        conf.writers = get(tree, "workers.writers", conf.writers);
+        conf.locks = get(tree, "workers.locks", conf.locks);
+        conf.heartbeat = get_milliseconds(tree, "workers.heartbeat",
+                                          std::chrono::milliseconds{0});
+        conf.batch_window = get_milliseconds(tree, "workers.batch_window",
+                                             conf.batch_window);
+        conf.batch_bytes = get(tree, "workers.batch_bytes", conf.batch_bytes);
+
+        auto keys = tree.get_child_optional("keys");
+        if (keys) {
+            for (auto & bucket : *keys) {
+                auto mode = bucket.second.get_value<std::string>();
+                if (mode != "uuid" && mode != "ulid" && mode != "sequence") {
+                    throw dagboxd::exception::invalid_config("keys." + bucket.first
+                                                             + " must be uuid, ulid or sequence");
+                }
+                conf.bucket_keys[bucket.first] = mode;
+            }
+        }
+        auto indexes = tree.get_child_optional("indexes");
+        if (indexes) {
+            for (auto & bucket : *indexes) {
+                conf.bucket_indexes[bucket.first] = split_words(
+                    bucket.second.get_value<std::string>());
+            }
+        }
+
+        conf.pin = get(tree, "placement.pin", conf.pin);
+
+        conf.drain = get_milliseconds(tree, "shutdown.drain", conf.drain);
+    } catch (ptree::ptree_error & e) {
+        throw dagboxd::exception::invalid_config(e.what());
+    }
+
+    if (conf.heartbeat.count() == 0) {
+        conf.heartbeat = conf.worker_timeout / 2;
+    }
+    if (conf.heartbeat >= conf.worker_timeout) {
+        throw dagboxd::exception::invalid_config("workers.heartbeat must be less than "
+                                        "broker.worker_timeout");
+    }
+    if (conf.broker_bind.empty() && conf.broker_connect.compare(0, 9, "inproc://") == 0) {
+        // There is no broker in this process to connect to
+        throw dagboxd::exception::invalid_config("broker.connect must not be an "
+                                                 "inproc address without broker.bind");
+    }
+    if (conf.locks > 1) {
+        // Every lock service keeps its own set of locks
+        throw dagboxd::exception::invalid_config("workers.locks can't be more than 1");
+    }
+    if ((conf.readers > 0 || conf.writers > 0) && conf.storage_directory.empty()) {
+        throw dagboxd::exception::invalid_config("storage.directory is required to "
+                                        "run readers or writers");
+    }
+    return conf;
+}
+
+
+auto dagboxd::read_config(std::string const & path) -> config
+{
+    std::ifstream input(path);
+    if (!input) {
+        throw dagboxd::exception::invalid_config("Can't read the configuration file " + path);
+    }
+    return read_config(input);
+}
@@ -0,0 +1,186 @@
+/*
+  Copyright 2017 Kaan Genç
+
+  This file is part of DagBox.
+
+  DagBox is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  DagBox is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with DagBox.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <chrono>
+#include <istream>
+#include <map>
+#include <string>
+#include <vector>
+#include "../src/exception.hpp"
+
+
+/*! \file config.hpp
+ * Configuration of the DagBox server.
+ */
+
+
+/*! \brief The DagBox server.
+ */
+namespace dagboxd
+{
+    namespace exception
+    {
+        using std::runtime_error;
+
+        /*! \brief The configuration file is missing, can't be parsed,
+         *  or has invalid values.
+         */
+        EXCEPTION(invalid_config, runtime_error);
+    };
+
+
+    /*! \brief What the server runs, and how.
+     *
+     * The configuration is read from an INI file, where every
+     * setting is optional. The example below shows the defaults,
+     * except for `storage.directory` which has none.
+     *
+     * ```
+     * [broker]
+     * ; Addresses the broker binds to, separated by spaces. Leave
+     * ; empty to run only workers, connecting to a broker elsewhere.
+     * bind = tcp://0.0.0.0:5555 inproc://dagbox
+     * ; Address the workers connect to
+     * connect = inproc://dagbox
+     * worker_timeout = 1000
+     *
+     * [storage]
+     * directory = /var/lib/dagbox
+     * ; 0 uses LMDB's default
+     * map_size = 0
+     * ; Lets readers keep their read transactions between requests
+     * notls = false
+     *
+     * [workers]
+     * readers = 1
+     * writers = 1
+     * locks = 1
+     * ; Time between heartbeats, 0 for half the worker timeout
+     * heartbeat = 0
+     * ; Time readers may keep reading from the same snapshot, needs notls
+     * read_staleness = 0
+     * ; Time writes are held back to be committed together, and the
+     * ; amount of data that commits them early, 0 for no limit
+     * batch_window = 0
+     * batch_bytes = 0
+     *
+     * [keys]
+     * ; How writers generate keys in each bucket, one of uuid, ulid or
+     * ; sequence. Buckets that aren't listed use uuid.
+     * events = ulid
+     *
+     * [indexes]
+     * ; The fields each bucket is indexed by, separated by spaces
+     * users = email address.city
+     *
+     * [placement]
+     * ; Pin the broker to a core of its own, and the workers to the others
+     * pin = false
+     *
+     * [shutdown]
+     * ; Time given to the broker to deliver the last replies
+     * drain = 500
+     * ```
+     *
+     * A single process can run everything over `inproc://`, or the
+     * broker and the workers can be split into several processes
+     * that connect over `tcp://`.
+     */
+    struct config
+    {
+        /*! \brief The addresses the broker binds to. Empty to not run
+         *  a broker.
+         */
+        std::vector<std::string> broker_bind = {"tcp://0.0.0.0:5555", "inproc://dagbox"};
+        /*! \brief The address the workers connect to. */
+        std::string broker_connect = "inproc://dagbox";
+        /*! \brief The time after which the broker considers a
+         *  worker dead.
+         */
+        std::chrono::milliseconds worker_timeout{1000};
+        /*! \brief The time between heartbeats sent by the workers. */
+        std::chrono::milliseconds heartbeat{500};
+
+        /*! \brief The directory of the LMDB environment. */
+        std::string storage_directory;
+        /*! \brief The largest size the database may grow to, in
+         *  bytes. 0 for LMDB's default.
+         */
+        std::size_t map_size = 0;
+        /*! \brief Whether the storage is opened with `MDB_NOTLS`, see
+         *  [storage](\ref data::storage).
+         */
+        bool notls = false;
+
+        /*! \brief The number of [readers](\ref data::reader) to run. */
+        std::size_t readers = 1;
+        /*! \brief How long readers may keep reading from the same
+         *  snapshot, see [reader](\ref data::reader).
+         */
+        std::chrono::milliseconds read_staleness{0};
+        /*! \brief The number of [writers](\ref data::writer) to run. */
+        std::size_t writers = 1;
+        /*! \brief The number of [lock services](\ref lock::lock) to
+         *  run, either 0 or 1.
+         */
+        std::size_t locks = 1;
+        /*! \brief How long writes are held back to be committed
+         *  together, see [writer](\ref data::writer).
+         */
+        std::chrono::milliseconds batch_window{0};
+        /*! \brief Commit held back writes early once they have this
+         *  many bytes of data. 0 for no limit.
+         */
+        std::size_t batch_bytes = 0;
+        /*! \brief The [key mode](\ref data::key_mode) of each bucket
+         *  that doesn't use UUIDs, by name.
+         */
+        std::map<std::string, std::string> bucket_keys;
+        /*! \brief The [indexed fields](\ref data::bucket_options::indexes)
+         *  of each bucket, by name.
+         */
+        std::map<std::string, std::vector<std::string>> bucket_indexes;
+
+        /*! \brief Whether threads are pinned to CPUs, see
+         *  [isolate_broker](\ref placement::isolate_broker).
+         */
+        bool pin = false;
+
+        /*! \brief The time given to the broker to deliver replies
+         *  once the workers have stopped.
+         */
+        std::chrono::milliseconds drain{500};
+    };
+
+
+    /*! \brief Read a configuration.
+     *
+     * \throws exception::invalid_config The configuration can't be
+     * parsed, or has invalid values.
+     */
+    auto read_config(std::istream & input) -> config;
+
+    /*! \brief Read a configuration from a file.
+     *
+     * \throws exception::invalid_config The file can't be read, or
+     * the configuration in it is invalid.
+     */
+    auto read_config(std::string const & path) -> config;
+};
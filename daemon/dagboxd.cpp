@@ -0,0 +1,195 @@
+/*
+  Copyright 2017 Kaan Genç
+
+  This file is part of DagBox.
+
+  DagBox is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  DagBox is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with DagBox.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <csignal>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <thread>
+#include <pthread.h>
+#include <zmq.hpp>
+#include <spdlog/spdlog.h>
+#include "config.hpp"
+#include "../src/helpers.hpp"
+#include "../src/placement.hpp"
+#include "../src/broker.hpp"
+#include "../src/assistant.hpp"
+#include "../src/worker/datastore.hpp"
+#include "../src/worker/lock.hpp"
+
+
+/*! \file dagboxd.cpp
+ * The DagBox server.
+ *
+ * Runs a broker and the storage and lock workers, as described by a
+ * [configuration file](\ref dagboxd::config):
+ *
+ * ```
+ * dagboxd /etc/dagbox/dagboxd.ini
+ * ```
+ *
+ * The server stops on `SIGINT` or `SIGTERM`. The workers are stopped
+ * first, each finishing the requests it has already received, then
+ * the broker is given some time to deliver their replies.
+ */
+
+
+namespace
+{
+    // Where the threads of the server run
+    struct thread_layout
+    {
+        placement::thread_placement broker;
+        std::vector<placement::thread_placement> readers;
+        std::vector<placement::thread_placement> writers;
+        std::vector<placement::thread_placement> locks;
+    };
+
+
+    auto make_layout(dagboxd::config const & conf) -> thread_layout
+    {
+        auto total = conf.readers + conf.writers + conf.locks;
+        placement::layout spread;
+        if (conf.pin) {
+            spread = placement::isolate_broker(total, "worker");
+        } else {
+            spread.broker.name = "broker";
+            spread.workers.resize(total);
+        }
+
+        thread_layout layout;
+        layout.broker = spread.broker;
+        auto next = spread.workers.begin();
+        auto take = [&](std::size_t count, std::string const & name) {
+            std::vector<placement::thread_placement> taken(next, next + count);
+            next += count;
+            for (std::size_t i = 0; i < taken.size(); ++i) {
+                taken[i].name = name + "-" + std::to_string(i);
+            }
+            return taken;
+        };
+        layout.readers = take(conf.readers, "reader");
+        layout.writers = take(conf.writers, "writer");
+        layout.locks = take(conf.locks, "lock");
+        return layout;
+    }
+}
+
+
+auto main(int argc, char * argv[]) -> int
+{
+    auto logger = spdlog::stdout_color_mt("dagboxd");
+    if (argc != 2) {
+        std::cerr << "Usage: " << argv[0] << " CONFIG" << std::endl;
+        return 2;
+    }
+
+    dagboxd::config conf;
+    try {
+        conf = dagboxd::read_config(argv[1]);
+    } catch (dagboxd::exception::invalid_config & e) {
+        logger->error("Invalid configuration: {}", e.what());
+        return 1;
+    }
+
+    // Block the signals before any thread is started, so that the
+    // threads inherit the mask and only this thread receives them
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    auto layout = make_layout(conf);
+    zmq::context_t ctx;
+    std::unique_ptr<data::storage> store;
+    std::unique_ptr<component<broker>> broker_component;
+    std::unique_ptr<component_pool<assistant<data::reader>>> readers;
+    std::unique_ptr<component_pool<assistant<data::scanner>>> scanners;
+    std::unique_ptr<component_pool<assistant<data::writer>>> writers;
+    std::unique_ptr<component_pool<assistant<lock::lock>>> locks;
+    auto heartbeat = static_cast<int>(conf.heartbeat.count());
+
+    try {
+        if (!conf.broker_bind.empty()) {
+            broker_component.reset(new component<broker>(
+                                       placed, layout.broker, ctx,
+                                       conf.broker_bind, conf.worker_timeout));
+        }
+        if (conf.readers > 0 || conf.writers > 0) {
+            store.reset(new data::storage(conf.storage_directory, conf.map_size,
+                                          conf.notls ? MDB_NOTLS : 0));
+            std::map<std::string, data::bucket_options> buckets;
+            for (auto & bucket : conf.bucket_keys) {
+                buckets[bucket.first].keys =
+                    bucket.second == "ulid" ? data::key_mode::ulid
+                    : bucket.second == "sequence" ? data::key_mode::sequence
+                    : data::key_mode::uuid;
+            }
+            for (auto & bucket : conf.bucket_indexes) {
+                buckets[bucket.first].indexes = bucket.second;
+            }
+            for (auto & bucket : buckets) {
+                store->configure_bucket(bucket.first, bucket.second);
+            }
+            readers.reset(new component_pool<assistant<data::reader>>(
+                              layout.readers, ctx, conf.broker_connect, heartbeat,
+                              std::ref(*store), conf.read_staleness));
+            // Scans are rarer than reads, so a scanner shares the CPU
+            // of each reader
+            scanners.reset(new component_pool<assistant<data::scanner>>(
+                               layout.readers, ctx, conf.broker_connect, heartbeat,
+                               std::ref(*store), conf.read_staleness));
+            writers.reset(new component_pool<assistant<data::writer>>(
+                              layout.writers, ctx, conf.broker_connect, heartbeat,
+                              std::ref(*store), conf.batch_window, conf.batch_bytes));
+        }
+        locks.reset(new component_pool<assistant<lock::lock>>(
+                        layout.locks, ctx, conf.broker_connect, heartbeat));
+    } catch (std::exception & e) {
+        logger->error("Failed to start: {}", e.what());
+        return 1;
+    }
+    logger->info("Started with {} readers, {} writers and {} lock services",
+                 conf.readers, conf.writers, conf.locks);
+
+    int received;
+    sigwait(&signals, &received);
+    logger->info("Received signal {}, shutting down", received);
+
+    // Every worker withdraws from the broker at once, so that no new
+    // requests are routed to any of them. Each then finishes the
+    // requests it has already received, including a batch it holds
+    // back, while the broker keeps delivering their replies.
+    locks->stop();
+    if (store) {
+        writers->stop();
+        scanners->stop();
+        readers->stop();
+    }
+    locks.reset();
+    writers.reset();
+    scanners.reset();
+    readers.reset();
+    // Replies the workers sent last may still be queued in the broker
+    if (broker_component) {
+        std::this_thread::sleep_for(conf.drain);
+        broker_component.reset();
+    }
+    return 0;
+}
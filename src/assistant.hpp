@@ -18,12 +18,26 @@
  */
 #pragma once
 
+#include <chrono>
+#include <exception>
+#include <stdexcept>
 #include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 #include <boost/variant.hpp>
 #include <zmq.hpp>
 #include <spdlog/spdlog.h>
 #include "message.hpp"
+#include "compression.hpp"
+#include "shm.hpp"
+#include "stream.hpp"
+#include "requester.hpp"
+#include "services.hpp"
 #include "socket.hpp"
+#include "reactor.hpp"
+#include "heartbeat.hpp"
 #include "helpers.hpp"
 
 /*! \file assistant.hpp
@@ -37,13 +51,205 @@ typedef std::vector<zmq::message_t> sendable;
 typedef boost::optional<sendable> maybe_sendable;
 
 
+namespace detail_assistant
+{
+    // Workers that accept a requester reply through it, others are
+    // called with just the request
+    template <class worker>
+    auto call(worker & work, msg::request && request, requester & req, int)
+        -> decltype(work(std::move(request), req), msg::part_source())
+    {
+        work(std::move(request), req);
+        // The reply will be sent through the requester
+        return msg::part_source();
+    }
+
+    template <class worker>
+    auto call(worker & work, msg::request && request, requester &, long)
+        -> decltype(work(std::move(request)))
+    {
+        return work(std::move(request));
+    }
+
+    // Whether a worker replies through a requester
+    template <class worker, class = void>
+    struct accepts_requester : std::false_type {};
+
+    template <class worker>
+    struct accepts_requester<
+        worker,
+        decltype(void(std::declval<worker &>()(std::declval<msg::request>(),
+                                               std::declval<requester &>())))>
+        : std::true_type {};
+
+    // Whether a worker sends its replies in chunks
+    template <class worker, class = void>
+    struct accepts_stream : std::false_type {};
+
+    template <class worker>
+    struct accepts_stream<
+        worker,
+        decltype(void(std::declval<worker &>()(std::declval<msg::request>(),
+                                               std::declval<reply_stream &>())))>
+        : std::true_type {};
+
+    // Whether a worker can process several requests at once
+    template <class worker, class = void>
+    struct accepts_batch : std::false_type {};
+
+    template <class worker>
+    struct accepts_batch<
+        worker,
+        decltype(void(std::declval<worker &>()(std::declval<std::vector<msg::request>>())))>
+        : std::true_type {};
+
+    // Workers that accept batches may ask for requests to be held
+    // back for a while, or until they hold a number of bytes, so
+    // that more of them share the work
+    template <class worker>
+    auto batch_window(worker const & work, int)
+        -> decltype(std::chrono::milliseconds(work.batch_window))
+    {
+        return work.batch_window;
+    }
+
+    template <class worker>
+    auto batch_window(worker const &, long) -> std::chrono::milliseconds
+    {
+        return std::chrono::milliseconds{0};
+    }
+
+    template <class worker>
+    auto batch_bytes(worker const & work, int)
+        -> decltype(std::size_t(work.batch_bytes))
+    {
+        return work.batch_bytes;
+    }
+
+    template <class worker>
+    auto batch_bytes(worker const &, long) -> std::size_t
+    {
+        return 0;
+    }
+
+    // Workers that hold on to something between requests, such as a
+    // snapshot, may ask to be told every so often that they are idle
+    template <class worker>
+    auto idle_interval(worker const & work, int)
+        -> decltype(std::chrono::milliseconds(work.idle_interval()))
+    {
+        return work.idle_interval();
+    }
+
+    template <class worker>
+    auto idle_interval(worker const &, long) -> std::chrono::milliseconds
+    {
+        return std::chrono::milliseconds{0};
+    }
+
+    template <class worker>
+    auto idle(worker & work, int) -> decltype(work.idle())
+    {
+        work.idle();
+    }
+
+    template <class worker>
+    auto idle(worker &, long) -> void {}
+
+    // How the reply to a request has to be encoded
+    struct encoding
+    {
+        bool shared;
+        bool compressed;
+    };
+
+    // Replies are encoded the same way as the request they answer,
+    // whose flags they carry
+    auto inline flags_of(msg::many_parts const & metadata) -> encoding
+    {
+        return {shm::detail::has_flag(metadata), compression::detail::has_flag(metadata)};
+    }
+
+    // Compresses the payload of a message, then exports it to shared
+    // memory, so that the message is only read and sent once
+    struct encoder
+    {
+        encoding how;
+        shm::ring * ring;
+
+        template <class message>
+        auto operator()(message & m) const -> void {
+            if (how.compressed) {
+                compression::compress(m);
+            }
+            if (how.shared) {
+                ring->export_parts(m);
+            }
+        }
+    };
+
+    // Several assistants may run the same worker, for example in a
+    // component pool, so they share a logger
+    auto inline shared_logger(std::string const & name)
+        -> std::shared_ptr<spdlog::logger>
+    {
+        auto logger = spdlog::get(name);
+        if (logger) {
+            return logger;
+        }
+        try {
+            return spdlog::stdout_color_mt(name);
+        } catch (spdlog::spdlog_ex &) {
+            // Another thread created it first
+            return spdlog::get(name);
+        }
+    }
+}
+
+
 /*! \brief An assistant for running workers.
  *
  * Creates a socket, and handles sending pings to avoid timeouts.
  *
  * The `worker` class must have a public constructor, a member
  * `std::string const service_name` and a method `operator()(msg::request && request) -> std::vector<zmq::message_t>`.
- * See [datastore](\ref data::datastore) for an example.
+ * See [datastore](\ref data::datastore) for an example. Workers that
+ * provide several services also list them in
+ * `std::vector<std::string> service_names`, and are registered for
+ * all of them, see [multi_service](\ref multi_service). Workers that
+ * send their results in chunks may instead take a
+ * [reply_stream](\ref reply_stream) as a second argument, and return
+ * a producer of the chunks. Workers that need results from other
+ * services may instead take a [requester](\ref requester), and reply
+ * through it once they are done. The requests they send expire after
+ * ten heartbeat intervals without a reply.
+ *
+ * Workers may also provide a method
+ * `operator()(std::vector<msg::request> && requests) -> std::vector<msg::part_source>`,
+ * which returns one reply for each request, in the same order. The
+ * assistant will then collect all requests already waiting on its
+ * socket, up to `max_batch` of them, and pass them to the worker at
+ * once. This allows the worker to share work between requests, such
+ * as an LMDB transaction. Each reply is still sent to its own client.
+ *
+ * Such workers may also have the members
+ * `std::chrono::milliseconds batch_window` and
+ * `std::size_t batch_bytes`. The assistant then holds a batch back
+ * for up to `batch_window` after its first request arrives, unless
+ * the data of its requests reaches `batch_bytes` first, see
+ * [writer](\ref data::writer). Such workers register with a
+ * concurrency of `max_batch`, so that the broker keeps sending them
+ * requests while a batch is held back.
+ *
+ * Workers that hold on to resources between requests may provide the
+ * methods `idle_interval() const -> std::chrono::milliseconds` and
+ * `idle() -> void`. The assistant then calls `idle` every
+ * `idle_interval`, between requests, see [reader](\ref data::reader).
+ *
+ * If the worker throws an exception while processing a request, the
+ * assistant replies to it with an error, see
+ * [make_error_reply](\ref msg::make_error_reply). A worker that
+ * fails to process a batch fails every request in it.
  */
 template <class worker>
 class assistant
@@ -53,20 +259,274 @@ class assistant
 
     auto register_worker() -> sendable
     {
-        return msg::send(msg::registration::make(work.service_name));
+        // Workers that accept batches can only be given one if the
+        // broker sends them several requests at once. Workers that
+        // wait for other services can take requests in the meantime.
+        uint32_t concurrency = detail_assistant::accepts_batch<worker>::value
+            || detail_assistant::accepts_requester<worker>::value ? max_batch : 1;
+        return msg::send(msg::registration::make(service_names(work), concurrency));
     }
 
     worker work;
+    std::chrono::milliseconds const heartbeat_interval;
     class socket sock;
-    std::shared_ptr<spdlog::logger> logger = spdlog::stdout_color_st(work.service_name + " assistant");
+    heartbeat beat;
+    shm::importer importer;
+    // Only created once a client asks for shared memory
+    std::unique_ptr<shm::ring> ring;
+    // Requests waiting to be passed to the worker together
+    std::vector<msg::request> batch;
+    std::vector<detail_assistant::encoding> batch_encodings;
+    // What is needed to reply to them if the worker fails
+    std::vector<msg::request> batch_failed;
+    std::size_t batch_size;
+    std::chrono::milliseconds const batch_window;
+    std::size_t const batch_bytes;
+    // Only set once attached to a reactor, batches are flushed as
+    // soon as the socket is drained otherwise
+    reactor * batch_loop;
+    reactor::timer_id batch_timer;
+    // Set while withdrawing from the broker, until it confirms
+    bool draining;
+    // Requests the worker sent to other services
+    requester subrequests;
+    // Streams of partial replies that wait for credit, by their names
+    struct open_stream
+    {
+        reply_stream stream;
+        reply_stream::producer produce;
+        // What is needed to reply if the stream fails
+        msg::request failed;
+        detail_assistant::encoding how;
+        detail_time::time last_credit;
+        // Sent once the chunks held back by the stream are
+        boost::optional<sendable> finished;
+    };
+    std::unordered_map<msg::address, open_stream> streams;
+    std::chrono::milliseconds const stall_timeout;
+    // Only set once attached to a reactor, streams don't stall
+    // otherwise
+    reactor * stream_loop;
+    reactor::timer_id stall_timer;
+
+    // Everything sent to the broker counts as a heartbeat
+    auto send(sendable && parts) -> void {
+        sock.send_multimsg(std::move(parts));
+        beat.sent();
+    }
+
+    auto shared_ring() -> shm::ring & {
+        if (!ring) {
+            ring.reset(new shm::ring());
+        }
+        return *ring;
+    }
+
+    auto encode(msg::part_source && parts, detail_assistant::encoding how)
+        -> msg::part_source
+    {
+        if (!how.compressed && !how.shared) {
+            return std::move(parts);
+        }
+        auto ring = how.shared ? &shared_ring() : nullptr;
+        return msg::modify_payload(std::move(parts), detail_assistant::encoder{how, ring});
+    }
+
+    template <class message>
+    auto decode(message & msg) -> detail_assistant::encoding {
+        auto shared = importer.import_parts(msg);
+        auto compressed = compression::decompress(msg);
+        return {shared, compressed};
+    }
+
+    // A request the worker failed to process is still answered, so
+    // that neither the client nor the broker keeps waiting for it
+    auto fail(msg::request && failed, std::exception const & e,
+              detail_assistant::encoding how)
+        -> msg::part_source
+    {
+        logger->error("Failed to process a request for {}: {}", failed.service(), e.what());
+        return encode(msg::send(msg::make_error_reply(std::move(failed), e.what())), how);
+    }
+
+    // Workers without a batch interface process each request as it
+    // arrives
+    auto take(msg::request & msg, detail_assistant::encoding how, std::false_type)
+        -> maybe_sendable
+    {
+        auto failed = msg::copy_without_data(msg);
+        try {
+            return respond(msg, failed, how, detail_assistant::accepts_stream<worker>());
+        } catch (std::exception & e) {
+            return fail(std::move(failed), e, how);
+        }
+    }
+
+    auto respond(msg::request & msg, msg::request &, detail_assistant::encoding how,
+                 std::false_type)
+        -> maybe_sendable
+    {
+        auto reply = detail_assistant::call(work, std::move(msg), subrequests, 0);
+        if (reply.size() == 0) {
+            return boost::none;
+        }
+        return encode(std::move(reply), how);
+    }
+
+    // Workers that stream their replies produce them as the client
+    // allows, while the assistant goes on with other messages
+    auto respond(msg::request & msg, msg::request & failed, detail_assistant::encoding how,
+                 std::true_type)
+        -> maybe_sendable
+    {
+        reply_stream stream(msg,
+                            [this](msg::part_source && parts) {
+                                send(std::move(parts));
+                            },
+                            [this, how](msg::part_source && parts) {
+                                return encode(std::move(parts), how);
+                            });
+        auto name = stream.name();
+        if (streams.count(name) > 0) {
+            throw std::runtime_error("A stream for the same request is already open");
+        }
+        auto found = streams.emplace(name, open_stream{
+                std::move(stream), nullptr, msg::copy_without_data(failed), how,
+                detail_time::time_now(), boost::none}).first;
+        try {
+            found->second.produce = work(std::move(msg), found->second.stream);
+        } catch (...) {
+            streams.erase(found);
+            throw;
+        }
+        if (stream_loop != nullptr && streams.size() == 1) {
+            stream_loop->reset_timer(stall_timer);
+        }
+        advance(found);
+        return boost::none;
+    }
+
+    // Run the producer of a stream while it has credit, and end the
+    // stream once its final reply can be sent
+    auto advance(typename std::unordered_map<msg::address, open_stream>::iterator found)
+        -> void
+    {
+        auto & opened = found->second;
+        try {
+            if (!opened.finished && opened.stream.remaining_credit() > 0) {
+                auto reply = opened.produce(opened.stream);
+                if (reply) {
+                    opened.finished = encode(std::move(*reply), opened.how);
+                }
+            }
+        } catch (std::exception & e) {
+            send(fail(std::move(opened.failed), e, opened.how));
+            streams.erase(found);
+            return;
+        }
+        // Chunks held back are sent before the final reply
+        if (opened.finished && opened.stream.held_chunks() == 0) {
+            send(std::move(*opened.finished));
+            streams.erase(found);
+        }
+    }
+
+    // Streams whose client stopped sending credit are ended with an
+    // error, so that the broker frees the worker
+    auto end_streams(std::string const & why, bool stalled_only) -> void {
+        auto now = detail_time::time_now();
+        auto iter = streams.begin();
+        while (iter != streams.end()) {
+            auto & opened = iter->second;
+            if (stalled_only && now - opened.last_credit < stall_timeout) {
+                ++iter;
+                continue;
+            }
+            logger->warn("Ending a stream of {}: {}", work.service_name, why);
+            send(encode(msg::send(msg::make_error_reply(std::move(opened.failed), why)),
+                        opened.how));
+            iter = streams.erase(iter);
+        }
+        if (stream_loop != nullptr && streams.empty()) {
+            stream_loop->cancel_timer(stall_timer);
+        }
+    }
+
+    auto take(msg::request & msg, detail_assistant::encoding how, std::true_type)
+        -> maybe_sendable
+    {
+        batch_encodings.push_back(how);
+        batch_failed.push_back(msg::copy_without_data(msg));
+        for (auto & p : msg.data()) {
+            batch_size += p.size();
+        }
+        batch.push_back(std::move(msg));
+        if (batch.size() == 1 && batch_loop != nullptr) {
+            // The window starts with the first request of a batch
+            batch_loop->reset_timer(batch_timer, batch_window);
+        }
+        return boost::none;
+    }
+
+    auto batch_full() const -> bool {
+        return batch.size() >= max_batch
+            || (batch_bytes > 0 && batch_size >= batch_bytes);
+    }
+
+    auto flush_batch(std::false_type) -> void {}
+
+    auto flush_batch(std::true_type) -> void {
+        if (batch.size() == 0) {
+            return;
+        }
+        std::vector<msg::request> requests;
+        std::vector<detail_assistant::encoding> encodings;
+        std::vector<msg::request> failed;
+        std::swap(requests, batch);
+        std::swap(encodings, batch_encodings);
+        std::swap(failed, batch_failed);
+        batch_size = 0;
+        if (batch_loop != nullptr) {
+            // Nothing is held back until the next batch starts
+            batch_loop->cancel_timer(batch_timer);
+        }
+        std::vector<msg::part_source> replies;
+        try {
+            replies = work(std::move(requests));
+        } catch (std::exception & e) {
+            for (std::size_t i = 0; i < failed.size(); ++i) {
+                send(fail(std::move(failed[i]), e, encodings[i]));
+            }
+            return;
+        }
+        if (replies.size() != encodings.size()) {
+            logger->error("Worker returned {} replies for {} requests",
+                          replies.size(), encodings.size());
+        }
+        for (std::size_t i = 0; i < replies.size() && i < encodings.size(); ++i) {
+            send(encode(std::move(replies[i]), encodings[i]));
+        }
+    }
+
+    auto handle(msg::any_message & message) -> void {
+        auto maybe_reply = boost::apply_visitor(*this, message);
+        if (maybe_reply) {
+            send(std::move(*maybe_reply));
+        }
+    }
+    std::shared_ptr<spdlog::logger> logger;
 public:
+    /*! \brief The most requests that are passed to a worker at once. */
+    std::size_t const static max_batch = 64;
+
     /*! \brief Create an assistant that runs the `worker`.
      *
      * \param ctx 0MQ context the assistant will run in.
      * \param broker_addr The address of the broker the assistant
      * should connect to.
-     * \param worker_timeout Time in miliseconds the broker will
-     * consider a worker dead if there hasn't been any communication.
+     * \param worker_timeout Time in miliseconds between heartbeats
+     * sent to the broker. This should be less than the time after
+     * which the broker will consider a worker dead.
      * \param args The arguments to be passed to the constructor of
      * the worker.
      */
@@ -76,43 +536,135 @@ public:
               int worker_timeout,
               Args ... args)
         : work(args...),
+          heartbeat_interval(worker_timeout),
           sock(ctx, socket_type),
-          logger(spdlog::stdout_color_st(work.service_name + " assistant"))
+          beat(heartbeat_interval),
+          batch_size(0),
+          batch_window(detail_assistant::batch_window(work, 0)),
+          batch_bytes(detail_assistant::batch_bytes(work, 0)),
+          batch_loop(nullptr),
+          batch_timer(0),
+          draining(false),
+          subrequests([this](msg::part_source && parts) {
+                  send(std::move(parts));
+              },
+              [this](msg::reply && reply) {
+                  auto how = detail_assistant::flags_of(reply.metadata());
+                  send(encode(msg::send(std::move(reply)), how));
+              },
+              10 * heartbeat_interval),
+          stall_timeout(10 * heartbeat_interval),
+          stream_loop(nullptr),
+          stall_timer(0),
+          logger(detail_assistant::shared_logger(work.service_name + " assistant"))
     {
-        // Timeout on recv so we can stop waiting and send a ping to the
-        // broker
-        sock.setsockopt(ZMQ_RCVTIMEO, worker_timeout);
         sock.connect(broker_addr);
 
         sock.send_multimsg(register_worker());
     }
 
-    /*! \brief Run the worker for one iteration.
+    /*! \brief Run the worker on a reactor.
      *
-     * The assistant will first try to accept a message from the
-     * broker. If the message is a request then it will be passed to
-     * the worker, otherwise it will be handled by the assistant.
+     * Whenever a message arrives from the broker, requests are passed
+     * to the worker, and other messages are handled by the assistant.
      * Depending on the message, the assistant may or may not send a
-     * message in response.
+     * message in response. Heartbeats are only sent to the broker
+     * when the assistant hasn't sent anything else for a while, see
+     * [heartbeat](\ref heartbeat).
+     *
+     * Instead of calling this function directly, consider using
+     * [component](\ref component) to run the assistant.
      */
-    auto run() -> void {
-        auto received = sock.recv_multimsg();
-        if (received.size() == 0) {
-            // Check if the broker is still alive
-            sock.send_multimsg(msg::send(msg::ping::make()));
-        } else {
-            // If the recv didn't time out
+    auto attach(reactor & loop) -> void {
+        loop.add_socket(sock, [this](){ receive(); });
+        beat.attach(loop, [this](){
+                // Check if the broker is still alive
+                sock.send_multimsg(msg::send(msg::ping::make()));
+            });
+        if (batch_window.count() > 0) {
+            batch_loop = &loop;
+            batch_timer = loop.add_timer(batch_window, [this](){
+                    flush_batch(detail_assistant::accepts_batch<worker>());
+                });
+            // The timer only runs while a batch is held back
+            loop.cancel_timer(batch_timer);
+        }
+        if (detail_assistant::accepts_stream<worker>::value) {
+            stream_loop = &loop;
+            stall_timer = loop.add_timer(heartbeat_interval, [this](){
+                    end_streams("The client stopped reading the stream", true);
+                });
+            // The timer only runs while a stream is open
+            loop.cancel_timer(stall_timer);
+        }
+        if (detail_assistant::accepts_requester<worker>::value) {
+            loop.add_timer(heartbeat_interval, [this](){ subrequests.expire(); });
+        }
+        auto idle_interval = detail_assistant::idle_interval(work, 0);
+        if (idle_interval.count() > 0) {
+            loop.add_timer(idle_interval, [this](){ detail_assistant::idle(work, 0); });
+        }
+    }
+
+    /*! \brief Finish the requests the worker has already been given.
+     *
+     * Called by [component](\ref component) once its reactor has
+     * stopped. The assistant withdraws from the broker by registering
+     * again with no concurrency, so that it isn't given any more
+     * requests. It keeps handling the requests that arrive until the
+     * broker confirms, then processes any batch that is held back.
+     * If the broker doesn't confirm within a heartbeat interval, for
+     * example because it has stopped too, the assistant stops
+     * waiting.
+     */
+    auto drain() -> void {
+        draining = true;
+        send(msg::send(msg::registration::make(service_names(work), 0)));
+        auto deadline = detail_time::time_now() + heartbeat_interval;
+        while (draining) {
+            auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - detail_time::time_now()).count();
+            if (remaining <= 0) {
+                logger->warn("Broker didn't confirm the withdrawal of {}", work.service_name);
+                break;
+            }
+            zmq::pollitem_t item = {static_cast<void *>(sock), 0, ZMQ_POLLIN, 0};
+            zmq::poll(&item, 1, remaining);
+            if (item.revents & ZMQ_POLLIN) {
+                receive();
+            }
+        }
+        flush_batch(detail_assistant::accepts_batch<worker>());
+        end_streams("The worker stopped before finishing the stream", false);
+    }
+
+    /*! \brief Handle all messages that are waiting on the socket. */
+    auto receive() -> void {
+        while (true) {
+            auto received = sock.recv_multimsg(ZMQ_DONTWAIT);
+            if (received.size() == 0) {
+                // A batch that is held back is flushed by its timer
+                if (batch_loop == nullptr) {
+                    flush_batch(detail_assistant::accepts_batch<worker>());
+                }
+                return;
+            }
             auto message = msg::read(std::move(received));
-            auto maybe_reply = boost::apply_visitor(*this, message);
-            if (maybe_reply) {
-                sock.send_multimsg(std::move(*maybe_reply));
+            handle(message);
+            if (batch_full()) {
+                flush_batch(detail_assistant::accepts_batch<worker>());
             }
         }
     }
 
     /*! \brief Process a registration message. */
-    auto operator()(msg::registration & msg) -> maybe_sendable {
-        logger->debug("Successfully registered for service {}", msg.service());
+    auto operator()(msg::registration &) -> maybe_sendable {
+        if (draining) {
+            // Every request the broker sent before this has arrived
+            draining = false;
+            return boost::none;
+        }
+        logger->debug("Successfully registered for service {}", work.service_name);
         return boost::none;
     }
 
@@ -126,18 +678,67 @@ public:
         return boost::none;
     }
 
-    /*! \brief Process a work request. */
+    /*! \brief Process a work request.
+     *
+     * If the client asked for compression or shared memory, the
+     * worker gets the request with its data parts restored, and its
+     * reply is encoded the same way before being sent back. Workers
+     * that accept batches get the request once the socket has been
+     * drained. Requests whose data parts can't be restored are
+     * replied to with an error without reaching the worker.
+     */
     auto operator()(msg::request & msg) -> maybe_sendable {
-        return work(std::move(msg));
+        detail_assistant::encoding how;
+        try {
+            how = decode(msg);
+        } catch (msg::exception::malformed & e) {
+            return fail(msg::copy_without_data(msg), e,
+                        detail_assistant::flags_of(msg.metadata()));
+        }
+        return take(msg, how, detail_assistant::accepts_batch<worker>());
     }
 
-    /*! \brief Process a work reply. */
-    auto operator()(msg::reply &) -> maybe_sendable {
-        logger->warn("Recieved unexpected reply");
+    /*! \brief Process the reply to a request the worker has sent.
+     *
+     * Replies whose data parts can't be restored are dropped.
+     */
+    auto operator()(msg::reply & msg) -> maybe_sendable {
+        try {
+            decode(msg);
+        } catch (msg::exception::malformed & e) {
+            logger->warn("Dropping a malformed reply: {}", e.what());
+            return boost::none;
+        }
+        if (!subrequests.resolve(std::move(msg))) {
+            logger->warn("Recieved unexpected reply");
+        }
         return boost::none;
     }
     /*! \brief Process a reconnect message. */
     auto operator()(msg::reconnect &) -> maybe_sendable {
         return register_worker();
     }
+
+    /*! \brief Process a partial reply. */
+    auto operator()(msg::partial &) -> maybe_sendable {
+        logger->warn("Recieved unexpected partial reply");
+        return boost::none;
+    }
+
+    /*! \brief Process a credit for a stream.
+     *
+     * The chunks the stream held back are sent first, then its
+     * producer is called if there is credit left. Credit for streams
+     * that have already ended is dropped.
+     */
+    auto operator()(msg::credit & msg) -> maybe_sendable {
+        auto found = streams.find(msg.stream());
+        if (found == streams.end()) {
+            return boost::none;
+        }
+        found->second.last_credit = detail_time::time_now();
+        found->second.stream.add_credit(msg.amount());
+        advance(found);
+        return boost::none;
+    }
 };
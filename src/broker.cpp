@@ -40,58 +40,133 @@ auto get_addr_ensure(message & msg) -> msg::address
 // popped is undefined. If the set is empty, calling this function on
 // it is undefined behaviour.
 template <class T>
-auto pop_any(std::unordered_set<T> & set) -> T &&
+auto pop_any(std::unordered_set<T> & set) -> T
 {
     auto iter = begin(set);
     auto elem = std::move(*iter);
     set.erase(iter);
-    return std::move(elem);
+    return elem;
 }
 
 
 broker::broker(zmq::context_t & ctx,
                std::string const & addr,
                std::chrono::milliseconds worker_timeout)
-    : addr(addr),
+    : broker(ctx, std::vector<std::string>{addr}, worker_timeout)
+{}
+
+
+broker::broker(zmq::context_t & ctx,
+               std::vector<std::string> const & addrs,
+               std::chrono::milliseconds worker_timeout)
+    : addrs(addrs),
       worker_timeout(worker_timeout),
       sock(ctx, socket_type)
 {
-    sock.setsockopt(ZMQ_RCVTIMEO, run_max_wait_ms);
-    sock.bind(addr);
+    for (auto & addr : addrs) {
+        sock.bind(addr);
+    }
 }
 
 
-auto broker::run() -> void
+auto broker::attach(reactor & loop) -> void
 {
-    auto received = sock.recv_multimsg();
-    if (received.size() == 0) {
-        // recv timed out, there is no message to process
-        return;
+    loop.add_socket(sock, [this](){ receive(); });
+    loop.add_timer(worker_timeout, [this](){ purge_workers(); });
+}
+
+
+auto broker::receive() -> void
+{
+    while (true) {
+        auto received = sock.recv_multimsg(ZMQ_DONTWAIT);
+        if (received.size() == 0) {
+            // No more messages waiting
+            return;
+        }
+        auto message = msg::read(std::move(received));
+        boost::apply_visitor(*this, message);
+
+        // Processing the message may result in 0 or more messages
+        // that need to be sent
+        while (send_queue.size() > 0) {
+            sock.send_multimsg(std::move(send_queue.front()));
+            send_queue.pop();
+        }
     }
-    auto message = msg::read(std::move(received));
-    boost::apply_visitor(*this, message);
+}
 
-    // Processing the message may result in 0 or more messages
-    // that need to be sent
-    while (send_queue.size() > 0) {
-        sock.send_multimsg(std::move(send_queue.front()));
-        send_queue.pop();
+
+auto broker::purge_workers() -> void
+{
+    auto now = detail_time::time_now();
+    auto iter = begin(workers);
+    while (iter != end(workers)) {
+        auto & worker = iter->second;
+        if ((now - worker.last_seen) >= worker_timeout) {
+            withdraw(worker);
+            streams.erase(worker.address);
+            iter = workers.erase(iter);
+        } else {
+            ++iter;
+        }
     }
 }
 
 
-auto broker::free_worker(worker const & worker) -> void
+auto broker::assign(worker & worker, msg::request && request) -> void
 {
-    auto & pending = pending_requests[worker.service];
-    if (pending.size() == 0) {
-        // No pending work, add to free_workers to wait for work to arrive
-        free_workers[worker.service].insert(worker.address);
-        return;
-    } else {
-        // Pending work, immediately assign the work
-        auto request = std::move(pending.front());
-        pending.pop();
-        send_queue.push(msg::send(request));
+    request.address(worker.address);
+    ++worker.in_flight;
+    send_queue.push(msg::send(std::move(request)));
+}
+
+
+auto broker::release(worker & worker) -> void
+{
+    if (worker.in_flight > 0) {
+        --worker.in_flight;
+    }
+    free_worker(worker);
+}
+
+
+auto broker::free_worker(worker & worker) -> void
+{
+    // Immediately assign any pending work the worker has room for
+    for (auto & service : worker.services) {
+        auto & pending = pending_requests[service];
+        while (pending.size() > 0 && worker.in_flight < worker.capacity) {
+            auto request = std::move(pending.front());
+            pending.pop();
+            assign(worker, std::move(request));
+        }
+    }
+    // Add to free_workers to wait for more work to arrive
+    if (worker.in_flight < worker.capacity) {
+        for (auto & service : worker.services) {
+            free_workers[service].insert(worker.address);
+        }
+    }
+}
+
+
+auto broker::withdraw(worker & worker) -> void
+{
+    // A worker with several services is free under each of them
+    for (auto & service : worker.services) {
+        free_workers[service].erase(worker.address);
+    }
+}
+
+
+auto broker::seen(msg::address const & addr) -> void
+{
+    // Any message from a worker shows that it is alive, so workers
+    // only need to ping when they have nothing else to send
+    auto found = workers.find(addr);
+    if (found != workers.end()) {
+        found->second.last_seen = detail_time::time_now();
     }
 }
 
@@ -103,10 +178,15 @@ auto broker::get_worker(decltype(free_workers[""]) & available_workers)
         return boost::none;
     }
     auto worker_addr = pop_any(available_workers);
-    auto & worker = workers[worker_addr];
+    auto found = workers.find(worker_addr);
+    if (found == workers.end()) {
+        return get_worker(available_workers);
+    }
+    auto & worker = found->second;
     if ((detail_time::time_now() - worker.last_seen) >= worker_timeout) {
         // Worker is likely dead, remove it and find a new one
-        workers.erase(worker_addr);
+        withdraw(worker);
+        workers.erase(found);
         return get_worker(available_workers);
     }
     return worker;
@@ -115,12 +195,18 @@ auto broker::get_worker(decltype(free_workers[""]) & available_workers)
 
 auto broker::operator()(msg::registration & msg) -> void
 {
-    auto serv = msg.service();
     auto addr = get_addr_ensure(msg);
+    auto existing = workers.find(addr);
+    if (existing != workers.end()) {
+        // The worker may be registering different services this time
+        withdraw(existing->second);
+    }
     workers[addr] = {
         .address = addr,
-        .service = serv,
+        .services = msg.services(),
         .last_seen = detail_time::time_now(),
+        .capacity = msg.concurrency(),
+        .in_flight = 0,
     };
     send_queue.push(msg::send(msg));
     free_worker(workers[addr]);
@@ -144,8 +230,7 @@ auto broker::operator()(msg::ping & msg) -> void
 
 auto broker::operator()(msg::pong & msg) -> void
 {
-    auto addr = get_addr_ensure(msg);
-    workers[addr].last_seen = detail_time::time_now();
+    seen(get_addr_ensure(msg));
 }
 
 
@@ -157,11 +242,9 @@ auto broker::operator()(msg::request & msg) -> void
     if (!msg.client()) {
         msg.client(addr);
     }
-    // If the request came from a worker, mark the worker as free
-    auto maybe_worker = workers.find(addr);
-    if (maybe_worker != workers.end()) {
-        free_worker(maybe_worker->second);
-    }
+    // A worker sending a request is still busy with the one it was
+    // given, which is only done once its reply arrives
+    seen(addr);
     // Are there any workers who provide this service?
     auto service_name = msg.service();
     auto maybe_workers = free_workers.find(service_name);
@@ -174,8 +257,16 @@ auto broker::operator()(msg::request & msg) -> void
     auto & available_workers = maybe_workers->second;
     auto found_worker = get_worker(available_workers);
     if (found_worker) {
-        msg.address(found_worker->address);
-        send_queue.push(msg::send(std::move(msg)));
+        auto & worker = *found_worker;
+        assign(worker, std::move(msg));
+        // Workers that run several requests at once stay available
+        // until all of their slots are taken, which they share
+        // between all of their services
+        if (worker.in_flight < worker.capacity) {
+            available_workers.insert(worker.address);
+        } else {
+            withdraw(worker);
+        }
     } else {
         pending_requests[service_name].push(std::move(msg));
     }
@@ -184,11 +275,15 @@ auto broker::operator()(msg::request & msg) -> void
 
 auto broker::operator()(msg::reply & msg) -> void
 {
-    // Mark the worker who sent the reply as free
+    // Mark the worker who sent the reply as free. If the worker has
+    // timed out in the meantime, it will have to register again.
     auto addr = get_addr_ensure(msg);
-    auto & worker = workers[addr];
-    worker.last_seen = detail_time::time_now();
-    free_worker(worker);
+    auto worker_ = workers.find(addr);
+    if (worker_ != workers.end()) {
+        auto & worker = worker_->second;
+        worker.last_seen = detail_time::time_now();
+        release(worker);
+    }
     // Send the reply to the client
     auto client = msg.client();
     if (!client) {
@@ -196,6 +291,14 @@ auto broker::operator()(msg::reply & msg) -> void
         // broker.
         throw msg::exception::malformed("Recieved a reply that has no client");
     }
+    // The reply ends the stream of its request, if there was one
+    auto worker_streams = streams.find(addr);
+    if (worker_streams != streams.end()) {
+        worker_streams->second.erase(*client + msg::stream_suffix(msg.metadata()));
+        if (worker_streams->second.empty()) {
+            streams.erase(worker_streams);
+        }
+    }
     msg.address(*client);
     send_queue.push(msg::send(msg));
 }
@@ -205,3 +308,50 @@ auto broker::operator()(msg::reconnect &) -> void
 {
     logger->warn("Recieved a reconnect message, which is for workers only");
 }
+
+
+
+auto broker::operator()(msg::partial & msg) -> void
+{
+    // The worker stays busy until the final reply arrives
+    auto addr = get_addr_ensure(msg);
+    seen(addr);
+    auto client = msg.client();
+    if (!client) {
+        throw msg::exception::malformed("Recieved a partial reply "
+                                        "that has no client");
+    }
+    // A worker may stream to several requests of the same client,
+    // which are told apart by their request IDs
+    auto suffix = msg::stream_suffix(msg.metadata());
+    streams[addr].insert(*client + suffix);
+    // The client needs to know which stream to send credits to
+    msg.client(addr + suffix);
+    msg.address(*client);
+    send_queue.push(msg::send(msg));
+}
+
+
+auto broker::operator()(msg::credit & msg) -> void
+{
+    auto addr = get_addr_ensure(msg);
+    auto name = msg.stream();
+    if (name.size() < msg::stream_suffix_size) {
+        logger->warn("Recieved a credit for a stream with a malformed name");
+        return;
+    }
+    auto split = name.size() - msg::stream_suffix_size;
+    auto worker_addr = name.substr(0, split);
+    // The worker knows the stream by the client it is sent to
+    auto worker_name = addr + name.substr(split);
+    auto worker_streams = streams.find(worker_addr);
+    if (worker_streams == streams.end()
+        || worker_streams->second.count(worker_name) == 0) {
+        // The stream has already ended, or never belonged to the
+        // sender of the credit
+        return;
+    }
+    msg.stream(worker_name);
+    msg.address(worker_addr);
+    send_queue.push(msg::send(msg));
+}
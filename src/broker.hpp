@@ -20,6 +20,7 @@
 
 #include <string>
 #include <tuple>
+#include <vector>
 #include <queue>
 #include <unordered_set>
 #include <unordered_map>
@@ -28,6 +29,7 @@
 #include <zmq.hpp>
 #include "message.hpp"
 #include "socket.hpp"
+#include "reactor.hpp"
 #include "helpers.hpp"
 
 
@@ -45,27 +47,36 @@ class broker
     struct worker
     {
         msg::address address;
-        std::string service;
+        std::vector<std::string> services;
         detail_time::time last_seen;
+        // How many requests the worker can handle at once, and how
+        // many it is currently handling
+        uint32_t capacity;
+        uint32_t in_flight;
     };
 
-    std::string const addr;
+    std::vector<std::string> const addrs;
     auto const static socket_type = zmq::socket_type::router;
     std::chrono::milliseconds const worker_timeout;
-    // The number of miliseconds the broker should wait at most for a
-    // new message to arrive. `component` class will have to wait at
-    // most this many miliseconds before terminating the broker.
-    int run_max_wait_ms = 200;
     class socket sock;
     std::queue<msg::part_source> send_queue;
 
     std::unordered_map<msg::address, worker> workers;
     std::unordered_map<std::string, std::unordered_set<msg::address>> free_workers;
     std::unordered_map<std::string, std::queue<msg::request>> pending_requests;
+    // The streams each worker is sending, named as the worker knows
+    // them: the address of the client and a stream suffix
+    std::unordered_map<msg::address, std::unordered_set<msg::address>> streams;
 
-    auto free_worker(worker const & worker) -> void;
+    auto assign(worker & worker, msg::request && request) -> void;
+    auto free_worker(worker & worker) -> void;
+    auto withdraw(worker & worker) -> void;
+    auto seen(msg::address const & addr) -> void;
+    auto release(worker & worker) -> void;
     auto get_worker(decltype(free_workers[""]) & available_workers)
         -> boost::optional<worker &>;
+    auto receive() -> void;
+    auto purge_workers() -> void;
 public:
     /*! \brief Process a registration message. */
     auto operator()(msg::registration & msg) -> void;
@@ -79,6 +90,10 @@ public:
     auto operator()(msg::reply        & msg) -> void;
     /*! \brief Process a reconnect message. */
     auto operator()(msg::reconnect    & msg) -> void;
+    /*! \brief Process a partial reply. */
+    auto operator()(msg::partial      & msg) -> void;
+    /*! \brief Process a credit message for a stream. */
+    auto operator()(msg::credit       & msg) -> void;
 
     /*! \brief Create a message broker.
      *
@@ -96,14 +111,27 @@ public:
            std::string const & addr,
            std::chrono::milliseconds worker_timeout);
 
-    /*! \brief Run the message broker for one iteration.
+    /*! \brief Create a message broker that listens on several addresses.
      *
-     * This function should be called repeatedly to run the
-     * broker. When called, if there are no messages to be recieved,
-     * it will wait for some time.
+     * Workers and clients may connect to any of the addresses, for
+     * example an `inproc://` address for workers running in the same
+     * process and a `tcp://` address for everything else.
+     *
+     * \param ctx The 0MQ context the broker should run in.
+     * \param addrs The addresses the broker should bind to.
+     * \param worker_timeout See the constructor above.
+     */
+    broker(zmq::context_t & ctx,
+           std::vector<std::string> const & addrs,
+           std::chrono::milliseconds worker_timeout);
+
+    /*! \brief Run the message broker on a reactor.
+     *
+     * The broker will handle messages whenever they arrive, and
+     * periodically remove workers that have timed out.
      *
      * Instead of calling this function directly, consider using
      * [component](\ref component) to run the broker.
      */
-    auto run() -> void;
+    auto attach(reactor & loop) -> void;
 };
@@ -0,0 +1,142 @@
+/*
+  Copyright 2017 Kaan Genç
+
+  This file is part of DagBox.
+
+  DagBox is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  DagBox is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with DagBox.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <utility>
+#include <zmq.hpp>
+
+
+/*! \file buffer.hpp
+ * A buffer for packing message parts.
+ */
+
+
+namespace msg
+{
+    /*! \brief A buffer that becomes a message part without being
+     *  copied.
+     *
+     * msgpack can pack into it like into a `msgpack::sbuffer`. Once
+     * packing is done, [release](\ref buffer::release) hands the
+     * memory to a message part, which frees it after 0MQ has sent
+     * it.
+     *
+     * ```
+     * msg::buffer buf;
+     * msgpack::pack(buf, reply);
+     * parts.push_back(buf.release());
+     * ```
+     */
+    class buffer
+    {
+        char * bytes;
+        std::size_t length;
+        std::size_t capacity;
+
+        static auto free_bytes(void * data, void *) -> void
+        {
+            std::free(data);
+        }
+
+        auto grow(std::size_t needed) -> void
+        {
+            auto new_capacity = capacity > 0 ? capacity : initial_capacity;
+            while (new_capacity < needed) {
+                new_capacity *= 2;
+            }
+            auto grown = static_cast<char *>(std::realloc(bytes, new_capacity));
+            if (grown == nullptr) {
+                throw std::bad_alloc();
+            }
+            bytes = grown;
+            capacity = new_capacity;
+        }
+    public:
+        /*! \brief The capacity of a buffer when something is first
+         *  written to it.
+         */
+        std::size_t const static initial_capacity = 256;
+
+        buffer() : bytes(nullptr), length(0), capacity(0) {}
+
+        ~buffer()
+        {
+            std::free(bytes);
+        }
+
+        buffer(buffer const &) = delete;
+        auto operator=(buffer const &) -> buffer & = delete;
+
+        buffer(buffer && other) noexcept
+            : bytes(other.bytes), length(other.length), capacity(other.capacity)
+        {
+            other.bytes = nullptr;
+            other.length = other.capacity = 0;
+        }
+
+        auto operator=(buffer && other) noexcept -> buffer &
+        {
+            std::swap(bytes, other.bytes);
+            std::swap(length, other.length);
+            std::swap(capacity, other.capacity);
+            return *this;
+        }
+
+        /*! \brief Append bytes to the buffer, as msgpack does. */
+        auto write(char const * data, std::size_t size) -> void
+        {
+            if (length + size > capacity) {
+                grow(length + size);
+            }
+            std::memcpy(bytes + length, data, size);
+            length += size;
+        }
+
+        /*! \brief The bytes written so far. */
+        auto data() const noexcept -> char const *
+        {
+            return bytes;
+        }
+
+        /*! \brief The number of bytes written so far. */
+        auto size() const noexcept -> std::size_t
+        {
+            return length;
+        }
+
+        /*! \brief Turn the buffer into a message part.
+         *
+         * The part takes over the memory of the buffer, which is
+         * empty afterwards.
+         */
+        auto release() -> zmq::message_t
+        {
+            if (length == 0) {
+                return zmq::message_t();
+            }
+            zmq::message_t part(bytes, length, free_bytes, nullptr);
+            bytes = nullptr;
+            length = capacity = 0;
+            return part;
+        }
+    };
+};
@@ -0,0 +1,389 @@
+/*
+  Copyright 2017 Kaan Genç
+
+  This file is part of DagBox.
+
+  DagBox is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  DagBox is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with DagBox.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <memory>
+#include <unistd.h>
+#include <fcntl.h>
+#include <spdlog/spdlog.h>
+#include "client.hpp"
+using namespace dagbox;
+
+
+namespace
+{
+    auto logger = spdlog::stdout_color_mt("client");
+}
+
+
+client::client(zmq::context_t & ctx,
+               std::string const & broker_addr,
+               std::chrono::milliseconds timeout,
+               unsigned retries)
+    : timeout(timeout),
+      retries(retries),
+      next_id(0),
+      outstanding(0),
+      submitted(nullptr),
+      sock(ctx, socket_type)
+{
+    int fds[2];
+    if (pipe(fds) != 0) {
+        throw ::exception::fatal("Unable to create the wakeup pipe of a client");
+    }
+    wakeup_read = fds[0];
+    wakeup_write = fds[1];
+    fcntl(wakeup_read, F_SETFL, fcntl(wakeup_read, F_GETFL) | O_NONBLOCK);
+    fcntl(wakeup_write, F_SETFL, fcntl(wakeup_write, F_GETFL) | O_NONBLOCK);
+
+    sock.connect(broker_addr);
+    loop.add_socket(sock, [this](){ receive(); });
+    loop.add_fd(wakeup_read, [this](){ take_submissions(); });
+    // Checking a few times per timeout keeps retries close to their
+    // deadline
+    loop.add_timer(std::max(std::chrono::milliseconds{1}, timeout / 4),
+                   [this](){ expire(); });
+    // Only runs while a coalesced request waits for more requests
+    flush_timer = loop.add_timer(std::chrono::milliseconds{1},
+                                 [this](){ flush_expired(); });
+    loop.cancel_timer(flush_timer);
+    thread = std::thread([this](){ loop.run(); });
+}
+
+
+client::~client()
+{
+    loop.stop();
+    thread.join();
+
+    auto stopped = std::make_exception_ptr(
+        exception::stopped("The client stopped before a reply arrived"));
+    for (auto & waiter : waiting) {
+        waiter.second.on_error(stopped);
+    }
+    for (auto & pending : batches) {
+        for (auto & m : pending.second.members) {
+            m.on_error(stopped);
+        }
+    }
+    auto sub = submitted.exchange(nullptr);
+    while (sub != nullptr) {
+        sub->on_error(stopped);
+        auto next = sub->next;
+        delete sub;
+        sub = next;
+    }
+    close(wakeup_read);
+    close(wakeup_write);
+}
+
+
+auto client::send(msg::request && request,
+                  reply_handler on_reply,
+                  error_handler on_error) -> void
+{
+    submission * sub;
+    auto found = coalesced.find(request.service());
+    if (found != coalesced.end() && request.metadata().empty()) {
+        sub = new submission{
+            0,
+            std::move(request.data()),
+            std::move(on_reply),
+            std::move(on_error),
+            found->first,
+            submitted.load(),
+        };
+    } else {
+        auto id = next_id++;
+        msg::set_request_id(request.metadata(), id);
+        sub = new submission{
+            id,
+            msg::send(std::move(request)),
+            std::move(on_reply),
+            std::move(on_error),
+            std::string(),
+            submitted.load(),
+        };
+    }
+    ++outstanding;
+    while (!submitted.compare_exchange_weak(sub->next, sub)) {}
+    // The thread of the client only needs waking up by the first
+    // submission, it takes all of them at once
+    if (sub->next == nullptr) {
+        char const signal = 0;
+        // If the pipe is full, the client is going to wake up anyway
+        auto written = write(wakeup_write, &signal, sizeof(signal));
+        (void) written;
+    }
+}
+
+
+auto client::coalesce(std::string const & service_name,
+                      std::size_t max_parts,
+                      std::chrono::microseconds max_delay) -> void
+{
+    coalesced[service_name] = {std::max<std::size_t>(max_parts, 1), max_delay};
+}
+
+
+auto client::request(msg::request && request) -> std::future<msg::reply>
+{
+    auto promise = std::make_shared<std::promise<msg::reply>>();
+    auto future = promise->get_future();
+    send(std::move(request),
+         [promise](msg::reply && reply) { promise->set_value(std::move(reply)); },
+         [promise](std::exception_ptr error) { promise->set_exception(error); });
+    return future;
+}
+
+
+auto client::pending() const noexcept -> std::size_t
+{
+    return outstanding.load();
+}
+
+
+auto client::transmit(in_flight & request) -> void
+{
+    request.deadline = detail_time::time_now() + timeout * (1u << request.attempts);
+    if (retries == 0) {
+        sock.send_multimsg(std::move(request.parts));
+        request.parts = msg::part_source();
+        return;
+    }
+    // The parts are kept in case the request needs to be sent again
+    msg::part_source copy;
+    copy.reserve(request.parts.size());
+    for (auto & p : request.parts) {
+        copy.push_back(msg::detail::copy_part(p));
+    }
+    sock.send_multimsg(std::move(copy));
+}
+
+
+auto client::take_submissions() -> void
+{
+    // The pipe has to be drained before taking the submissions,
+    // otherwise a wakeup for a later submission may be lost
+    char buffer[64];
+    while (read(wakeup_read, buffer, sizeof(buffer)) > 0) {}
+
+    // Submissions are stacked, so they are reversed to send them in
+    // the order they were made
+    submission * taken = nullptr;
+    auto sub = submitted.exchange(nullptr);
+    while (sub != nullptr) {
+        auto next = sub->next;
+        sub->next = taken;
+        taken = sub;
+        sub = next;
+    }
+    while (taken != nullptr) {
+        std::unique_ptr<submission> current(taken);
+        taken = taken->next;
+        if (current->service.empty()) {
+            auto & request = waiting[current->id] = {
+                std::move(current->parts),
+                std::move(current->on_reply),
+                std::move(current->on_error),
+                detail_time::time_now(),
+                0,
+                1,
+            };
+            transmit(request);
+            continue;
+        }
+
+        auto & config = coalesced.at(current->service);
+        auto found = batches.find(current->service);
+        if (found == batches.end()) {
+            found = batches.emplace(current->service, batch()).first;
+            found->second.deadline = detail_time::time_now() + config.max_delay;
+        }
+        auto & pending = found->second;
+        pending.members.push_back({
+            std::move(current->on_reply),
+            std::move(current->on_error),
+            current->parts.size(),
+        });
+        for (auto & p : current->parts) {
+            pending.data.push_back(std::move(p));
+        }
+        if (pending.data.size() >= config.max_parts) {
+            flush(found->first, std::move(pending));
+            batches.erase(found);
+        }
+    }
+    flush_expired();
+}
+
+
+auto client::flush_expired() -> void
+{
+    auto now = detail_time::time_now();
+    auto iter = begin(batches);
+    while (iter != end(batches)) {
+        if (iter->second.deadline <= now) {
+            flush(iter->first, std::move(iter->second));
+            iter = batches.erase(iter);
+        } else {
+            ++iter;
+        }
+    }
+    if (batches.empty()) {
+        loop.cancel_timer(flush_timer);
+        return;
+    }
+
+    // Batches that aren't full yet wait for more requests to join
+    // them, while the client goes on with its replies
+    auto deadline = begin(batches)->second.deadline;
+    for (auto & b : batches) {
+        deadline = std::min(deadline, b.second.deadline);
+    }
+    auto wait = std::chrono::duration_cast<std::chrono::microseconds>(deadline - now);
+    // The reactor counts in milliseconds, so the wait is rounded up
+    loop.reset_timer(flush_timer, std::chrono::milliseconds{(wait.count() + 999) / 1000});
+}
+
+
+auto client::flush(std::string const & service_name, batch && pending) -> void
+{
+    auto request = msg::request::make(service_name, {}, std::move(pending.data));
+    auto id = next_id++;
+    msg::set_request_id(request.metadata(), id);
+
+    auto members = std::make_shared<std::vector<member>>(std::move(pending.members));
+    auto split = [members, service_name](msg::reply && reply) {
+        std::size_t expected = 0;
+        for (auto & m : *members) {
+            expected += m.parts;
+        }
+        if (reply.data().size() != expected) {
+            auto error = std::make_exception_ptr(exception::mismatched_reply(
+                "Service " + service_name + " replied with "
+                + std::to_string(reply.data().size()) + " parts to "
+                + std::to_string(expected) + " coalesced parts"));
+            for (auto & m : *members) {
+                m.on_error(error);
+            }
+            return;
+        }
+        auto part = begin(reply.data());
+        for (auto & m : *members) {
+            msg::many_parts data;
+            for (std::size_t i = 0; i < m.parts; ++i, ++part) {
+                data.push_back(std::move(*part));
+            }
+            m.on_reply(msg::reply::make(
+                           msg::request::make(service_name, {}, std::move(data))));
+        }
+    };
+    auto fail = [members](std::exception_ptr error) {
+        for (auto & m : *members) {
+            m.on_error(error);
+        }
+    };
+
+    auto & sent = waiting[id] = {
+        msg::send(std::move(request)),
+        std::move(split),
+        std::move(fail),
+        detail_time::time_now(),
+        0,
+        members->size(),
+    };
+    transmit(sent);
+}
+
+
+auto client::receive() -> void
+{
+    while (true) {
+        auto received = sock.recv_multimsg(ZMQ_DONTWAIT);
+        if (received.size() == 0) {
+            // No more messages waiting
+            return;
+        }
+        try {
+            auto message = msg::read(std::move(received));
+            auto reply = boost::get<msg::reply>(&message);
+            if (reply == nullptr) {
+                logger->warn("Received a message that is not a reply, "
+                             "streamed replies are not supported");
+                continue;
+            }
+            auto id = msg::find_request_id(reply->metadata());
+            if (!id) {
+                logger->warn("Received a reply without a request ID");
+                continue;
+            }
+            auto found = waiting.find(*id);
+            if (found == waiting.end()) {
+                // A request that was sent again may be replied to
+                // more than once
+                continue;
+            }
+            auto on_reply = std::move(found->second.on_reply);
+            auto on_error = std::move(found->second.on_error);
+            outstanding -= found->second.callers;
+            waiting.erase(found);
+            if (msg::is_error(reply->metadata())) {
+                auto & data = reply->data();
+                std::string what;
+                if (!data.empty()) {
+                    what.assign(data[0].data<char>(), data[0].size());
+                }
+                on_error(std::make_exception_ptr(exception::failed(what)));
+                continue;
+            }
+            on_reply(std::move(*reply));
+        } catch (std::exception & e) {
+            logger->error("Failed to handle a reply: {}", e.what());
+        }
+    }
+}
+
+
+auto client::expire() -> void
+{
+    auto now = detail_time::time_now();
+    // The handlers may send more requests, so they are only called
+    // once the waiting requests are no longer being iterated
+    std::vector<in_flight> failed;
+    auto iter = begin(waiting);
+    while (iter != end(waiting)) {
+        auto & request = iter->second;
+        if (request.deadline > now) {
+            ++iter;
+        } else if (request.attempts < retries) {
+            ++request.attempts;
+            transmit(request);
+            ++iter;
+        } else {
+            failed.push_back(std::move(request));
+            iter = waiting.erase(iter);
+        }
+    }
+    auto error = std::make_exception_ptr(
+        exception::timeout("No reply arrived for the request"));
+    for (auto & request : failed) {
+        outstanding -= request.callers;
+        request.on_error(error);
+    }
+}
@@ -0,0 +1,266 @@
+/*
+  Copyright 2017 Kaan Genç
+
+  This file is part of DagBox.
+
+  DagBox is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  DagBox is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with DagBox.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <functional>
+#include <future>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <zmq.hpp>
+#include "exception.hpp"
+#include "message.hpp"
+#include "socket.hpp"
+#include "reactor.hpp"
+#include "helpers.hpp"
+
+
+/*! \file client.hpp
+ * A client for sending requests to DagBox services.
+ */
+
+
+/*! \brief Client side of DagBox.
+ */
+namespace dagbox
+{
+    namespace exception
+    {
+        using std::runtime_error;
+
+        /*! \brief No reply arrived for a request, even after retrying
+         *  it.
+         */
+        EXCEPTION(timeout, runtime_error);
+
+        /*! \brief The client was destroyed before a reply arrived. */
+        EXCEPTION(stopped, runtime_error);
+
+        /*! \brief The service replied that it couldn't process the
+         *  request, see msg::make_error_reply.
+         */
+        EXCEPTION(failed, runtime_error);
+
+        /*! \brief A reply didn't have one part for each data part of
+         *  the request, which coalesced requests rely on.
+         */
+        EXCEPTION(mismatched_reply, runtime_error);
+    };
+
+
+    /*! \brief Sends requests to services through a broker.
+     *
+     * The client keeps any number of requests in flight over a single
+     * connection. Each request is tagged with a
+     * [request ID](\ref msg::request_id_prefix), which is used to
+     * pass its reply to the caller that sent it, no matter in which
+     * order the replies arrive.
+     *
+     * Requests may be sent from any number of threads at once. They
+     * are handed over to the thread of the client without taking any
+     * locks, and that thread owns the socket.
+     *
+     * ```
+     * dagbox::client c(ctx, "tcp://localhost:5555");
+     * auto reply = c.request(msg::request::make("datastore reader", {}, std::move(data)));
+     * use(reply.get().data());
+     *
+     * c.send(msg::request::make("lock", {}, std::move(locks)),
+     *        [](msg::reply && reply) { locked(reply.data()); },
+     *        [](std::exception_ptr error) { failed(error); });
+     * ```
+     *
+     * If a reply doesn't arrive in time, the request fails with
+     * exception::timeout. A client can be created with a number of
+     * retries, in which case the request is sent again first as the
+     * protocol recommends, waiting twice as long each time. Since a
+     * request may then be processed more than once, retries should
+     * only be used by clients whose requests are all safe to repeat.
+     * Streamed replies are not supported.
+     *
+     * Small requests to a service can be
+     * [coalesced](\ref client::coalesce) into a single request, which
+     * the worker then processes at once, for example within a single
+     * transaction.
+     */
+    class client
+    {
+    public:
+        /*! \brief Called with the reply to a request. */
+        typedef std::function<void(msg::reply &&)> reply_handler;
+        /*! \brief Called with the reason a request failed. */
+        typedef std::function<void(std::exception_ptr)> error_handler;
+
+    private:
+        // A request handed over to the thread of the client. Requests
+        // that will be coalesced only carry their data parts, and the
+        // name of their service.
+        struct submission
+        {
+            uint64_t id;
+            msg::part_source parts;
+            reply_handler on_reply;
+            error_handler on_error;
+            std::string service;
+            submission * next;
+        };
+
+        struct coalescing
+        {
+            std::size_t max_parts;
+            std::chrono::microseconds max_delay;
+        };
+
+        // A request whose data was coalesced with others
+        struct member
+        {
+            reply_handler on_reply;
+            error_handler on_error;
+            std::size_t parts;
+        };
+
+        struct batch
+        {
+            msg::many_parts data;
+            std::vector<member> members;
+            detail_time::time deadline;
+        };
+
+        // A request that has been sent. Its parts are only kept if it
+        // may be sent again.
+        struct in_flight
+        {
+            msg::part_source parts;
+            reply_handler on_reply;
+            error_handler on_error;
+            detail_time::time deadline;
+            unsigned attempts;
+            // The number of requests that were coalesced into this one
+            std::size_t callers;
+        };
+
+        auto const static socket_type = zmq::socket_type::dealer;
+
+        std::chrono::milliseconds const timeout;
+        unsigned const retries;
+        std::atomic<uint64_t> next_id;
+        std::atomic<std::size_t> outstanding;
+        std::atomic<submission *> submitted;
+        int wakeup_read;
+        int wakeup_write;
+        std::unordered_map<std::string, coalescing> coalesced;
+
+        // Only used by the thread of the client
+        class socket sock;
+        std::unordered_map<uint64_t, in_flight> waiting;
+        std::unordered_map<std::string, batch> batches;
+        reactor loop;
+        reactor::timer_id flush_timer;
+        std::thread thread;
+
+        auto transmit(in_flight & request) -> void;
+        auto take_submissions() -> void;
+        auto flush_expired() -> void;
+        auto flush(std::string const & service_name, batch && pending) -> void;
+        auto receive() -> void;
+        auto expire() -> void;
+    public:
+        /*! \brief Create a client.
+         *
+         * \param ctx 0MQ context the client will run in.
+         * \param broker_addr The address of the broker.
+         * \param timeout The time to wait for a reply before sending
+         * a request again.
+         * \param retries How many times a request is sent again
+         * before it fails with exception::timeout. Only requests that
+         * are safe to repeat should be sent by a client that retries.
+         */
+        client(zmq::context_t & ctx,
+               std::string const & broker_addr,
+               std::chrono::milliseconds timeout = std::chrono::milliseconds{1000},
+               unsigned retries = 0);
+
+        /*! \brief Stop the client.
+         *
+         * Requests that haven't been replied to fail with
+         * exception::stopped.
+         */
+        ~client();
+
+        client(client const &) = delete;
+        client(client &&) = delete;
+        auto operator=(client const &) -> client & = delete;
+        auto operator=(client &&) -> client & = delete;
+
+        /*! \brief Send a request.
+         *
+         * May be called from any thread. The handlers are called on
+         * the thread of the client, so they should return quickly.
+         *
+         * \param request The request. A request ID is added to its
+         * metadata, replacing any ID it already carries.
+         * \param on_reply Called with the reply once it arrives.
+         * \param on_error Called if the request fails, including
+         * with exception::failed if the service replied with an
+         * error.
+         */
+        auto send(msg::request && request,
+                  reply_handler on_reply,
+                  error_handler on_error) -> void;
+
+        /*! \brief Coalesce small requests to a service.
+         *
+         * Requests to the service that are sent close together are
+         * combined into a single request, with the data parts of all
+         * of them. The parts of the reply are then split between the
+         * callers, so the worker must reply with exactly one part for
+         * each part of the request, as the datastore and lock workers
+         * do.
+         *
+         * A combined request is sent as soon as it has `max_parts`
+         * parts, or once there are no more requests waiting to be
+         * sent and `max_delay` has passed since its first request.
+         * Even with no delay, requests that are sent while the client
+         * is busy are combined. The delay is rounded up to whole
+         * milliseconds. Requests that carry metadata are never
+         * coalesced.
+         *
+         * Must be called before sending any requests.
+         */
+        auto coalesce(std::string const & service_name,
+                      std::size_t max_parts,
+                      std::chrono::microseconds max_delay = std::chrono::microseconds{0})
+            -> void;
+
+        /*! \brief Send a request, and get its reply later.
+         *
+         * May be called from any thread.
+         */
+        auto request(msg::request && request) -> std::future<msg::reply>;
+
+        /*! \brief The number of requests that haven't been sent yet,
+         *  or haven't been replied to.
+         */
+        auto pending() const noexcept -> std::size_t;
+    };
+};
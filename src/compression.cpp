@@ -0,0 +1,172 @@
+/*
+  Copyright 2017 Kaan Genç
+
+  This file is part of DagBox.
+
+  DagBox is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  DagBox is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with DagBox.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <cstdlib>
+#include <cstring>
+#include <lz4.h>
+#include "compression.hpp"
+using namespace compression;
+using namespace detail;
+
+
+namespace
+{
+    // One byte for the method, followed by the uncompressed size
+    std::size_t const lz4_prefix_size = 1 + sizeof(uint32_t);
+
+    auto free_buffer(void * data, void *) -> void
+    {
+        std::free(data);
+    }
+
+    // The size is written byte by byte so that it reads the same on
+    // every machine
+    auto write_size(char * dest, uint32_t size) -> void
+    {
+        for (std::size_t i = 0; i < sizeof(size); ++i) {
+            dest[i] = static_cast<char>((size >> (8 * i)) & 0xff);
+        }
+    }
+
+    auto read_size(char const * src) -> uint32_t
+    {
+        uint32_t size = 0;
+        for (std::size_t i = 0; i < sizeof(size); ++i) {
+            size |= static_cast<uint32_t>(static_cast<uint8_t>(src[i])) << (8 * i);
+        }
+        return size;
+    }
+
+    auto store_part(msg::part & p) -> void
+    {
+        msg::part stored(p.size() + 1);
+        auto dest = stored.data<char>();
+        dest[0] = static_cast<char>(method::none);
+        std::memcpy(dest + 1, p.data(), p.size());
+        p = std::move(stored);
+    }
+
+    struct compressor
+    {
+        std::size_t threshold;
+
+        template <class message_type>
+        auto operator()(message_type & message) const -> void {
+            compress(message, threshold);
+        }
+    };
+}
+
+
+auto detail::has_flag(msg::many_parts const & metadata) -> bool
+{
+    for (auto const & p : metadata) {
+        if (p.size() == flag.size()
+            && std::memcmp(p.data(), flag.data(), flag.size()) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+auto detail::compress_part(msg::part & p, std::size_t threshold) -> void
+{
+    if (p.size() < threshold
+        || p.size() > static_cast<std::size_t>(LZ4_MAX_INPUT_SIZE)) {
+        store_part(p);
+        return;
+    }
+
+    auto source_size = static_cast<int>(p.size());
+    auto bound = LZ4_compressBound(source_size);
+    auto buffer = static_cast<char *>(std::malloc(lz4_prefix_size + bound));
+    if (buffer == nullptr) {
+        throw ::exception::fatal("Unable to allocate compression buffer");
+    }
+    auto compressed_size = LZ4_compress_default(p.data<char>(),
+                                                buffer + lz4_prefix_size,
+                                                source_size,
+                                                bound);
+    if (compressed_size <= 0
+        || static_cast<std::size_t>(compressed_size) + lz4_prefix_size
+           >= p.size() + 1) {
+        // Compression didn't help, send the part as it is
+        std::free(buffer);
+        store_part(p);
+        return;
+    }
+
+    buffer[0] = static_cast<char>(method::lz4);
+    write_size(buffer + 1, static_cast<uint32_t>(source_size));
+    auto total_size = lz4_prefix_size + compressed_size;
+    // Shrinking a buffer is done in place by most allocators, and
+    // lets the part take over the buffer without copying it
+    auto shrunk = std::realloc(buffer, total_size);
+    if (shrunk != nullptr) {
+        buffer = static_cast<char *>(shrunk);
+    }
+    p = msg::part(buffer, total_size, free_buffer);
+}
+
+
+auto detail::decompress_part(msg::part & p) -> void
+{
+    using msg::exception::malformed;
+
+    if (p.size() < 1) {
+        throw malformed("Compressed data part is missing its method");
+    }
+    auto source = p.data<char>();
+    switch (static_cast<method>(source[0])) {
+    case method::none: {
+        msg::part plain(source + 1, p.size() - 1);
+        p = std::move(plain);
+        return;
+    }
+    case method::lz4: {
+        if (p.size() < lz4_prefix_size) {
+            throw malformed("Compressed data part is truncated");
+        }
+        auto original_size = read_size(source + 1);
+        if (original_size > static_cast<uint32_t>(LZ4_MAX_INPUT_SIZE)) {
+            throw malformed("Compressed data part is too large");
+        }
+        msg::part plain(original_size);
+        auto result = LZ4_decompress_safe(
+            source + lz4_prefix_size,
+            plain.data<char>(),
+            static_cast<int>(p.size() - lz4_prefix_size),
+            static_cast<int>(original_size));
+        if (result < 0 || static_cast<uint32_t>(result) != original_size) {
+            throw malformed("Compressed data part is corrupt");
+        }
+        p = std::move(plain);
+        return;
+    }
+    }
+    throw malformed("Data part is compressed with an unknown method");
+}
+
+
+auto compression::compress_parts(msg::part_source && parts,
+                                 std::size_t threshold)
+    -> msg::part_source
+{
+    return msg::modify_payload(std::move(parts), compressor{threshold});
+}
@@ -0,0 +1,153 @@
+/*
+  Copyright 2017 Kaan Genç
+
+  This file is part of DagBox.
+
+  DagBox is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  DagBox is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with DagBox.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include "message.hpp"
+
+
+/*! \file compression.hpp
+ * Optional compression of the data parts of requests and replies.
+ */
+
+
+
+/*! \brief Optional compression of the data parts of requests and replies.
+ *
+ * Compression is negotiated per request. A client that wants to use
+ * compression calls [compress](\ref compression::compress) on the
+ * request before sending it, which adds the
+ * [flag](\ref compression::flag) to the metadata of the request. The
+ * assistant decompresses such requests before handing them to the
+ * worker, and compresses the reply before sending it back. Since the
+ * metadata is copied into the reply, the client can call
+ * [decompress](\ref compression::decompress) on every reply it
+ * receives.
+ *
+ * When a message is flagged, every data part starts with a single
+ * byte that tells how the rest of the part is encoded. Parts that are
+ * smaller than the threshold are sent as they are, behind that byte,
+ * so that small messages don't pay for compression.
+ *
+ * The broker never looks inside the data parts, so it is not affected
+ * by compression at all.
+ *
+ * ```
+ * auto req = msg::request::make("datastore reader", {}, std::move(data));
+ * compression::compress(req);
+ * sock.send_multimsg(msg::send(std::move(req)));
+ *
+ * auto received = msg::read(sock.recv_multimsg());
+ * auto & rep = boost::get<msg::reply>(received);
+ * compression::decompress(rep);
+ * ```
+ */
+namespace compression
+{
+    /*! \brief The metadata part that marks a message as compressed. */
+    std::string const flag = "DGBX:lz4";
+
+    /*! \brief Data parts smaller than this many bytes are not compressed. */
+    std::size_t const default_threshold = 1024;
+
+    namespace detail
+    {
+        enum class method : uint8_t
+        {
+            none = 0x00,
+            lz4 = 0x01,
+        };
+
+        auto has_flag(msg::many_parts const & metadata) -> bool;
+
+        auto compress_part(msg::part & p, std::size_t threshold) -> void;
+
+        auto decompress_part(msg::part & p) -> void;
+    };
+
+
+    /*! \brief Compress the data parts of a request or a reply.
+     *
+     * The compression flag is added to the metadata of the message if
+     * it is not there yet. Data parts that are smaller than
+     * `threshold`, or that don't get any smaller when compressed, are
+     * left uncompressed.
+     *
+     * \param message A [request](\ref msg::request) or a
+     * [reply](\ref msg::reply).
+     * \param threshold Parts smaller than this many bytes will not be
+     * compressed.
+     */
+    template <class message_type>
+    auto compress(message_type & message, std::size_t threshold = default_threshold)
+        -> void
+    {
+        if (!detail::has_flag(message.metadata())) {
+            message.metadata().push_back(msg::part(flag.data(), flag.size()));
+        }
+        for (auto & p : message.data()) {
+            detail::compress_part(p, threshold);
+        }
+    }
+
+
+    /*! \brief Decompress the data parts of a request or a reply.
+     *
+     * Messages that don't carry the compression flag are left as they
+     * are. The flag itself is kept in the metadata, since workers
+     * must copy the metadata into their replies unmodified.
+     *
+     * \param message A [request](\ref msg::request) or a
+     * [reply](\ref msg::reply).
+     *
+     * \returns True if the message was flagged for compression.
+     *
+     * \throws msg::exception::malformed A data part could not be
+     * decompressed.
+     */
+    template <class message_type>
+    auto decompress(message_type & message) -> bool
+    {
+        if (!detail::has_flag(message.metadata())) {
+            return false;
+        }
+        for (auto & p : message.data()) {
+            detail::decompress_part(p);
+        }
+        return true;
+    }
+
+
+    /*! \brief Compress a message that is ready to be sent.
+     *
+     * Requests and replies in `parts` are compressed as with
+     * [compress](\ref compression::compress), any other message is
+     * returned unchanged. This reads and sends `parts` again, so
+     * messages that are still being built should be compressed with
+     * [compress](\ref compression::compress) instead.
+     *
+     * \param parts Message parts, as returned by `msg::send`.
+     * \param threshold Parts smaller than this many bytes will not be
+     * compressed.
+     */
+    auto compress_parts(msg::part_source && parts,
+                        std::size_t threshold = default_threshold)
+        -> msg::part_source;
+};
@@ -0,0 +1,128 @@
+/*
+  Copyright 2017 Kaan Genç
+
+  This file is part of DagBox.
+
+  DagBox is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  DagBox is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with DagBox.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "embedded.hpp"
+using namespace embedded;
+
+
+auto dispatcher::find(std::string const & service_name) -> detail::service &
+{
+    auto found = services.find(service_name);
+    if (found == services.end()) {
+        throw exception::unknown_service("No worker for service " + service_name);
+    }
+    return *found->second;
+}
+
+
+auto dispatcher::provides(std::string const & service_name) const -> bool
+{
+    return services.count(service_name) > 0;
+}
+
+
+namespace
+{
+    // Holds an instance of a worker until the call is done, even if
+    // the worker throws
+    class claim
+    {
+        detail::service & service;
+        detail::instance * inst;
+    public:
+        claim(detail::service & service)
+            : service(service), inst(nullptr)
+        {
+            // Spread the callers over the instances, and only wait if
+            // every instance is busy
+            auto start = service.next++;
+            if (try_claim(start)) {
+                return;
+            }
+            std::unique_lock<std::mutex> guard(service.idle_lock);
+            ++service.waiting;
+            service.idle.wait(guard, [&](){ return try_claim(start); });
+            --service.waiting;
+        }
+
+        ~claim()
+        {
+            inst->busy.store(false);
+            if (service.waiting.load() > 0) {
+                std::lock_guard<std::mutex> guard(service.idle_lock);
+                service.idle.notify_one();
+            }
+        }
+
+        claim(claim const &) = delete;
+        auto operator=(claim const &) -> claim & = delete;
+
+        auto try_claim(std::size_t start) -> bool
+        {
+            auto & instances = service.instances;
+            for (std::size_t i = 0; i < instances.size(); ++i) {
+                auto & candidate = *instances[(start + i) % instances.size()];
+                if (!candidate.busy.load(std::memory_order_relaxed)
+                    && !candidate.busy.exchange(true)) {
+                    inst = &candidate;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        auto operator->() const -> detail::instance * { return inst; }
+    };
+
+    auto read_reply(std::string const & service_name, msg::part_source && parts)
+        -> msg::reply
+    {
+        auto message = msg::read(std::move(parts));
+        auto reply = boost::get<msg::reply>(&message);
+        if (reply == nullptr) {
+            throw embedded::exception::unexpected_reply("Worker for service "
+                                                        + service_name + " did not reply");
+        }
+        return std::move(*reply);
+    }
+}
+
+
+auto dispatcher::call(msg::request && request) -> msg::reply
+{
+    auto service_name = request.service();
+    claim inst(find(service_name));
+    if (inst->process) {
+        request.data() = inst->process(std::move(request.data()));
+        return msg::reply::make(std::move(request));
+    }
+    return read_reply(service_name, inst->call(std::move(request)));
+}
+
+
+auto dispatcher::call(std::string const & service_name, msg::many_parts && data_parts)
+    -> msg::many_parts
+{
+    claim inst(find(service_name));
+    if (inst->process) {
+        return inst->process(std::move(data_parts));
+    }
+    auto reply = read_reply(service_name, inst->call(
+                                msg::request::make(service_name, {}, std::move(data_parts))));
+    return std::move(reply.data());
+}
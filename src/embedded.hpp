@@ -0,0 +1,258 @@
+/*
+  Copyright 2017 Kaan Genç
+
+  This file is part of DagBox.
+
+  DagBox is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  DagBox is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with DagBox.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "exception.hpp"
+#include "message.hpp"
+#include "services.hpp"
+
+
+/*! \file embedded.hpp
+ * Calling workers directly from the same process.
+ */
+
+
+/*! \brief Calling workers directly from the same process.
+ *
+ * When DagBox is embedded into an application, and every worker runs
+ * in the same process as the application, requests don't need to go
+ * through the broker at all. The [dispatcher](\ref embedded::dispatcher)
+ * passes requests straight to the workers on the calling thread,
+ * without any sockets or threads of its own.
+ *
+ * Requests and replies have the same payloads as they do over 0MQ,
+ * so code can move between an embedded and a distributed deployment
+ * without changing how it builds requests. Workers that can process
+ * the data parts of a request on their own are called without
+ * framing a message at all.
+ */
+namespace embedded
+{
+    namespace exception
+    {
+        using std::runtime_error;
+
+        /*! \brief No worker was added for the requested service. */
+        EXCEPTION(unknown_service, runtime_error);
+
+        /*! \brief A worker returned something other than a reply.
+         *
+         * Only workers that return their reply from `operator()` can
+         * be called directly.
+         */
+        EXCEPTION(unexpected_reply, runtime_error);
+
+        /*! \brief A worker that keeps the state of its service was
+         *  added more than once.
+         *
+         * Each instance would have a state of its own, for example a
+         * table of locks, so callers using different instances
+         * wouldn't see each other.
+         */
+        EXCEPTION(single_instance, runtime_error);
+    };
+
+
+    namespace detail
+    {
+        // One instance of a worker, which only one thread may call at
+        // a time
+        struct instance
+        {
+            std::atomic<bool> busy;
+            std::function<msg::part_source(msg::request &&)> call;
+            // Only set for workers that process data parts on their
+            // own
+            std::function<msg::many_parts(msg::many_parts &&)> process;
+
+            instance() : busy(false) {}
+        };
+
+        struct service
+        {
+            std::vector<std::shared_ptr<instance>> instances;
+            // Where the next caller starts looking for a free instance
+            std::atomic<std::size_t> next;
+            // Callers only wait here when every instance is busy
+            std::atomic<std::size_t> waiting;
+            std::mutex idle_lock;
+            std::condition_variable idle;
+
+            service() : next(0), waiting(0) {}
+        };
+
+        // Workers whose instances would each keep a state of their
+        // own declare `single_instance`
+        template <class worker>
+        auto single_instance(int) -> decltype(bool(worker::single_instance))
+        {
+            return worker::single_instance;
+        }
+
+        template <class worker>
+        auto single_instance(long) -> bool
+        {
+            return false;
+        }
+
+        // Workers may process the data parts of a request without it
+        // being framed
+        template <class worker>
+        auto set_process(instance & inst, std::shared_ptr<worker> const & work, int)
+            -> decltype(void(work->process(std::declval<msg::many_parts>())))
+        {
+            inst.process = [work](msg::many_parts && data_parts) {
+                return work->process(std::move(data_parts));
+            };
+        }
+
+        template <class worker>
+        auto set_process(instance &, std::shared_ptr<worker> const &, long) -> void {}
+    };
+
+
+    /*! \brief Passes requests directly to workers in the same process.
+     *
+     * Workers are added with [add](\ref dispatcher::add) before any
+     * request is made. After that the services don't change, so
+     * finding the worker for a request needs no locks, and any
+     * number of threads may call [call](\ref dispatcher::call) at
+     * once. Each instance of a worker is used by a single thread at a
+     * time, so workers don't need to be thread safe. Adding several
+     * instances of a worker lets that many threads use the service at
+     * once.
+     *
+     * ```
+     * data::storage store(directory);
+     * embedded::dispatcher db;
+     * db.add<data::writer>(1, std::ref(store));
+     * db.add<data::reader>(4, std::ref(store));
+     * db.add<lock::lock>(1);
+     *
+     * auto keys = db.call("datastore writer", std::move(writes));
+     * ```
+     *
+     * Only workers whose `operator()` takes just the request and
+     * returns the reply are supported, see [assistant](\ref assistant).
+     * Workers may also provide a method
+     * `process(msg::many_parts && data_parts) -> msg::many_parts`,
+     * which the dispatcher then calls instead, without framing the
+     * request or reading the reply. Workers that keep the state of
+     * their service, such as [lock](\ref lock::lock), declare
+     * `static bool const single_instance = true`, and can only be
+     * added once.
+     */
+    class dispatcher
+    {
+        std::unordered_map<std::string, std::unique_ptr<detail::service>> services;
+
+        auto find(std::string const & service_name) -> detail::service &;
+    public:
+        dispatcher() = default;
+
+        dispatcher(dispatcher const &) = delete;
+        dispatcher(dispatcher &&) = delete;
+        auto operator=(dispatcher const &) -> dispatcher & = delete;
+        auto operator=(dispatcher &&) -> dispatcher & = delete;
+
+        /*! \brief Add instances of a worker.
+         *
+         * The worker will be called for requests to its
+         * `service_name`. This function must not be called while
+         * other threads are making requests.
+         *
+         * \param instances The number of instances of the worker,
+         * which is the number of threads that can use the service at
+         * once.
+         * \param args The arguments to be passed to the constructor
+         * of each instance.
+         *
+         * \throws exception::single_instance The worker keeps the
+         * state of its service, and would have more than one
+         * instance.
+         */
+        template <class worker, class ... Args>
+        auto add(std::size_t instances, Args ... args) -> void
+        {
+            auto single = detail::single_instance<worker>(0);
+            if (single && instances > 1) {
+                throw exception::single_instance(
+                    "A worker that keeps the state of its service can't have "
+                    + std::to_string(instances) + " instances");
+            }
+            for (std::size_t i = 0; i < instances; ++i) {
+                std::shared_ptr<worker> work(new worker(args...));
+                for (auto & name : service_names(*work)) {
+                    if (single && services.count(name) > 0) {
+                        throw exception::single_instance(
+                            "The worker for service " + name + " was already added");
+                    }
+                }
+                std::shared_ptr<detail::instance> inst(new detail::instance());
+                inst->call = [work](msg::request && request) {
+                    return (*work)(std::move(request));
+                };
+                detail::set_process(*inst, work, 0);
+                // A worker with several services shares its instance
+                // between all of them
+                for (auto & name : service_names(*work)) {
+                    auto & service = services[name];
+                    if (!service) {
+                        service.reset(new detail::service());
+                    }
+                    service->instances.push_back(inst);
+                }
+            }
+        }
+
+        /*! \brief Whether a worker was added for a service. */
+        auto provides(std::string const & service_name) const -> bool;
+
+        /*! \brief Process a request on the calling thread.
+         *
+         * If all instances of the worker are busy, waits for one of
+         * them.
+         *
+         * \throws exception::unknown_service No worker was added for
+         * the service of the request.
+         * \throws exception::unexpected_reply The worker didn't
+         * return a reply.
+         */
+        auto call(msg::request && request) -> msg::reply;
+
+        /*! \brief Process the data parts of a request on the calling
+         *  thread.
+         *
+         * \param service_name The service the request is for.
+         * \param data_parts The data of the request.
+         *
+         * \returns The data parts of the reply.
+         */
+        auto call(std::string const & service_name, msg::many_parts && data_parts)
+            -> msg::many_parts;
+    };
+};
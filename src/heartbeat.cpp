@@ -0,0 +1,59 @@
+/*
+  Copyright 2017 Kaan Genç
+
+  This file is part of DagBox.
+
+  DagBox is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  DagBox is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with DagBox.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "heartbeat.hpp"
+
+
+heartbeat::heartbeat(std::chrono::milliseconds interval)
+    : interval(interval),
+      loop(nullptr),
+      timer(0),
+      random(std::random_device()())
+{}
+
+
+auto heartbeat::next_delay() -> std::chrono::milliseconds
+{
+    auto spread = interval.count() / 4;
+    if (spread <= 0) {
+        return interval;
+    }
+    std::uniform_int_distribution<long> jitter(0, spread);
+    return interval - std::chrono::milliseconds{jitter(random)};
+}
+
+
+auto heartbeat::attach(reactor & loop, reactor::handler send_ping) -> void
+{
+    this->loop = &loop;
+    timer = loop.add_timer(interval, [this, send_ping](){
+            send_ping();
+            this->loop->reset_timer(timer, next_delay());
+        });
+    loop.reset_timer(timer, next_delay());
+}
+
+
+auto heartbeat::sent() -> void
+{
+    if (loop != nullptr) {
+        // Postponed by the full interval, the jitter only needs to
+        // break up pings that happen at the same time
+        loop->reset_timer(timer);
+    }
+}
@@ -0,0 +1,78 @@
+/*
+  Copyright 2017 Kaan Genç
+
+  This file is part of DagBox.
+
+  DagBox is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  DagBox is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with DagBox.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <chrono>
+#include <random>
+#include "reactor.hpp"
+
+
+/*! \file heartbeat.hpp
+ * Scheduling the heartbeats of workers.
+ */
+
+
+/*! \brief Decides when a worker needs to send a heartbeat.
+ *
+ * The broker considers any message from a worker as a sign that the
+ * worker is alive, so a worker only needs to send a ping after it has
+ * been quiet for a while. Every message the worker sends postpones
+ * the next ping, so busy workers don't send any.
+ *
+ * The time between pings is shortened by a random amount of up to a
+ * quarter of the interval, so that workers which started together
+ * don't all ping the broker at the same moment.
+ *
+ * ```
+ * heartbeat beat(interval);
+ * beat.attach(loop, [&](){ sock.send_multimsg(msg::send(msg::ping::make())); });
+ * sock.send_multimsg(reply);
+ * beat.sent();
+ * ```
+ */
+class heartbeat
+{
+    std::chrono::milliseconds const interval;
+    reactor * loop;
+    reactor::timer_id timer;
+    std::minstd_rand random;
+
+    auto next_delay() -> std::chrono::milliseconds;
+public:
+    /*! \brief Create a heartbeat schedule.
+     *
+     * \param interval The longest time a worker stays quiet. This
+     * should be less than the worker timeout of the broker.
+     */
+    heartbeat(std::chrono::milliseconds interval);
+
+    /*! \brief Start sending heartbeats on a reactor.
+     *
+     * \param loop The reactor of the worker.
+     * \param send_ping Sends a ping to the broker.
+     */
+    auto attach(reactor & loop, reactor::handler send_ping) -> void;
+
+    /*! \brief Note that the worker has sent a message.
+     *
+     * Postpones the next ping. Does nothing before the heartbeat is
+     * attached to a reactor.
+     */
+    auto sent() -> void;
+};
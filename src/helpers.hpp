@@ -20,7 +20,11 @@
 
 #include <chrono>
 #include <thread>
-#include <atomic>
+#include <memory>
+#include <future>
+#include <vector>
+#include "reactor.hpp"
+#include "placement.hpp"
 
 
 /*! \file helpers.hpp
@@ -41,18 +45,60 @@ namespace detail_time
 }
 
 
+namespace detail_component
+{
+    // Components that may still have work when their reactor stops
+    // finish it in a drain method
+    template <class C>
+    auto drain(C & comp, int) -> decltype(comp.drain())
+    {
+        return comp.drain();
+    }
+
+    template <class C>
+    auto drain(C &, long) -> void {}
+}
+
+
+/*! \brief Marks the arguments of a [component](\ref component) as
+ *  starting with a placement.
+ */
+struct placed_t {};
+
+/*! \brief See [placed_t](\ref placed_t). */
+placed_t const placed = {};
+
+
 /*! \brief Run a component on a thread.
  *
  * Creates a thread and runs a component in that thread. The component
- * is a class with a public constructor and a `run(void)` method. The
- * `run` method will be continuously called until the component is
- * destructed.
+ * is a class with a public constructor and an `attach(reactor &)`
+ * method. The component is constructed on the new thread, and runs on
+ * a [reactor](\ref reactor) until it is destructed.
+ *
+ * The constructor returns once the component has been constructed,
+ * and rethrows any exception thrown by the component's constructor.
+ * Destroying the component stops its reactor. If the component has a
+ * `drain()` method, it is then called on the thread of the component
+ * to finish the work it was already given, see
+ * [assistant::drain](\ref assistant::drain). Calling
+ * [stop](\ref component::stop) first lets several components drain
+ * at the same time.
+ *
+ * The thread can be named and pinned to CPUs or a NUMA node by
+ * passing [placed](\ref placed) and a
+ * [placement](\ref placement::thread_placement) before the arguments
+ * of the component:
+ *
+ * ```
+ * component<broker> b(placed, layout.broker, ctx, addr, timeout);
+ * ```
  */
 template <class C>
 class component
 {
+    reactor loop;
     std::thread thread;
-    std::atomic_bool condition;
 public:
     /*! \brief Create a component.
      *
@@ -60,19 +106,139 @@ public:
      * constructor of class `C`.
      */
     template <class ...Args> component(Args && ... args)
-        : condition(true)
+        : component(placed, placement::thread_placement(), std::forward<Args>(args)...)
+    {}
+
+    /*! \brief Create a component on a placed thread.
+     *
+     * \param where Where the thread of the component should run.
+     * \param args These arguments will be directly passed to the
+     * constructor of class `C`.
+     *
+     * \throws placement::exception::invalid The thread could not be
+     * placed.
+     */
+    template <class ...Args>
+    component(placed_t, placement::thread_placement where, Args && ... args)
     {
+        std::promise<void> ready;
+        auto started = ready.get_future();
         thread = std::thread([&](){
-            C comp(args...);
-            while (condition.load()) {
-                comp.run();
+            std::unique_ptr<C> comp;
+            try {
+                // Placed before the component is constructed, so that
+                // its memory is allocated on the right node
+                placement::apply(where);
+                comp.reset(new C(args...));
+                comp->attach(loop);
+            } catch (...) {
+                ready.set_exception(std::current_exception());
+                return;
+            }
+            // The arguments and the promise are owned by the
+            // constructor, they must not be touched after this
+            ready.set_value();
+            loop.run();
+            try {
+                detail_component::drain(*comp, 0);
+            } catch (std::exception &) {
+                // The component is stopping anyway, and has nobody
+                // left to report to
             }
         });
+        try {
+            started.get();
+        } catch (...) {
+            thread.join();
+            throw;
+        }
+    }
+
+    /*! \brief Stop the reactor of the component without waiting.
+     *
+     * The component drains on its own thread, and the destructor
+     * waits for it to finish.
+     */
+    auto stop() -> void
+    {
+        loop.stop();
     }
 
     ~component()
     {
-        condition.store(false);
+        stop();
         thread.join();
     }
+
+    component(component const &) = delete;
+    component(component &&) = delete;
+    auto operator=(component const &) -> component & = delete;
+    auto operator=(component &&) -> component & = delete;
+};
+
+
+/*! \brief Run several instances of a component, each on its own thread.
+ *
+ * Each instance is constructed with the same arguments, and runs as a
+ * [component](\ref component) on a thread placed as requested. See
+ * [isolate_broker](\ref placement::isolate_broker) for a way to
+ * spread workers over the CPUs that the broker doesn't use.
+ *
+ * ```
+ * auto layout = placement::isolate_broker(readers, "reader");
+ * component<broker> b(placed, layout.broker, ctx, addr, timeout);
+ * component_pool<assistant<data::reader>> r(layout.workers, ctx, addr, timeout, std::ref(store));
+ * ```
+ */
+template <class C>
+class component_pool
+{
+    std::vector<std::unique_ptr<component<C>>> components;
+public:
+    /*! \brief Create a pool of components.
+     *
+     * \param placements Where each instance should run. One instance
+     * is created for each placement.
+     * \param args These arguments will be passed to the constructor
+     * of every instance of `C`.
+     */
+    template <class ...Args>
+    component_pool(std::vector<placement::thread_placement> const & placements,
+                   Args && ... args)
+    {
+        for (auto & where : placements) {
+            components.emplace_back(new component<C>(placed, where, args...));
+        }
+    }
+
+    /*! \brief Create a pool of unplaced components.
+     *
+     * \param count The number of instances.
+     * \param args These arguments will be passed to the constructor
+     * of every instance of `C`.
+     */
+    template <class ...Args>
+    component_pool(std::size_t count, Args && ... args)
+        : component_pool(std::vector<placement::thread_placement>(count),
+                         std::forward<Args>(args)...)
+    {}
+
+    /*! \brief Stop every instance without waiting, see
+     *  [component::stop](\ref component::stop).
+     */
+    auto stop() -> void
+    {
+        for (auto & comp : components) {
+            comp->stop();
+        }
+    }
+
+    /*! \brief The number of instances in the pool. */
+    auto size() const noexcept -> std::size_t { return components.size(); }
+
+    // The instances drain at the same time, rather than one by one
+    ~component_pool()
+    {
+        stop();
+    }
 };
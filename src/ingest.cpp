@@ -0,0 +1,168 @@
+/*
+  Copyright 2017 Kaan Genç
+
+  This file is part of DagBox.
+
+  DagBox is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  DagBox is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with DagBox.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include "ingest.hpp"
+using namespace dagbox;
+
+
+ingest::ingest(client & sender,
+               std::string const & service_name,
+               std::size_t window,
+               std::size_t chunk_size,
+               acknowledgement on_ack)
+    : sender(sender),
+      service_name(service_name),
+      window(std::max<std::size_t>(window, 1)),
+      chunk_size(std::max<std::size_t>(std::min(chunk_size, window), 1)),
+      on_ack(std::move(on_ack)),
+      next_chunk(0),
+      sent(0),
+      next_ack(0),
+      acked(0),
+      failed(0)
+{}
+
+
+ingest::~ingest()
+{
+    // The client would call back into a destroyed ingest otherwise
+    try {
+        flush();
+    } catch (std::exception &) {}
+    std::unique_lock<std::mutex> guard(lock);
+    changed.wait(guard, [this](){ return acked + failed >= sent; });
+}
+
+
+auto ingest::add(msg::part && record) -> void
+{
+    chunk.push_back(std::move(record));
+    if (chunk.size() >= chunk_size) {
+        flush();
+    }
+}
+
+
+auto ingest::flush() -> void
+{
+    if (chunk.empty()) {
+        return;
+    }
+    wait(window - chunk.size());
+
+    auto chunk_id = next_chunk++;
+    auto records = chunk.size();
+    sent += records;
+    sender.send(msg::request::make(service_name, {}, std::move(chunk)),
+                [this, chunk_id, records](msg::reply && reply) {
+                    if (reply.data().size() != records) {
+                        fail(chunk_id, records, std::make_exception_ptr(
+                                 exception::mismatched_reply(
+                                     "Service " + service_name + " replied with "
+                                     + std::to_string(reply.data().size())
+                                     + " parts to " + std::to_string(records)
+                                     + " records")));
+                        return;
+                    }
+                    arrive(chunk_id, records, std::move(reply.data()));
+                },
+                [this, chunk_id, records](std::exception_ptr reason) {
+                    fail(chunk_id, records, reason);
+                });
+    chunk = msg::many_parts();
+}
+
+
+auto ingest::finish() -> void
+{
+    flush();
+    wait(0);
+}
+
+
+auto ingest::acknowledged() -> std::size_t
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return acked;
+}
+
+
+auto ingest::wait(std::size_t allowed) -> void
+{
+    std::unique_lock<std::mutex> guard(lock);
+    changed.wait(guard, [&](){
+            return error || sent - acked - failed <= allowed;
+        });
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+
+auto ingest::arrive(uint64_t chunk_id, std::size_t records,
+                    boost::optional<msg::many_parts> && parts) -> void
+{
+    // Replies are only acknowledged once every earlier chunk has
+    // been, which keeps the keys in the order of the records
+    std::vector<msg::many_parts> ready;
+    std::size_t ready_records = 0, failed_records = 0;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        arrived.emplace(chunk_id, std::make_pair(records, std::move(parts)));
+        auto next = arrived.find(next_ack);
+        while (next != arrived.end()) {
+            if (next->second.second) {
+                ready_records += next->second.first;
+                ready.push_back(std::move(*next->second.second));
+            } else {
+                failed_records += next->second.first;
+            }
+            arrived.erase(next);
+            next = arrived.find(++next_ack);
+        }
+    }
+    // Only the thread of the client calls this, so the chunks are
+    // still passed on in order
+    if (on_ack) {
+        for (auto & parts : ready) {
+            on_ack(std::move(parts));
+        }
+    }
+    // The records only count once they are passed on, so finish()
+    // and the destructor can't return while a callback still runs.
+    // Waking the waiters under the lock keeps the ingest from being
+    // destroyed before this returns.
+    std::lock_guard<std::mutex> guard(lock);
+    acked += ready_records;
+    failed += failed_records;
+    changed.notify_all();
+}
+
+
+auto ingest::fail(uint64_t chunk_id, std::size_t records, std::exception_ptr reason) -> void
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (!error) {
+            error = reason;
+        }
+    }
+    // The chunks after a failed one are still acknowledged
+    arrive(chunk_id, records, boost::none);
+}
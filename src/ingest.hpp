@@ -0,0 +1,156 @@
+/*
+  Copyright 2017 Kaan Genç
+
+  This file is part of DagBox.
+
+  DagBox is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  DagBox is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with DagBox.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <boost/optional.hpp>
+#include "message.hpp"
+#include "client.hpp"
+
+
+/*! \file ingest.hpp
+ * Writing large numbers of records through a client.
+ */
+
+
+namespace dagbox
+{
+    /*! \brief Sends a continuous stream of records to a service.
+     *
+     * Records are gathered into chunks, and each chunk is sent as a
+     * single request, which the datastore writer stores in a single
+     * transaction. Chunks are sent without waiting for the earlier
+     * ones to be replied to, as long as fewer than `window` records
+     * are unacknowledged. Adding records blocks once the window is
+     * full, so the throughput is limited by how fast the service
+     * stores records rather than by the round trip to it.
+     *
+     * ```
+     * dagbox::client c(ctx, broker_addr, std::chrono::milliseconds{5000}, 0);
+     * dagbox::ingest load(c, "datastore writer", 4096, 256,
+     *                     [&](msg::many_parts && keys) { save(keys); });
+     * for (auto & record : records) {
+     *     load.add(encode(record));
+     * }
+     * load.finish();
+     * ```
+     *
+     * Replies are acknowledged in the order the records were added,
+     * even if they arrive out of order, so the keys the writer
+     * generates line up with the records. The service must reply
+     * with one part for each record.
+     *
+     * A record that is sent again may be written twice, so the client
+     * should not retry requests.
+     */
+    class ingest
+    {
+    public:
+        /*! \brief Called with the reply parts for a chunk of records,
+         *  in the order the records were added.
+         *
+         * Called on the thread of the client, so it must not add
+         * records to the ingest.
+         */
+        typedef std::function<void(msg::many_parts &&)> acknowledgement;
+
+    private:
+        client & sender;
+        std::string const service_name;
+        std::size_t const window;
+        std::size_t const chunk_size;
+        acknowledgement on_ack;
+
+        msg::many_parts chunk;
+        uint64_t next_chunk;
+        std::size_t sent;
+
+        // Shared with the thread of the client
+        std::mutex lock;
+        std::condition_variable changed;
+        // Replies that arrived before those of earlier chunks, with
+        // the number of records they hold. Failed chunks are left
+        // empty.
+        std::map<uint64_t, std::pair<std::size_t, boost::optional<msg::many_parts>>> arrived;
+        uint64_t next_ack;
+        std::size_t acked;
+        std::size_t failed;
+        std::exception_ptr error;
+
+        auto arrive(uint64_t chunk_id, std::size_t records,
+                    boost::optional<msg::many_parts> && parts) -> void;
+        auto fail(uint64_t chunk_id, std::size_t records, std::exception_ptr reason) -> void;
+        auto wait(std::size_t allowed) -> void;
+    public:
+        /*! \brief Start an ingest session.
+         *
+         * \param sender The client the records are sent through. It
+         * must outlive the ingest.
+         * \param service_name The service that stores the records.
+         * \param window The largest number of records that may be
+         * unacknowledged at once.
+         * \param chunk_size The number of records sent in each
+         * request. It is capped by the window.
+         * \param on_ack Called with the reply to each chunk.
+         */
+        ingest(client & sender,
+               std::string const & service_name,
+               std::size_t window = 4096,
+               std::size_t chunk_size = 256,
+               acknowledgement on_ack = acknowledgement());
+
+        /*! \brief Send the remaining records, and wait for them to be
+         *  acknowledged. Failures are ignored.
+         */
+        ~ingest();
+
+        ingest(ingest const &) = delete;
+        ingest(ingest &&) = delete;
+        auto operator=(ingest const &) -> ingest & = delete;
+        auto operator=(ingest &&) -> ingest & = delete;
+
+        /*! \brief Add a record.
+         *
+         * Blocks while the window is full.
+         *
+         * \throws Any error that failed an earlier chunk, such as
+         * exception::timeout.
+         */
+        auto add(msg::part && record) -> void;
+
+        /*! \brief Send the records that don't fill a chunk yet. */
+        auto flush() -> void;
+
+        /*! \brief Send the remaining records, and wait until every
+         *  record is acknowledged.
+         *
+         * \throws Any error that failed a chunk.
+         */
+        auto finish() -> void;
+
+        /*! \brief The number of records that have been acknowledged. */
+        auto acknowledged() -> std::size_t;
+    };
+};
@@ -16,6 +16,7 @@
   You should have received a copy of the GNU Lesser General Public
   License along with DagBox.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <algorithm>
 #include <cstring>
 #include <zmq.hpp>
 #include "message.hpp"
@@ -23,6 +24,45 @@ using namespace msg;
 using namespace detail;
 
 
+namespace
+{
+    // Parts that are the same for every message are kept in static
+    // storage, and the outgoing message parts point to them instead
+    // of carrying their own copies.
+    char const protocol_header[] = {'D', 'G', 'B', 'X', protocol::version};
+
+    enum types const type_values[] = {
+        types::registration,
+        types::ping,
+        types::pong,
+        types::request,
+        types::reply,
+        types::reconnect,
+        types::partial,
+        types::credit,
+    };
+
+    auto noop_free(void *, void *) -> void
+    {
+        // The data is in static storage, there is nothing to free
+    }
+
+    auto constant_part(void const * data, size_t size) noexcept -> part
+    {
+#if ZMQ_VERSION >= ZMQ_MAKE_VERSION(4, 2, 0)
+        // Without a free function, 0MQ treats the data as a constant
+        // and points at it, where a free function would need a
+        // reference count to be allocated. Copying the parts wouldn't
+        // allocate either, they fit in the message itself.
+        (void) noop_free;
+        return part(const_cast<void *>(data), size, nullptr);
+#else
+        return part(const_cast<void *>(data), size, noop_free);
+#endif
+    }
+}
+
+
 
 auto msg::read(std::vector<zmq::message_t> && parts) -> any_message
 {
@@ -54,6 +94,12 @@ auto msg::read(std::vector<zmq::message_t> && parts) -> any_message
     case types::reconnect:
         return reconnect::read(std::move(h), iter, end_);
         break;
+    case types::partial:
+        return partial::read(std::move(h), iter, end_);
+        break;
+    case types::credit:
+        return credit::read(std::move(h), iter, end_);
+        break;
     }
 
     // The compiler can't recognise that the switch above will always
@@ -64,18 +110,42 @@ auto msg::read(std::vector<zmq::message_t> && parts) -> any_message
 }
 
 
+//////////////////// Numbers
+
+auto detail::make_uint32_part(uint32_t value) -> part
+{
+    part p(sizeof(value));
+    auto bytes = p.data<uint8_t>();
+    for (std::size_t i = 0; i < sizeof(value); ++i) {
+        bytes[i] = static_cast<uint8_t>((value >> (8 * i)) & 0xff);
+    }
+    return p;
+}
+
+
+auto detail::read_uint32_part(part const & p) -> uint32_t
+{
+    auto bytes = p.data<uint8_t>();
+    uint32_t value = 0;
+    for (std::size_t i = 0; i < sizeof(value); ++i) {
+        value |= static_cast<uint32_t>(bytes[i]) << (8 * i);
+    }
+    return value;
+}
+
+
 //////////////////// Header
 
 auto header::make_protocol_part() noexcept -> part
 {
-    return part(protocol::header.data(),
-                protocol::header.size());
+    return constant_part(protocol_header, sizeof(protocol_header));
 }
 
 
 auto header::make_type_part(enum types type_) noexcept -> part
 {
-    return part(&type_, sizeof(type_));
+    auto index = static_cast<char>(type_) - type_lower_bound;
+    return constant_part(&type_values[index], sizeof(type_));
 }
 
 
@@ -139,7 +209,9 @@ auto header::type() const noexcept -> enum types
 
 auto header::type(enum types new_type) noexcept -> void
 {
-    *(type_.data<enum types>()) = new_type;
+    // The type part may point to shared constant storage, so it is
+    // replaced rather than modified in place
+    type_ = make_type_part(new_type);
 }
 
 
@@ -171,18 +243,69 @@ auto header::send(part_sink & sink) -> void
 //////////////////// Registration
 
 registration::registration(header && head,
-                           part && service)
+                           part && service,
+                           optional_part && concurrency,
+                           many_parts && more_services)
     : head(std::move(head)),
-      service_(std::move(service))
+      service_(std::move(service)),
+      concurrency_(std::move(concurrency)),
+      more_services_(std::move(more_services))
 {}
 
 
-auto registration::make(std::string const & service_name) noexcept
+auto registration::make(std::string const & service_name,
+                        uint32_t concurrency)
     -> registration
 {
+    optional_part concurrency_part;
+    if (concurrency != 1) {
+        concurrency_part = make_uint32_part(concurrency);
+    }
     return registration(header::make(types::registration),
                         part(service_name.data(),
-                             service_name.size()));
+                             service_name.size()),
+                        std::move(concurrency_part),
+                        many_parts());
+}
+
+
+auto registration::make(std::vector<std::string> const & service_names,
+                        uint32_t concurrency)
+    -> registration
+{
+    if (service_names.size() == 0) {
+        throw exception::malformed("Registration needs at least one service");
+    }
+    auto reg = make(service_names.front(), concurrency);
+    if (service_names.size() > 1 && !reg.concurrency_) {
+        // The concurrency comes before the other services, so it
+        // can't be left out
+        reg.concurrency_ = make_uint32_part(concurrency);
+    }
+    for (std::size_t i = 1; i < service_names.size(); ++i) {
+        auto & name = service_names[i];
+        reg.more_services_.emplace_back(name.data(), name.size());
+    }
+    return reg;
+}
+
+
+auto registration::services() const -> std::vector<std::string>
+{
+    std::vector<std::string> names = {service()};
+    for (auto & p : more_services_) {
+        names.emplace_back(p.data<char>(), p.size());
+    }
+    return names;
+}
+
+
+auto registration::concurrency() const noexcept -> uint32_t
+{
+    if (!concurrency_) {
+        return 1;
+    }
+    return read_uint32_part(*concurrency_);
 }
 
 
@@ -190,6 +313,8 @@ auto registration::send(detail::part_sink & sink)
     -> void
 {
     detail::send_section(sink, service_);
+    detail::send_section(sink, concurrency_);
+    detail::send_section(sink, more_services_);
 }
 
 
@@ -347,3 +472,201 @@ auto reconnect::send(detail::part_sink &) -> void
 {
     // Reconnect messages only have a header, nothing to do here
 }
+
+
+
+//////////////////// Partial
+
+uint32_t const partial::initial_credit;
+
+
+partial::partial(header        && head,
+                 optional_part && client_,
+                 part          && client_delimiter,
+                 many_parts    && metadata,
+                 part          && metadata_delimiter,
+                 many_parts    && data)
+    : head(std::move(head)),
+      client_(std::move(client_)),
+      client_delimiter(std::move(client_delimiter)),
+      metadata_(std::move(metadata)),
+      metadata_delimiter(std::move(metadata_delimiter)),
+      data_(std::move(data))
+{}
+
+
+auto partial::make(msg::request const & r, many_parts && data_parts)
+    -> partial
+{
+    optional_part client;
+    if (r.client_) {
+        client = copy_part(*r.client_);
+    }
+    many_parts metadata;
+    for (auto const & p : r.metadata_) {
+        metadata.push_back(copy_part(p));
+    }
+    return partial(header::make(partial::type),
+                   std::move(client),
+                   part(),
+                   std::move(metadata),
+                   part(),
+                   std::move(data_parts));
+}
+
+
+auto partial::send(detail::part_sink & sink) -> void
+{
+    using namespace detail;
+
+    send_section(sink, client_);
+    send_section(sink, client_delimiter);
+    send_section(sink, metadata_);
+    send_section(sink, metadata_delimiter);
+    send_section(sink, data_);
+}
+
+
+
+//////////////////// Credit
+
+credit::credit(detail::header && head,
+               part && stream_,
+               part && amount_)
+    : head(std::move(head)),
+      stream_(std::move(stream_)),
+      amount_(std::move(amount_))
+{}
+
+
+auto credit::make(msg::address const & stream, uint32_t amount) -> credit
+{
+    return credit(header::make(credit::type),
+                  part(stream.data(), stream.size()),
+                  make_uint32_part(amount));
+}
+
+
+auto credit::amount() const noexcept -> uint32_t
+{
+    return read_uint32_part(amount_);
+}
+
+
+auto credit::send(detail::part_sink & sink) -> void
+{
+    detail::send_section(sink, stream_);
+    detail::send_section(sink, amount_);
+}
+
+
+//////////////////// Request IDs
+
+namespace
+{
+    auto is_request_id(part const & p) -> bool
+    {
+        return p.size() == request_id_prefix.size() + sizeof(uint64_t)
+            && std::equal(request_id_prefix.begin(), request_id_prefix.end(),
+                          p.data<char>());
+    }
+}
+
+
+auto msg::make_request_id(uint64_t id) -> part
+{
+    part p(request_id_prefix.size() + sizeof(id));
+    std::copy(request_id_prefix.begin(), request_id_prefix.end(), p.data<char>());
+    auto bytes = p.data<uint8_t>() + request_id_prefix.size();
+    for (std::size_t i = 0; i < sizeof(id); ++i) {
+        bytes[i] = static_cast<uint8_t>((id >> (8 * i)) & 0xff);
+    }
+    return p;
+}
+
+
+auto msg::find_request_id(many_parts const & metadata) -> boost::optional<uint64_t>
+{
+    for (auto & p : metadata) {
+        if (!is_request_id(p)) {
+            continue;
+        }
+        auto bytes = p.data<uint8_t>() + request_id_prefix.size();
+        uint64_t id = 0;
+        for (std::size_t i = 0; i < sizeof(id); ++i) {
+            id |= static_cast<uint64_t>(bytes[i]) << (8 * i);
+        }
+        return id;
+    }
+    return boost::none;
+}
+
+
+auto msg::set_request_id(many_parts & metadata, uint64_t id) -> void
+{
+    metadata.erase(std::remove_if(metadata.begin(), metadata.end(), is_request_id),
+                   metadata.end());
+    metadata.push_back(make_request_id(id));
+}
+
+
+auto msg::stream_suffix(many_parts const & metadata) -> std::string
+{
+    auto id = find_request_id(metadata).value_or(0);
+    std::string suffix(stream_suffix_size, '\0');
+    for (std::size_t i = 0; i < stream_suffix_size; ++i) {
+        suffix[i] = static_cast<char>((id >> (8 * i)) & 0xff);
+    }
+    return suffix;
+}
+
+
+//////////////////// Errors
+
+auto msg::make_error_reply(request && req, std::string const & what) -> reply
+{
+    if (!is_error(req.metadata())) {
+        req.metadata().emplace_back(error_flag.data(), error_flag.size());
+    }
+    many_parts data;
+    data.emplace_back(what.data(), what.size());
+    req.data() = std::move(data);
+    return reply::make(std::move(req));
+}
+
+
+auto msg::copy_without_data(request const & req) -> request
+{
+    auto head = header::make(request::type);
+    auto address = req.head.address();
+    if (address) {
+        head.address(*address);
+    }
+    optional_part client;
+    if (req.client_) {
+        client = copy_part(*req.client_);
+    }
+    many_parts metadata;
+    for (auto const & p : req.metadata_) {
+        metadata.push_back(copy_part(p));
+    }
+    return request(std::move(head),
+                   copy_part(req.service_),
+                   std::move(client),
+                   part(),
+                   std::move(metadata),
+                   part(),
+                   many_parts());
+}
+
+
+auto msg::is_error(many_parts const & metadata) -> bool
+{
+    for (auto & p : metadata) {
+        if (p.size() == error_flag.size()
+            && std::memcmp(p.data(), error_flag.data(), error_flag.size()) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
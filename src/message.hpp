@@ -94,8 +94,10 @@ namespace msg
             request = 0x04,
             reply = 0x05,
             reconnect = 0x06,
+            partial = 0x07,
+            credit = 0x08,
         };
-        auto const type_upper_bound = static_cast<char>(types::reconnect);
+        auto const type_upper_bound = static_cast<char>(types::credit);
         auto const type_lower_bound = static_cast<char>(types::registration);
 
 
@@ -170,6 +172,19 @@ namespace msg
                 sink.push_back(std::move(p));
             }
         }
+
+        // Make a part that shares the contents of `original`
+        auto inline copy_part(part const & original) -> part
+        {
+            part p;
+            p.copy(&original);
+            return p;
+        }
+
+        // Numbers are sent as 4 byte little-endian integers, so that
+        // they read the same on every machine
+        auto make_uint32_part(uint32_t value) -> part;
+        auto read_uint32_part(part const & p) -> uint32_t;
     };
 
 
@@ -180,6 +195,8 @@ namespace msg
     class request;
     class reply;
     class reconnect;
+    class partial;
+    class credit;
 
     /*! \brief Any message type.
      *
@@ -193,7 +210,9 @@ namespace msg
         pong,
         request,
         reply,
-        reconnect
+        reconnect,
+        partial,
+        credit
         > any_message;
 
 
@@ -325,9 +344,13 @@ namespace msg
     {
         detail::header head;
         part service_;
+        optional_part concurrency_;
+        many_parts more_services_;
 
         registration(detail::header && head,
-                     part && service);
+                     part && service,
+                     optional_part && concurrency,
+                     many_parts && more_services);
 
         auto send(detail::part_sink & sink) -> void;
 
@@ -335,9 +358,24 @@ namespace msg
         auto static read(detail::header && h, iterator & iter, iterator & end)
             -> registration {
             auto service = detail::read_part(iter, end);
+            optional_part concurrency;
+            if (iter != end) {
+                concurrency = detail::read_part(iter, end);
+                if (concurrency->size() != sizeof(uint32_t)) {
+                    throw exception::malformed("Registration concurrency "
+                                               "is malformed");
+                }
+            }
+            auto more_services = detail::read_many(iter, end);
+            if (iter != end) {
+                throw exception::malformed("Registration service names "
+                                           "are malformed");
+            }
 
             return registration(std::move(h),
-                                std::move(service));
+                                std::move(service),
+                                std::move(concurrency),
+                                std::move(more_services));
         }
 
         enum detail::types static const type = detail::types::registration;
@@ -346,16 +384,45 @@ namespace msg
          *
          * \param service_name The name of the service the worker can
          * provide.
+         * \param concurrency The number of requests the worker can
+         * process at the same time.
          */
-        auto static make(std::string const & service_name) noexcept
+        auto static make(std::string const & service_name,
+                         uint32_t concurrency = 1)
+            -> registration;
+
+        /*! \brief Create a registration for several services.
+         *
+         * The worker will be given requests for any of the services,
+         * and the concurrency is shared between all of them.
+         *
+         * \param service_names The names of the services the worker
+         * can provide. Must not be empty.
+         * \param concurrency The number of requests the worker can
+         * process at the same time.
+         */
+        auto static make(std::vector<std::string> const & service_names,
+                         uint32_t concurrency = 1)
             -> registration;
 
         /*! \brief Get the service name this message is registering for.
+         *
+         * If the message registers several services, this is the
+         * first of them.
          */
         auto inline service() const noexcept -> std::string const{
             return std::string(service_.data<char>(), service_.size());
         }
 
+        /*! \brief Get all service names this message is registering for.
+         */
+        auto services() const -> std::vector<std::string>;
+
+        /*! \brief Get the number of requests the worker can process
+         *  at the same time.
+         */
+        auto concurrency() const noexcept -> uint32_t;
+
         /*! \brief Get the address of the sender. */
         auto inline address() const noexcept -> boost::optional<msg::address> {
             return head.address();
@@ -564,8 +631,10 @@ namespace msg
         }
 
         friend auto read(std::vector<zmq::message_t> && parts) -> any_message;
+        friend auto copy_without_data(request const & req) -> request;
         friend struct detail::sender;
         friend class reply;
+        friend class partial;
     };
 
 
@@ -698,4 +767,336 @@ namespace msg
         friend auto read(std::vector<zmq::message_t> && parts) -> any_message;
         friend struct detail::sender;
     };
+
+
+    /*! \brief A part of a reply, that is followed by more parts.
+     *
+     * Workers may send the result of a request in chunks, as any
+     * number of partial replies followed by a [reply](\ref reply)
+     * that completes it. The broker doesn't give more work to a worker
+     * until the final reply arrives.
+     *
+     * When a client receives a partial reply, its
+     * [stream](\ref partial::stream) identifies the worker that is
+     * sending it and the request it answers. The worker may only send as many partial replies as
+     * the client allows with [credit](\ref credit) messages, plus an
+     * initial window of [initial_credit](\ref partial::initial_credit).
+     */
+    class partial
+    {
+        detail::header head;
+        optional_part client_;
+        part          client_delimiter;
+        many_parts    metadata_;
+        part          metadata_delimiter;
+        many_parts    data_;
+
+        partial(detail::header && head,
+                optional_part && client_,
+                part          && client_delimiter,
+                many_parts    && metadata,
+                part          && metadata_delimiter,
+                many_parts    && data);
+
+        auto send(detail::part_sink & sink) -> void;
+
+        template <class iterator>
+        auto static read(detail::header && head,
+                         iterator & iter,
+                         iterator & end)
+            -> partial {
+            using namespace detail;
+
+            auto client_            = read_optional(iter, end);
+            auto client_delimiter   = read_part(iter, end);
+            auto metadata           = read_many(iter, end);
+            auto metadata_delimiter = read_part(iter, end);
+            auto data               = read_many(iter, end);
+
+            return partial(std::move(head),
+                           std::move(client_),
+                           std::move(client_delimiter),
+                           std::move(metadata),
+                           std::move(metadata_delimiter),
+                           std::move(data));
+        }
+
+        enum detail::types static const type = detail::types::partial;
+    public:
+        /*! \brief The number of partial replies a worker may send
+         *  before receiving any credit.
+         */
+        uint32_t static const initial_credit = 8;
+
+        /*! \brief Create a partial reply for a request.
+         *
+         * The client and the metadata of the request are shared with
+         * the partial reply, the request itself is left intact so that
+         * it can later be turned into the final reply.
+         *
+         * \param r The request that is being replied to.
+         * \param data_parts The data of this chunk of the reply.
+         */
+        auto static make(request const & r, many_parts && data_parts)
+            -> partial;
+
+        /*! \brief Get the metadata of the partial reply.
+         *
+         * The reference returned by this function is valid as long as
+         * the object it is called on is.
+         */
+        auto inline metadata() -> many_parts & {
+            return metadata_;
+        }
+        /*! \brief Get the data of the partial reply.
+         *
+         * The reference returned by this function is valid as long as
+         * the object it is called on is.
+         */
+        auto inline data() -> many_parts & {
+            return data_;
+        }
+
+        /*! \brief Get the address of the sender. */
+        auto inline address() const noexcept -> boost::optional<msg::address> {
+            return head.address();
+        }
+
+        /*! \brief Change the address of the sender. */
+        auto inline address(msg::address const & addr) -> void {
+            head.address(addr);
+        }
+
+        /*! \brief Get the destination of the partial reply.
+         *
+         * Once the broker forwards a partial reply to the client, this
+         * is replaced with the name of the stream, see
+         * [stream](\ref partial::stream).
+         */
+        auto inline client() const noexcept -> boost::optional<msg::address> {
+            if (client_) {
+                return std::string(client_->data<char>(), client_->size());
+            } else {
+                return boost::none;
+            }
+        }
+
+        /*! \brief Set the destination of the partial reply. */
+        auto inline client(msg::address const & addr) noexcept -> void {
+            client_ = part(addr.data(), addr.size());
+        }
+
+        /*! \brief Get the stream this partial reply belongs to.
+         *
+         * Only meaningful for partial replies that were received from
+         * the broker. It is the address of the worker followed by a
+         * [stream suffix](\ref stream_suffix). Clients pass this to
+         * [credit::make](\ref credit::make) to allow the worker to
+         * send more.
+         */
+        auto inline stream() const noexcept -> boost::optional<msg::address> {
+            return client();
+        }
+
+        friend auto read(std::vector<zmq::message_t> && parts) -> any_message;
+        friend struct detail::sender;
+    };
+
+
+    /*! \brief Allows a worker to send more partial replies.
+     *
+     * Clients send this message after consuming
+     * [partial replies](\ref partial). The broker forwards it to the
+     * worker that is sending the stream.
+     */
+    class credit
+    {
+        detail::header head;
+        part stream_;
+        part amount_;
+
+        credit(detail::header && head,
+               part && stream_,
+               part && amount_);
+
+        auto send(detail::part_sink & sink) -> void;
+
+        template <class iterator>
+        auto static read(detail::header && h, iterator & iter, iterator & end)
+            -> credit {
+            auto stream_ = detail::read_part(iter, end);
+            auto amount_ = detail::read_part(iter, end);
+
+            if (amount_.size() != sizeof(uint32_t)) {
+                throw exception::malformed("Credit amount is malformed");
+            }
+
+            return credit(std::move(h),
+                          std::move(stream_),
+                          std::move(amount_));
+        }
+
+        enum detail::types static const type = detail::types::credit;
+    public:
+        /*! \brief Create a credit message.
+         *
+         * \param stream The [stream](\ref partial::stream) of the
+         * partial replies that were consumed.
+         * \param amount The number of additional partial replies the
+         * worker may send.
+         */
+        auto static make(msg::address const & stream, uint32_t amount) -> credit;
+
+        /*! \brief The number of additional partial replies allowed. */
+        auto amount() const noexcept -> uint32_t;
+
+        /*! \brief Get the stream the credit is for.
+         *
+         * When a worker receives the credit, this is the address of
+         * the client that sent it followed by a
+         * [stream suffix](\ref stream_suffix).
+         */
+        auto inline stream() const noexcept -> msg::address {
+            return std::string(stream_.data<char>(), stream_.size());
+        }
+
+        /*! \brief Change the stream the credit is for. */
+        auto inline stream(msg::address const & addr) -> void {
+            stream_ = part(addr.data(), addr.size());
+        }
+
+        /*! \brief Get the address of the sender. */
+        auto inline address() const noexcept -> boost::optional<msg::address> {
+            return head.address();
+        }
+
+        /*! \brief Change the address of the sender. */
+        auto inline address(msg::address const & addr) -> void {
+            head.address(addr);
+        }
+
+        friend auto read(std::vector<zmq::message_t> && parts) -> any_message;
+        friend struct detail::sender;
+    };
+
+
+    namespace detail
+    {
+        template <class modifier>
+        class payload_visitor
+            : public boost::static_visitor<part_source>
+        {
+            modifier & modify;
+        public:
+            payload_visitor(modifier & modify)
+                : modify(modify)
+            {}
+
+            auto operator()(request & m) const -> part_source {
+                modify(m);
+                return msg::send(m);
+            }
+
+            auto operator()(reply & m) const -> part_source {
+                modify(m);
+                return msg::send(m);
+            }
+
+            auto operator()(partial & m) const -> part_source {
+                modify(m);
+                return msg::send(m);
+            }
+
+            // Other messages carry no payload
+            template <class message>
+            auto operator()(message & m) const -> part_source {
+                return msg::send(m);
+            }
+        };
+    };
+
+
+    /*! \brief Modify the payload of a message that is ready to be sent.
+     *
+     * If `parts` contain a [request](\ref request), a
+     * [reply](\ref reply) or a [partial reply](\ref partial),
+     * `modify` is called with it before it is turned back into
+     * parts. Any other message is returned unchanged.
+     *
+     * \param parts Message parts, as returned by [send](\ref send).
+     * \param modify A function object that can be called with a
+     * `request &`, a `reply &` and a `partial &`.
+     */
+    template <class modifier>
+    auto modify_payload(part_source && parts, modifier modify) -> part_source
+    {
+        auto message = read(std::move(parts));
+        return boost::apply_visitor(detail::payload_visitor<modifier>(modify),
+                                    message);
+    }
+
+
+    /*! \brief Prefix of the metadata part that carries a request ID.
+     *
+     * Since workers copy the metadata of a request into its reply,
+     * a request ID can be used to match a reply to the request it
+     * answers when several requests are in flight.
+     */
+    std::string const request_id_prefix = "DGBX:rid";
+
+    /*! \brief Make a metadata part that carries a request ID. */
+    auto make_request_id(uint64_t id) -> part;
+
+    /*! \brief Find the request ID in the metadata of a message.
+     *
+     * \returns The ID, or nothing if the metadata doesn't carry one.
+     */
+    auto find_request_id(many_parts const & metadata) -> boost::optional<uint64_t>;
+
+    /*! \brief Replace the request ID in the metadata of a message.
+     *
+     * Any request ID the metadata already carries is removed first.
+     */
+    auto set_request_id(many_parts & metadata, uint64_t id) -> void;
+
+    /*! \brief The length of a [stream suffix](\ref stream_suffix). */
+    std::size_t const stream_suffix_size = sizeof(uint64_t);
+
+    /*! \brief Tell apart the streams between the same client and
+     *  worker.
+     *
+     * A stream of [partial replies](\ref partial) is named by the
+     * address at its other end followed by this suffix, which is the
+     * request ID of the request being replied to, or 0 if it has
+     * none.
+     */
+    auto stream_suffix(many_parts const & metadata) -> std::string;
+
+
+    /*! \brief Metadata part that marks a reply as an error.
+     *
+     * A worker that fails to process a request still replies to it,
+     * so that the client isn't left waiting and the broker frees the
+     * slot of the worker. The only data part of such a reply
+     * describes the failure.
+     */
+    std::string const error_flag = "DGBX:err";
+
+    /*! \brief Turn a request into a reply reporting that it failed.
+     *
+     * \param req The request that failed.
+     * \param what A description of the failure.
+     */
+    auto make_error_reply(request && req, std::string const & what) -> reply;
+
+    /*! \brief Copy a request without its data.
+     *
+     * The copy keeps what is needed to reply to the request, so that
+     * it can still be answered with an error once the request itself
+     * has been moved into a worker.
+     */
+    auto copy_without_data(request const & req) -> request;
+
+    /*! \brief Whether the metadata of a reply marks it as an error. */
+    auto is_error(many_parts const & metadata) -> bool;
 };
@@ -0,0 +1,185 @@
+/*
+  Copyright 2017 Kaan Genç
+
+  This file is part of DagBox.
+
+  DagBox is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  DagBox is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with DagBox.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "placement.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iterator>
+#include <fstream>
+#include <sstream>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+using namespace placement;
+
+
+namespace
+{
+    // Parse a list of CPUs in the kernel's format, such as "0-3,8"
+    auto parse_cpu_list(std::string const & list) -> std::vector<int>
+    {
+        std::vector<int> cpus;
+        std::stringstream ranges(list);
+        std::string range;
+        while (std::getline(ranges, range, ',')) {
+            if (range.empty() || range == "\n") {
+                continue;
+            }
+            auto dash = range.find('-');
+            auto first = std::stoi(range.substr(0, dash));
+            auto last = dash == std::string::npos
+                ? first : std::stoi(range.substr(dash + 1));
+            for (auto cpu = first; cpu <= last; ++cpu) {
+                cpus.push_back(cpu);
+            }
+        }
+        return cpus;
+    }
+
+
+    auto bind_memory(int node) -> void
+    {
+        std::size_t const bits = 8 * sizeof(unsigned long);
+        std::size_t const max_nodes = 1024;
+        unsigned long mask[max_nodes / bits] = {};
+        if (node < 0 || static_cast<std::size_t>(node) >= max_nodes) {
+            throw placement::exception::invalid(
+                "NUMA node " + std::to_string(node) + " is out of range");
+        }
+        mask[node / bits] |= 1ul << (node % bits);
+        // Prefer the node rather than binding strictly, so that
+        // allocations still succeed when the node is out of memory
+        if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask, max_nodes) != 0) {
+            throw placement::exception::invalid(
+                "Could not bind memory to NUMA node " + std::to_string(node)
+                + ": " + std::strerror(errno));
+        }
+    }
+}
+
+
+auto placement::allowed_cpus() -> std::vector<int>
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    std::vector<int> cpus;
+    if (sched_getaffinity(0, sizeof(set), &set) != 0) {
+        return cpus;
+    }
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (CPU_ISSET(cpu, &set)) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+
+auto placement::node_cpus(int node) -> std::vector<int>
+{
+    std::ifstream list("/sys/devices/system/node/node" + std::to_string(node)
+                       + "/cpulist");
+    std::string contents;
+    if (node < 0 || !std::getline(list, contents)) {
+        throw exception::invalid("NUMA node " + std::to_string(node)
+                                 + " does not exist");
+    }
+    return parse_cpu_list(contents);
+}
+
+
+auto placement::apply(thread_placement const & where) -> void
+{
+    if (!where.name.empty()) {
+        // Linux limits thread names to 16 bytes, including the null
+        pthread_setname_np(pthread_self(), where.name.substr(0, 15).c_str());
+    }
+
+    auto cpus = where.cpus;
+    if (where.numa_node >= 0) {
+        auto on_node = node_cpus(where.numa_node);
+        if (cpus.empty()) {
+            cpus = on_node;
+        } else {
+            std::sort(cpus.begin(), cpus.end());
+            std::sort(on_node.begin(), on_node.end());
+            std::vector<int> both;
+            std::set_intersection(cpus.begin(), cpus.end(),
+                                  on_node.begin(), on_node.end(),
+                                  std::back_inserter(both));
+            cpus = both;
+            if (cpus.empty()) {
+                throw exception::invalid("None of the CPUs are on NUMA node "
+                                         + std::to_string(where.numa_node));
+            }
+        }
+        bind_memory(where.numa_node);
+    }
+
+    if (cpus.empty()) {
+        return;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (auto cpu : cpus) {
+        if (cpu < 0 || cpu >= CPU_SETSIZE) {
+            throw exception::invalid("CPU " + std::to_string(cpu)
+                                     + " is out of range");
+        }
+        CPU_SET(cpu, &set);
+    }
+    auto error = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (error != 0) {
+        throw exception::invalid(std::string("Could not set the CPU affinity: ")
+                                 + std::strerror(error));
+    }
+}
+
+
+auto placement::isolate_broker(std::size_t workers, std::string const & name)
+    -> layout
+{
+    auto cpus = allowed_cpus();
+    layout result;
+    result.broker.name = "broker";
+    if (cpus.empty()) {
+        // Nothing is known about the CPUs, only name the threads
+        for (std::size_t i = 0; i < workers; ++i) {
+            thread_placement worker;
+            worker.name = name + "-" + std::to_string(i);
+            result.workers.push_back(worker);
+        }
+        return result;
+    }
+    // The first CPUs usually handle interrupts and housekeeping, so
+    // the broker takes the last one
+    result.broker.cpus = {cpus.back()};
+    // With a single CPU, there is nothing to isolate the broker from
+    std::size_t worker_cpus = cpus.size() > 1 ? cpus.size() - 1 : 1;
+    for (std::size_t i = 0; i < workers; ++i) {
+        thread_placement worker;
+        worker.name = name + "-" + std::to_string(i);
+        auto index = i % worker_cpus;
+        worker.cpus = {cpus[index]};
+        result.workers.push_back(worker);
+    }
+    return result;
+}
@@ -0,0 +1,116 @@
+/*
+  Copyright 2017 Kaan Genç
+
+  This file is part of DagBox.
+
+  DagBox is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  DagBox is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with DagBox.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <string>
+#include <vector>
+#include "exception.hpp"
+
+
+/*! \file placement.hpp
+ * Controlling which CPUs and memory the threads of components use.
+ */
+
+
+/*! \brief Placing threads on CPUs and NUMA nodes.
+ */
+namespace placement
+{
+    namespace exception
+    {
+        using std::runtime_error;
+
+        /*! \brief A thread could not be placed as requested.
+         *
+         * For example, the placement refers to a CPU or a NUMA node
+         * that doesn't exist, or that the process isn't allowed to
+         * use.
+         */
+        EXCEPTION(invalid, runtime_error);
+    };
+
+
+    /*! \brief Where a thread should run.
+     *
+     * The default placement leaves the thread unnamed, and lets the
+     * operating system schedule it anywhere.
+     */
+    struct thread_placement
+    {
+        /*! \brief Name of the thread, as seen in tools like `top`.
+         *
+         * Names longer than 15 characters are truncated.
+         */
+        std::string name;
+        /*! \brief The CPUs the thread may run on. Empty for any CPU. */
+        std::vector<int> cpus;
+        /*! \brief The NUMA node to bind the thread to, or -1 for none.
+         *
+         * The thread only runs on the CPUs of the node, and its
+         * memory is allocated from the node whenever possible. If
+         * `cpus` is not empty as well, the thread runs on the CPUs
+         * that are in both.
+         */
+        int numa_node = -1;
+    };
+
+
+    /*! \brief Place the calling thread.
+     *
+     * \throws exception::invalid The thread could not be placed.
+     */
+    auto apply(thread_placement const & where) -> void;
+
+    /*! \brief The CPUs the process is allowed to run on. */
+    auto allowed_cpus() -> std::vector<int>;
+
+    /*! \brief The CPUs that belong to a NUMA node.
+     *
+     * \throws exception::invalid The node doesn't exist.
+     */
+    auto node_cpus(int node) -> std::vector<int>;
+
+    /*! \brief Placements for a broker and the workers serving it.
+     *
+     * See [isolate_broker](\ref isolate_broker).
+     */
+    struct layout
+    {
+        /*! \brief Placement of the broker. */
+        thread_placement broker;
+        /*! \brief Placements of the workers, one for each. */
+        std::vector<thread_placement> workers;
+    };
+
+    /*! \brief Pin the broker to a core of its own, and spread the
+     *  workers over the remaining ones.
+     *
+     * The broker gets the last CPU the process is allowed to run on,
+     * since the first ones usually handle interrupts and
+     * housekeeping. Each worker is pinned to one of the other CPUs
+     * in turn, so that workers sharing a CPU only happens when there
+     * are more workers than CPUs. Worker threads are named `name-0`,
+     * `name-1` and so on.
+     *
+     * \param workers The number of workers.
+     * \param name The name prefix for the worker threads.
+     */
+    auto isolate_broker(std::size_t workers, std::string const & name)
+        -> layout;
+};
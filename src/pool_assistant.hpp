@@ -0,0 +1,460 @@
+/*
+  Copyright 2017 Kaan Genç
+
+  This file is part of DagBox.
+
+  DagBox is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  DagBox is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with DagBox.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/variant.hpp>
+#include <zmq.hpp>
+#include <spdlog/spdlog.h>
+#include "message.hpp"
+#include "compression.hpp"
+#include "shm.hpp"
+#include "socket.hpp"
+#include "reactor.hpp"
+#include "heartbeat.hpp"
+#include "assistant.hpp"
+
+/*! \file pool_assistant.hpp
+ * Assistant class for running workers on a pool of threads.
+ */
+
+
+/*! \brief An assistant that runs several instances of a worker at once.
+ *
+ * The pool assistant holds a single connection and registration with
+ * the broker, and advertises how many requests it can handle at
+ * once. Every thread of the pool owns its own instance of `worker`,
+ * so workers don't need to be thread safe. For example, each thread
+ * running a [reader](\ref data::reader) opens its own read
+ * transactions, which allows a single registration to use all cores.
+ *
+ * Requests are spread over the threads as they arrive, and a thread
+ * that runs out of work takes requests waiting for other
+ * threads. Replies are sent to the broker as soon as they are
+ * complete, which may be in a different order than the requests
+ * arrived.
+ *
+ * The `worker` class has the same requirements as for
+ * [assistant](\ref assistant), except that workers taking a
+ * [reply_stream](\ref reply_stream) are not supported. Each thread
+ * tells its own worker when it is idle. Requests that the worker
+ * throws an exception for are replied to with an error, as with
+ * [assistant](\ref assistant).
+ */
+template <class worker>
+class pool_assistant
+    : public boost::static_visitor<maybe_sendable>
+{
+    auto const static socket_type = zmq::socket_type::dealer;
+
+    // Requests waiting for a thread of the pool
+    struct queue
+    {
+        std::mutex lock;
+        std::deque<msg::request> requests;
+    };
+
+    zmq::context_t & ctx;
+    std::vector<std::unique_ptr<worker>> works;
+    std::string const service_name;
+    std::chrono::milliseconds const heartbeat_interval;
+    class socket sock;
+    heartbeat beat;
+    // Threads of the pool push their replies here
+    std::string const replies_addr;
+    class socket replies;
+    shm::importer importer;
+    // Only created once a client asks for shared memory
+    std::unique_ptr<shm::ring> ring;
+    std::once_flag ring_created;
+
+    std::vector<std::unique_ptr<queue>> queues;
+    std::size_t next_queue = 0;
+    std::mutex idle_lock;
+    std::condition_variable wakeup;
+    std::atomic<std::size_t> pending;
+    // Requests given to the pool whose replies weren't forwarded yet
+    std::atomic<std::size_t> in_flight;
+    std::atomic<bool> stopping;
+    // Set while withdrawing from the broker, until it confirms
+    bool draining;
+    std::vector<std::thread> threads;
+
+    std::shared_ptr<spdlog::logger> logger;
+
+    auto register_worker() -> sendable
+    {
+        auto concurrency = static_cast<uint32_t>(works.size());
+        return msg::send(msg::registration::make(service_names(*works.front()),
+                                                 concurrency));
+    }
+
+    auto shared_ring() -> shm::ring & {
+        std::call_once(ring_created, [this](){ ring.reset(new shm::ring()); });
+        return *ring;
+    }
+
+    auto handle(msg::any_message & message) -> void {
+        auto maybe_reply = boost::apply_visitor(*this, message);
+        if (maybe_reply) {
+            sock.send_multimsg(std::move(*maybe_reply));
+            beat.sent();
+        }
+    }
+
+    // Take a request from the front of our own queue, or steal one
+    // from the back of another thread's queue
+    auto take(std::size_t own) -> boost::optional<msg::request> {
+        for (std::size_t i = 0; i < queues.size(); ++i) {
+            auto & q = *queues[(own + i) % queues.size()];
+            std::lock_guard<std::mutex> guard(q.lock);
+            if (q.requests.size() == 0) {
+                continue;
+            }
+            boost::optional<msg::request> request;
+            if (i == 0) {
+                request = std::move(q.requests.front());
+                q.requests.pop_front();
+            } else {
+                request = std::move(q.requests.back());
+                q.requests.pop_back();
+            }
+            --pending;
+            return request;
+        }
+        return boost::none;
+    }
+
+    auto encode(msg::part_source && parts, detail_assistant::encoding how)
+        -> msg::part_source
+    {
+        if (!how.compressed && !how.shared) {
+            return std::move(parts);
+        }
+        auto ring = how.shared ? &shared_ring() : nullptr;
+        return msg::modify_payload(std::move(parts), detail_assistant::encoder{how, ring});
+    }
+
+    // A request the worker failed to process is still answered, so
+    // that the broker frees the slot it took
+    auto fail(msg::request && failed, std::exception const & e) -> msg::part_source {
+        logger->error("Worker failed to process a request: {}", e.what());
+        auto how = detail_assistant::flags_of(failed.metadata());
+        return encode(msg::send(msg::make_error_reply(std::move(failed), e.what())), how);
+    }
+
+    auto process(worker & work, msg::request && request) -> msg::part_source {
+        auto failed = msg::copy_without_data(request);
+        try {
+            auto how = detail_assistant::flags_of(request.metadata());
+            compression::decompress(request);
+            return encode(work(std::move(request)), how);
+        } catch (std::exception & e) {
+            return fail(std::move(failed), e);
+        }
+    }
+
+    auto run_thread(std::size_t own) -> void {
+        class socket out(ctx, zmq::socket_type::push);
+        out.setsockopt(ZMQ_LINGER, 0);
+        out.connect(replies_addr);
+        auto & work = *works[own];
+        auto idle_interval = detail_assistant::idle_interval(work, 0);
+        auto woken = [this](){ return pending > 0 || stopping; };
+        while (true) {
+            auto request = take(own);
+            if (!request) {
+                std::unique_lock<std::mutex> guard(idle_lock);
+                if (idle_interval.count() == 0) {
+                    wakeup.wait(guard, woken);
+                } else if (!wakeup.wait_for(guard, idle_interval, woken)) {
+                    guard.unlock();
+                    detail_assistant::idle(work, 0);
+                    continue;
+                }
+                if (stopping) {
+                    return;
+                }
+                continue;
+            }
+            try {
+                out.send_multimsg(process(work, std::move(*request)));
+            } catch (std::exception & e) {
+                logger->error("Failed to send a reply: {}", e.what());
+                // Nothing will be forwarded for it
+                --in_flight;
+            }
+        }
+    }
+
+    auto dispatch(msg::request && request) -> void {
+        auto & q = *queues[next_queue];
+        next_queue = (next_queue + 1) % queues.size();
+        ++in_flight;
+        {
+            // Counted together with the push, so that a thread
+            // taking the request can't see the count before it
+            std::lock_guard<std::mutex> idle_guard(idle_lock);
+            std::lock_guard<std::mutex> guard(q.lock);
+            q.requests.push_back(std::move(request));
+            ++pending;
+        }
+        wakeup.notify_one();
+    }
+
+    template <class ... Args>
+    static auto make_works(std::size_t threads, Args ... args)
+        -> std::vector<std::unique_ptr<worker>>
+    {
+        if (threads == 0) {
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        std::vector<std::unique_ptr<worker>> works;
+        for (std::size_t i = 0; i < threads; ++i) {
+            works.emplace_back(new worker(args...));
+        }
+        return works;
+    }
+
+    static auto make_replies_addr(void const * pool) -> std::string {
+        std::stringstream addr;
+        addr << "inproc://pool-assistant-" << pool;
+        return addr.str();
+    }
+public:
+    /*! \brief Create a pool assistant that runs the `worker`.
+     *
+     * \param ctx 0MQ context the assistant will run in.
+     * \param broker_addr The address of the broker the assistant
+     * should connect to.
+     * \param worker_timeout Time in miliseconds between heartbeats
+     * sent to the broker. This should be less than the time after
+     * which the broker will consider a worker dead.
+     * \param threads The number of threads in the pool, which is
+     * also the number of requests the pool handles at once. If 0,
+     * one thread per core is used.
+     * \param args The arguments to be passed to the constructor of
+     * each worker.
+     */
+    template <class ... Args>
+    pool_assistant(zmq::context_t & ctx,
+                   std::string const & broker_addr,
+                   int worker_timeout,
+                   std::size_t threads,
+                   Args ... args)
+        : ctx(ctx),
+          works(make_works(threads, args...)),
+          service_name(works.front()->service_name),
+          heartbeat_interval(worker_timeout),
+          sock(ctx, socket_type),
+          beat(heartbeat_interval),
+          replies_addr(make_replies_addr(this)),
+          replies(ctx, zmq::socket_type::pull),
+          pending(0),
+          in_flight(0),
+          stopping(false),
+          draining(false),
+          logger(detail_assistant::shared_logger(service_name + " pool assistant"))
+    {
+        replies.bind(replies_addr);
+        for (std::size_t i = 0; i < works.size(); ++i) {
+            queues.emplace_back(new queue());
+        }
+        for (std::size_t i = 0; i < works.size(); ++i) {
+            this->threads.emplace_back([this, i](){ run_thread(i); });
+        }
+        sock.connect(broker_addr);
+
+        sock.send_multimsg(register_worker());
+    }
+
+    ~pool_assistant()
+    {
+        {
+            std::lock_guard<std::mutex> guard(idle_lock);
+            stopping = true;
+        }
+        wakeup.notify_all();
+        for (auto & thread : threads) {
+            thread.join();
+        }
+    }
+
+    pool_assistant(pool_assistant const &) = delete;
+    pool_assistant(pool_assistant &&) = delete;
+    auto operator=(pool_assistant const &) -> pool_assistant & = delete;
+    auto operator=(pool_assistant &&) -> pool_assistant & = delete;
+
+    /*! \brief Run the pool on a reactor.
+     *
+     * Requests arriving from the broker are passed to the threads of
+     * the pool, and their replies are sent to the broker once they
+     * are ready. Heartbeats are only sent while the pool is quiet,
+     * see [heartbeat](\ref heartbeat).
+     *
+     * Instead of calling this function directly, consider using
+     * [component](\ref component) to run the assistant.
+     */
+    auto attach(reactor & loop) -> void {
+        loop.add_socket(sock, [this](){ receive(); });
+        loop.add_socket(replies, [this](){ forward(); });
+        beat.attach(loop, [this](){
+                // Check if the broker is still alive
+                sock.send_multimsg(msg::send(msg::ping::make()));
+            });
+    }
+
+    /*! \brief Finish the requests the pool has already been given.
+     *
+     * Called by [component](\ref component) once its reactor has
+     * stopped. As with [assistant::drain](\ref assistant::drain),
+     * the pool withdraws from the broker by registering again with
+     * no concurrency, and keeps handling the requests that arrive
+     * until the broker confirms or a heartbeat interval passes. It
+     * then waits for its threads to finish every request they were
+     * given, and forwards their replies.
+     */
+    auto drain() -> void {
+        draining = true;
+        sock.send_multimsg(msg::send(msg::registration::make(service_names(*works.front()), 0)));
+        auto deadline = detail_time::time_now() + heartbeat_interval;
+        while (draining || in_flight > 0) {
+            auto timeout = heartbeat_interval.count();
+            if (draining) {
+                auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    deadline - detail_time::time_now()).count();
+                if (remaining <= 0) {
+                    logger->warn("Broker didn't confirm the withdrawal of {}", service_name);
+                    draining = false;
+                    continue;
+                }
+                timeout = std::min(timeout, remaining);
+            }
+            zmq::pollitem_t items[] = {
+                {static_cast<void *>(sock), 0, ZMQ_POLLIN, 0},
+                {static_cast<void *>(replies), 0, ZMQ_POLLIN, 0},
+            };
+            // Requests are only taken while the broker may still send
+            // them
+            zmq::poll(draining ? items : items + 1, draining ? 2 : 1, timeout);
+            if (draining && (items[0].revents & ZMQ_POLLIN)) {
+                receive();
+            }
+            if (items[1].revents & ZMQ_POLLIN) {
+                forward();
+            }
+        }
+    }
+
+    /*! \brief Handle all messages that are waiting on the socket. */
+    auto receive() -> void {
+        while (true) {
+            auto received = sock.recv_multimsg(ZMQ_DONTWAIT);
+            if (received.size() == 0) {
+                return;
+            }
+            auto message = msg::read(std::move(received));
+            handle(message);
+        }
+    }
+
+    /*! \brief Send all replies that the pool has completed. */
+    auto forward() -> void {
+        while (true) {
+            auto reply = replies.recv_multimsg(ZMQ_DONTWAIT);
+            if (reply.size() == 0) {
+                return;
+            }
+            --in_flight;
+            sock.send_multimsg(std::move(reply));
+            // The replies keep the pool alive while it is busy
+            beat.sent();
+        }
+    }
+
+    /*! \brief Process a registration message. */
+    auto operator()(msg::registration & msg) -> maybe_sendable {
+        if (draining) {
+            // Every request the broker sent before this has arrived
+            draining = false;
+            return boost::none;
+        }
+        logger->debug("Successfully registered for service {} with {} threads",
+                      service_name, msg.concurrency());
+        return boost::none;
+    }
+
+    /*! \brief Process a heartbeat message. */
+    auto operator()(msg::ping & msg) -> maybe_sendable {
+        return msg::send(msg::pong::make(std::move(msg)));
+    }
+
+    /*! \brief Process a heartbeat response. */
+    auto operator()(msg::pong &) -> maybe_sendable {
+        return boost::none;
+    }
+
+    /*! \brief Pass a work request to the pool.
+     *
+     * Shared memory parts are imported before the request is passed
+     * on, the rest of the decoding and encoding is done by the
+     * threads of the pool.
+     */
+    auto operator()(msg::request & msg) -> maybe_sendable {
+        try {
+            importer.import_parts(msg);
+        } catch (msg::exception::malformed & e) {
+            auto failed = msg::copy_without_data(msg);
+            return fail(std::move(failed), e);
+        }
+        dispatch(std::move(msg));
+        return boost::none;
+    }
+
+    /*! \brief Process a work reply. */
+    auto operator()(msg::reply &) -> maybe_sendable {
+        logger->warn("Recieved unexpected reply");
+        return boost::none;
+    }
+
+    /*! \brief Process a reconnect message. */
+    auto operator()(msg::reconnect &) -> maybe_sendable {
+        return register_worker();
+    }
+
+    /*! \brief Process a partial reply. */
+    auto operator()(msg::partial &) -> maybe_sendable {
+        logger->warn("Recieved unexpected partial reply");
+        return boost::none;
+    }
+
+    /*! \brief Process a credit message. */
+    auto operator()(msg::credit &) -> maybe_sendable {
+        return boost::none;
+    }
+};
@@ -0,0 +1,186 @@
+/*
+  Copyright 2017 Kaan Genç
+
+  This file is part of DagBox.
+
+  DagBox is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  DagBox is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with DagBox.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <cerrno>
+#include <algorithm>
+#include <unistd.h>
+#include <fcntl.h>
+#include "reactor.hpp"
+#include "exception.hpp"
+
+
+reactor::reactor()
+    : stopped(false)
+{
+    int fds[2];
+    if (pipe(fds) != 0) {
+        throw exception::fatal("Unable to create the wakeup pipe of a reactor");
+    }
+    wakeup_read = fds[0];
+    wakeup_write = fds[1];
+    fcntl(wakeup_read, F_SETFL, fcntl(wakeup_read, F_GETFL) | O_NONBLOCK);
+    fcntl(wakeup_write, F_SETFL, fcntl(wakeup_write, F_GETFL) | O_NONBLOCK);
+
+    items.push_back({nullptr, wakeup_read, ZMQ_POLLIN, 0});
+}
+
+
+reactor::~reactor()
+{
+    close(wakeup_read);
+    close(wakeup_write);
+}
+
+
+auto reactor::add_socket(zmq::socket_t & sock, handler on_readable) -> void
+{
+    items.push_back({static_cast<void *>(sock), 0, ZMQ_POLLIN, 0});
+    socket_handlers.push_back(std::move(on_readable));
+}
+
+
+auto reactor::add_fd(int fd, handler on_readable) -> void
+{
+    items.push_back({nullptr, fd, ZMQ_POLLIN, 0});
+    socket_handlers.push_back(std::move(on_readable));
+}
+
+
+auto reactor::add_timer(std::chrono::milliseconds interval, handler on_expire)
+    -> timer_id
+{
+    timers.push_back({
+        interval,
+        std::chrono::steady_clock::now() + interval,
+        std::move(on_expire),
+        true,
+    });
+    return timers.size() - 1;
+}
+
+
+auto reactor::reset_timer(timer_id id) -> void
+{
+    auto & t = timers[id];
+    t.next = std::chrono::steady_clock::now() + t.interval;
+    t.active = true;
+}
+
+
+auto reactor::reset_timer(timer_id id, std::chrono::milliseconds delay) -> void
+{
+    auto & t = timers[id];
+    t.next = std::chrono::steady_clock::now() + delay;
+    t.active = true;
+}
+
+
+auto reactor::cancel_timer(timer_id id) -> void
+{
+    timers[id].active = false;
+}
+
+
+auto reactor::run() -> void
+{
+    while (!stopped.load()) {
+        run_once(std::chrono::milliseconds{-1});
+    }
+}
+
+
+auto reactor::run_once(std::chrono::milliseconds max_wait) -> void
+{
+    auto timeout = next_timeout();
+    if (timeout < 0 || (max_wait.count() >= 0 && max_wait.count() < timeout)) {
+        timeout = max_wait.count();
+    }
+
+    try {
+        zmq::poll(items.data(), items.size(), timeout);
+    } catch (zmq::error_t & e) {
+        if (e.num() != EINTR) {
+            throw;
+        }
+        return;
+    }
+
+    if (items[0].revents & ZMQ_POLLIN) {
+        drain_wakeup();
+    }
+    // The handlers may add more sockets, which won't have any events
+    // to handle yet
+    auto count = items.size();
+    for (std::size_t i = 1; i < count && !stopped.load(); ++i) {
+        if (items[i].revents & ZMQ_POLLIN) {
+            socket_handlers[i - 1]();
+        }
+    }
+    run_timers();
+}
+
+
+auto reactor::stop() -> void
+{
+    stopped.store(true);
+    char const signal = 0;
+    // If the pipe is full, the reactor is going to wake up anyway
+    auto written = write(wakeup_write, &signal, sizeof(signal));
+    (void) written;
+}
+
+
+auto reactor::next_timeout() const -> long
+{
+    long timeout = -1;
+    auto now = std::chrono::steady_clock::now();
+    for (auto const & t : timers) {
+        if (!t.active) {
+            continue;
+        }
+        auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+            t.next - now).count();
+        remaining = std::max<long>(remaining, 0);
+        if (timeout < 0 || remaining < timeout) {
+            timeout = remaining;
+        }
+    }
+    return timeout;
+}
+
+
+auto reactor::run_timers() -> void
+{
+    auto now = std::chrono::steady_clock::now();
+    auto count = timers.size();
+    for (std::size_t i = 0; i < count && !stopped.load(); ++i) {
+        auto & t = timers[i];
+        if (t.active && t.next <= now) {
+            t.next = now + t.interval;
+            t.on_expire();
+        }
+    }
+}
+
+
+auto reactor::drain_wakeup() -> void
+{
+    char buffer[64];
+    while (read(wakeup_read, buffer, sizeof(buffer)) > 0) {
+    }
+}
@@ -0,0 +1,154 @@
+/*
+  Copyright 2017 Kaan Genç
+
+  This file is part of DagBox.
+
+  DagBox is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  DagBox is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with DagBox.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <deque>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <zmq.hpp>
+
+
+/*! \file reactor.hpp
+ * An event loop that waits on sockets and timers.
+ */
+
+
+
+/*! \brief An event loop that waits on sockets and timers.
+ *
+ * The reactor waits on any number of 0MQ sockets with `zmq_poll`, and
+ * calls the handler of a socket whenever there are messages waiting
+ * on it. Timers are run on the same thread, between socket events.
+ *
+ * Components such as the [broker](\ref broker) and the
+ * [assistant](\ref assistant) attach themselves to a reactor. Several
+ * components may be attached to the same reactor, in which case they
+ * will all run on the thread that runs the reactor.
+ *
+ * ```
+ * reactor loop;
+ * broker b(ctx, "inproc://broker", std::chrono::milliseconds{1000});
+ * assistant<data::reader> r(ctx, "inproc://broker", 500, store);
+ * b.attach(loop);
+ * r.attach(loop);
+ * loop.run(); // Returns once loop.stop() is called
+ * ```
+ *
+ * Except for [stop](\ref reactor::stop), the methods of the reactor
+ * must only be called from the thread that runs it.
+ */
+class reactor
+{
+public:
+    /*! \brief A function that is called when an event happens. */
+    typedef std::function<void()> handler;
+    /*! \brief Identifies a timer that was added to the reactor. */
+    typedef std::size_t timer_id;
+
+private:
+    struct timer
+    {
+        std::chrono::milliseconds interval;
+        std::chrono::steady_clock::time_point next;
+        handler on_expire;
+        bool active;
+    };
+
+    // Handlers are kept in deques, so that adding new ones from
+    // within a handler doesn't move the handler that is running
+    std::vector<zmq::pollitem_t> items;
+    std::deque<handler> socket_handlers;
+    std::deque<timer> timers;
+
+    int wakeup_read;
+    int wakeup_write;
+    std::atomic_bool stopped;
+
+    auto next_timeout() const -> long;
+    auto run_timers() -> void;
+    auto drain_wakeup() -> void;
+public:
+    /*! \brief Create a reactor. */
+    reactor();
+    ~reactor();
+
+    reactor(reactor const &) = delete;
+    reactor(reactor &&) = delete;
+    auto operator=(reactor const &) -> reactor & = delete;
+    auto operator=(reactor &&) -> reactor & = delete;
+
+    /*! \brief Call `on_readable` whenever `sock` has messages waiting.
+     *
+     * The handler should receive all messages that are waiting
+     * without blocking, for example with `ZMQ_DONTWAIT`.
+     */
+    auto add_socket(zmq::socket_t & sock, handler on_readable) -> void;
+
+    /*! \brief Call `on_readable` whenever the file descriptor `fd`
+     *  can be read from.
+     *
+     * The handler should read everything that is waiting, otherwise
+     * it will be called again right away.
+     */
+    auto add_fd(int fd, handler on_readable) -> void;
+
+    /*! \brief Call `on_expire` repeatedly, every `interval`.
+     *
+     * \returns An id that can be used to reset or cancel the timer.
+     */
+    auto add_timer(std::chrono::milliseconds interval, handler on_expire)
+        -> timer_id;
+
+    /*! \brief Restart the interval of a timer from now.
+     *
+     * A timer that was cancelled is started again.
+     */
+    auto reset_timer(timer_id id) -> void;
+
+    /*! \brief Expire a timer once after `delay` from now, then every
+     *  interval as before.
+     *
+     * A timer that was cancelled is started again.
+     */
+    auto reset_timer(timer_id id, std::chrono::milliseconds delay) -> void;
+
+    /*! \brief Stop a timer, its handler will not be called again
+     *  unless the timer is reset.
+     */
+    auto cancel_timer(timer_id id) -> void;
+
+    /*! \brief Wait for events and handle them, until stopped. */
+    auto run() -> void;
+
+    /*! \brief Wait for events once, and handle them.
+     *
+     * \param max_wait The longest time to wait if there are no events
+     * and no timers expiring.
+     */
+    auto run_once(std::chrono::milliseconds max_wait) -> void;
+
+    /*! \brief Stop the reactor.
+     *
+     * May be called from any thread. If the reactor is waiting for
+     * events, it is woken up immediately.
+     */
+    auto stop() -> void;
+};
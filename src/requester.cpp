@@ -0,0 +1,88 @@
+/*
+  Copyright 2017 Kaan Genç
+
+  This file is part of DagBox.
+
+  DagBox is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  DagBox is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with DagBox.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <vector>
+#include "requester.hpp"
+
+
+requester::requester(request_sender send_request, reply_sender send_reply,
+                     std::chrono::milliseconds timeout)
+    : send_request(std::move(send_request)),
+      send_reply(std::move(send_reply)),
+      timeout(timeout)
+{}
+
+
+auto requester::send(msg::request && request, continuation then) -> void
+{
+    auto id = next_id++;
+    msg::set_request_id(request.metadata(), id);
+    waiting.emplace(id, waiter{
+            std::move(then),
+            msg::copy_without_data(request),
+            std::chrono::steady_clock::now() + timeout,
+        });
+    send_request(msg::send(std::move(request)));
+}
+
+
+auto requester::reply(msg::reply && reply) -> void
+{
+    send_reply(std::move(reply));
+}
+
+
+auto requester::resolve(msg::reply && reply) -> bool
+{
+    auto id = msg::find_request_id(reply.metadata());
+    if (!id) {
+        return false;
+    }
+    auto found = waiting.find(*id);
+    if (found == waiting.end()) {
+        return false;
+    }
+    // The continuation may send more requests, which would
+    // invalidate the iterator
+    auto then = std::move(found->second.then);
+    waiting.erase(found);
+    then(std::move(reply));
+    return true;
+}
+
+
+auto requester::expire() -> void
+{
+    auto now = std::chrono::steady_clock::now();
+    // The continuations may send more requests, so they are only
+    // called once the waiting requests are no longer being iterated
+    std::vector<waiter> expired;
+    auto iter = waiting.begin();
+    while (iter != waiting.end()) {
+        if (iter->second.deadline <= now) {
+            expired.push_back(std::move(iter->second));
+            iter = waiting.erase(iter);
+        } else {
+            ++iter;
+        }
+    }
+    for (auto & request : expired) {
+        request.then(msg::make_error_reply(std::move(request.expired),
+                                           "No reply arrived for the request"));
+    }
+}
@@ -0,0 +1,218 @@
+/*
+  Copyright 2017 Kaan Genç
+
+  This file is part of DagBox.
+
+  DagBox is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  DagBox is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with DagBox.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <boost/optional.hpp>
+#include "message.hpp"
+
+#ifdef DAGBOX_COROUTINES
+#include <coroutine>
+#include <exception>
+#endif
+
+
+/*! \file requester.hpp
+ * Sending requests to other services from inside a worker.
+ */
+
+
+/*! \brief Sends requests to other services on behalf of a worker.
+ *
+ * Workers that accept a `requester &` as a second argument of their
+ * `operator()` may pass parts of their work on to other services, and
+ * continue once the replies arrive. Such workers don't return their
+ * reply, but send it through the requester once it is ready. In the
+ * meantime, the [assistant](\ref assistant) keeps handling other
+ * requests, and registers such workers with a concurrency of
+ * `max_batch`, so that the broker keeps sending them work.
+ *
+ * ```
+ * auto operator()(msg::request && request, requester & req) -> void {
+ *     auto original = std::make_shared<msg::request>(std::move(request));
+ *     req.send(msg::request::make("datastore reader", {}, lookup()),
+ *              [original, &req](msg::reply && found) {
+ *                  original->data() = std::move(found.data());
+ *                  req.reply(msg::reply::make(std::move(*original)));
+ *              });
+ * }
+ * ```
+ *
+ * Replies are matched to their requests with a
+ * [request ID](\ref msg::request_id_prefix) in the metadata. The
+ * continuations run on the thread of the assistant. Requests that
+ * aren't replied to within the timeout are
+ * [expired](\ref requester::expire), and their continuations get an
+ * [error reply](\ref msg::make_error_reply) instead.
+ *
+ * When built with `DAGBOX_COROUTINES`, workers may instead be
+ * coroutines returning [task](\ref requester::task), and wait for
+ * replies with `co_await req.async(request)`.
+ */
+class requester
+{
+public:
+    /*! \brief Called with the reply to a request. */
+    typedef std::function<void(msg::reply &&)> continuation;
+    /*! \brief Sends a message to the broker. */
+    typedef std::function<void(msg::part_source &&)> request_sender;
+    /*! \brief Sends the reply to a request the worker has finished. */
+    typedef std::function<void(msg::reply &&)> reply_sender;
+
+private:
+    // A request that hasn't been replied to yet
+    struct waiter
+    {
+        continuation then;
+        // Answered with an error if the request expires
+        msg::request expired;
+        std::chrono::steady_clock::time_point deadline;
+    };
+
+    request_sender send_request;
+    reply_sender send_reply;
+    std::chrono::milliseconds const timeout;
+    uint64_t next_id = 1;
+    std::unordered_map<uint64_t, waiter> waiting;
+
+public:
+    /*! \brief Create a requester.
+     *
+     * \param send_request Used to send the requests made by the
+     * worker.
+     * \param send_reply Used to send the replies of the worker,
+     * which may encode them before sending.
+     * \param timeout How long to wait for the reply to a request
+     * before it expires.
+     */
+    requester(request_sender send_request, reply_sender send_reply,
+              std::chrono::milliseconds timeout = std::chrono::milliseconds{10000});
+
+    requester(requester const &) = delete;
+    auto operator=(requester const &) -> requester & = delete;
+
+    /*! \brief Send a request to another service.
+     *
+     * \param request The request. A request ID is added to its
+     * metadata, replacing any ID it already carries.
+     * \param then Called with the reply once it arrives.
+     */
+    auto send(msg::request && request, continuation then) -> void;
+
+    /*! \brief Send the reply to a request the worker was given. */
+    auto reply(msg::reply && reply) -> void;
+
+    /*! \brief Pass a reply to the request it answers.
+     *
+     * \returns False if the reply doesn't answer any request sent
+     * through this requester.
+     */
+    auto resolve(msg::reply && reply) -> bool;
+
+    /*! \brief Give up on the requests whose timeout has passed.
+     *
+     * Their continuations are called with an error reply, see
+     * msg::is_error. A reply that arrives later is ignored.
+     */
+    auto expire() -> void;
+
+    /*! \brief The number of requests that haven't been replied to. */
+    auto pending() const noexcept -> std::size_t { return waiting.size(); }
+
+#ifdef DAGBOX_COROUTINES
+    /*! \brief The return type of workers that are coroutines.
+     *
+     * The coroutine starts running as soon as it is called. If it
+     * throws, the request it was given is replied to with an error
+     * through the requester, as the assistant does for other
+     * workers. By then the coroutine may have been resumed by a
+     * reply, so the exception can't be left to the assistant.
+     */
+    struct task
+    {
+        struct promise_type
+        {
+            // Only set for coroutines that are workers
+            boost::optional<msg::request> failed;
+            requester * req = nullptr;
+
+            promise_type() = default;
+
+            template <class worker>
+            promise_type(worker &, msg::request & request, requester & req)
+                : failed(msg::copy_without_data(request)), req(&req) {}
+
+            auto get_return_object() noexcept -> task { return {}; }
+            auto initial_suspend() noexcept -> std::suspend_never { return {}; }
+            auto final_suspend() noexcept -> std::suspend_never { return {}; }
+            auto return_void() noexcept -> void {}
+            auto unhandled_exception() -> void {
+                if (req == nullptr) {
+                    throw;
+                }
+                std::string what = "The worker failed with an unknown error";
+                try {
+                    throw;
+                } catch (std::exception & e) {
+                    what = e.what();
+                } catch (...) {}
+                req->reply(msg::make_error_reply(std::move(*failed), what));
+            }
+        };
+    };
+
+    /*! \brief Waits for the reply to a request. */
+    class awaitable
+    {
+        requester & req;
+        msg::request request;
+        boost::optional<msg::reply> result;
+    public:
+        awaitable(requester & req, msg::request && request)
+            : req(req), request(std::move(request)) {}
+
+        auto await_ready() const noexcept -> bool { return false; }
+        auto await_suspend(std::coroutine_handle<> waiter) -> void {
+            req.send(std::move(request), [this, waiter](msg::reply && reply) {
+                    result = std::move(reply);
+                    waiter.resume();
+                });
+        }
+        auto await_resume() -> msg::reply { return std::move(*result); }
+    };
+
+    /*! \brief Send a request to another service, and wait for its reply.
+     *
+     * ```
+     * auto operator()(msg::request && request, requester & req)
+     *     -> requester::task {
+     *     auto found = co_await req.async(msg::request::make("datastore reader", {}, lookup()));
+     *     request.data() = std::move(found.data());
+     *     req.reply(msg::reply::make(std::move(request)));
+     * }
+     * ```
+     */
+    auto async(msg::request && request) -> awaitable {
+        return awaitable(*this, std::move(request));
+    }
+#endif
+};
@@ -0,0 +1,169 @@
+/*
+  Copyright 2017 Kaan Genç
+
+  This file is part of DagBox.
+
+  DagBox is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  DagBox is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with DagBox.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+#include "exception.hpp"
+#include "message.hpp"
+
+
+/*! \file services.hpp
+ * Workers that provide several services.
+ */
+
+
+namespace detail_services
+{
+    // Workers providing several services list them in
+    // `service_names`, others only have a `service_name`
+    template <class worker>
+    auto service_names(worker const & work, int)
+        -> decltype(std::vector<std::string>(work.service_names))
+    {
+        return work.service_names;
+    }
+
+    template <class worker>
+    auto service_names(worker const & work, long)
+        -> std::vector<std::string>
+    {
+        return {work.service_name};
+    }
+
+    template <class ... Workers>
+    struct type_list {};
+
+    // Workers are given the arguments if they accept them, and are
+    // default constructed otherwise
+    template <class worker, class ... Args>
+    auto create(std::true_type, Args & ... args) -> worker *
+    {
+        return new worker(args...);
+    }
+
+    template <class worker, class ... Args>
+    auto create(std::false_type, Args & ...) -> worker *
+    {
+        return new worker();
+    }
+}
+
+
+/*! \brief Get the names of the services a worker provides.
+ *
+ * These are the names in `service_names` if the worker has them, or
+ * its `service_name` otherwise.
+ */
+template <class worker>
+auto service_names(worker const & work) -> std::vector<std::string>
+{
+    return detail_services::service_names(work, 0);
+}
+
+
+/*! \brief A worker that provides the services of several workers.
+ *
+ * Running several small services on a single
+ * [assistant](\ref assistant) only needs one socket, one heartbeat
+ * and one registration with the broker, which registers all of the
+ * services at once. Each request is passed to the worker that
+ * provides its service.
+ *
+ * ```
+ * assistant<multi_service<data::reader, lock::lock>> shared(ctx, addr, 500, std::ref(store));
+ * ```
+ *
+ * The arguments of the constructor are passed to the workers that
+ * can be constructed with them, and the other workers are default
+ * constructed. Only workers that take just the request and return
+ * their reply are supported.
+ */
+template <class ... Workers>
+class multi_service
+{
+    typedef std::function<std::vector<zmq::message_t>(msg::request &&)> handler;
+    std::unordered_map<std::string, handler> handlers;
+
+    template <class ... Args>
+    auto add(detail_services::type_list<>, Args & ...) -> void {}
+
+    template <class First, class ... Rest, class ... Args>
+    auto add(detail_services::type_list<First, Rest...>, Args & ... args) -> void
+    {
+        std::shared_ptr<First> work(detail_services::create<First>(
+                                        std::is_constructible<First, Args &...>(),
+                                        args...));
+        for (auto & name : ::service_names(*work)) {
+            handlers[name] = [work](msg::request && request) {
+                return (*work)(std::move(request));
+            };
+            service_names.push_back(name);
+        }
+        add(detail_services::type_list<Rest...>(), args...);
+    }
+
+    static auto join(std::vector<std::string> const & names) -> std::string
+    {
+        std::string joined;
+        for (auto & name : names) {
+            if (!joined.empty()) {
+                joined += ", ";
+            }
+            joined += name;
+        }
+        return joined;
+    }
+public:
+    /*! \brief The names of all services, in the order of the workers. */
+    std::vector<std::string> service_names;
+    /*! \brief The names of all services, for logging. */
+    std::string const service_name;
+
+    /*! \brief Create the workers.
+     *
+     * \param args The arguments to be passed to the constructors of
+     * the workers that accept them.
+     */
+    template <class ... Args>
+    multi_service(Args ... args)
+        // The workers are added first, since the name is made of
+        // their services
+        : service_name((add(detail_services::type_list<Workers...>(), args...),
+                        join(service_names)))
+    {}
+
+    /*! \brief Pass a request to the worker that provides its service.
+     *
+     * \throws exception::fatal No worker provides the service, which
+     * only happens if the broker misroutes the request.
+     */
+    auto operator()(msg::request && request) -> std::vector<zmq::message_t>
+    {
+        auto found = handlers.find(request.service());
+        if (found == handlers.end()) {
+            throw exception::fatal("No worker for service " + request.service());
+        }
+        return found->second(std::move(request));
+    }
+};
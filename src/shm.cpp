@@ -0,0 +1,419 @@
+/*
+  Copyright 2017 Kaan Genç
+
+  This file is part of DagBox.
+
+  DagBox is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  DagBox is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with DagBox.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <cstring>
+#include <algorithm>
+#include <random>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "shm.hpp"
+using namespace shm;
+using namespace detail;
+
+
+namespace
+{
+    // Reads "DGBXSHM1" in memory on little-endian machines
+    uint64_t const region_magic = 0x314d485358424744;
+
+    // Keeps the ring mapped while a part points into it, and releases
+    // the slots of the part once 0MQ is done with it
+    struct slot_lease
+    {
+        std::shared_ptr<mapping> map;
+        uint32_t first_slot;
+        uint32_t slot_count;
+    };
+
+    auto release_lease(void *, void * hint) -> void
+    {
+        auto lease = static_cast<slot_lease *>(hint);
+        lease->map->release(lease->first_slot, lease->slot_count);
+        delete lease;
+    }
+
+    auto leased_part(std::shared_ptr<mapping> const & map,
+                     std::size_t offset,
+                     std::size_t size,
+                     uint32_t first_slot,
+                     uint32_t slot_count)
+        -> msg::part
+    {
+        auto lease = new slot_lease{map, first_slot, slot_count};
+        return msg::part(map->data() + offset, size, release_lease, lease);
+    }
+
+    auto slots_needed(std::size_t size, std::size_t slot_size) -> uint32_t
+    {
+        return static_cast<uint32_t>((size + slot_size - 1) / slot_size);
+    }
+
+    struct exporter
+    {
+        ring & r;
+        std::size_t threshold;
+
+        template <class message>
+        auto operator()(message & m) const -> void {
+            r.export_parts(m, threshold);
+        }
+    };
+}
+
+
+//////////////////// Mapping
+
+mapping::mapping(int fd, std::size_t size)
+    : size_(size)
+{
+    auto addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        throw ::exception::fatal("Unable to map shared memory");
+    }
+    base = static_cast<char *>(addr);
+}
+
+
+mapping::~mapping()
+{
+    munmap(base, size_);
+}
+
+
+auto mapping::header() const noexcept -> region_header *
+{
+    return reinterpret_cast<region_header *>(base);
+}
+
+
+auto mapping::refs() const noexcept -> std::atomic<uint32_t> *
+{
+    return reinterpret_cast<std::atomic<uint32_t> *>(base + sizeof(region_header));
+}
+
+
+auto mapping::data() const noexcept -> char *
+{
+    return base + header()->data_offset;
+}
+
+
+auto mapping::release(uint32_t first_slot, uint32_t slot_count) -> void
+{
+    auto counts = refs();
+    for (uint32_t i = first_slot; i < first_slot + slot_count; ++i) {
+        counts[i].fetch_sub(1, std::memory_order_release);
+    }
+}
+
+
+auto detail::has_flag(msg::many_parts const & metadata) -> bool
+{
+    for (auto const & p : metadata) {
+        if (p.size() == flag.size()
+            && std::memcmp(p.data(), flag.data(), flag.size()) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+//////////////////// Ring
+
+// The reference counts are shared between processes, which is only
+// safe if they don't rely on a lock
+static_assert(ATOMIC_INT_LOCK_FREE == 2,
+              "Shared memory needs lock-free atomic integers");
+
+
+ring::ring(std::size_t capacity, std::size_t slot_size)
+{
+#ifdef __linux__
+    fd = memfd_create("dagbox-shm", MFD_CLOEXEC);
+#else
+    fd = -1;
+#endif
+    if (fd < 0) {
+        throw ::exception::fatal("Unable to create shared memory");
+    }
+
+    auto slot_count = slots_needed(capacity, slot_size);
+    auto counts_end = sizeof(region_header)
+        + slot_count * sizeof(std::atomic<uint32_t>);
+    // Keep the data area aligned to a cache line
+    auto data_offset = (counts_end + 63) / 64 * 64;
+    auto total_size = data_offset + slot_count * slot_size;
+    if (ftruncate(fd, static_cast<off_t>(total_size)) != 0) {
+        close(fd);
+        throw ::exception::fatal("Unable to resize shared memory");
+    }
+    map = std::make_shared<mapping>(fd, total_size);
+
+    std::random_device random;
+    auto header = map->header();
+    header->magic = region_magic;
+    header->region_id = (static_cast<uint64_t>(random()) << 32) | random();
+    header->slot_size = slot_size;
+    header->slot_count = slot_count;
+    header->data_offset = data_offset;
+    auto counts = map->refs();
+    for (uint32_t i = 0; i < slot_count; ++i) {
+        new (&counts[i]) std::atomic<uint32_t>(0);
+    }
+}
+
+
+ring::~ring()
+{
+    // Parts that are still alive keep the memory mapped
+    close(fd);
+}
+
+
+auto ring::reserve(uint32_t slot_count) -> boost::optional<uint32_t>
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    auto total = map->header()->slot_count;
+    if (slot_count == 0 || slot_count > total) {
+        return boost::none;
+    }
+    auto counts = map->refs();
+    for (uint32_t tried = 0; tried < total; ++tried) {
+        auto first = (next_slot + tried) % total;
+        if (first + slot_count > total) {
+            continue;
+        }
+        bool available = true;
+        for (uint32_t i = first; i < first + slot_count; ++i) {
+            if (counts[i].load(std::memory_order_acquire) != 0) {
+                available = false;
+                break;
+            }
+        }
+        if (available) {
+            // Only the owner of the ring takes references from free
+            // slots, so nobody else can race us here
+            for (uint32_t i = first; i < first + slot_count; ++i) {
+                counts[i].store(1, std::memory_order_relaxed);
+            }
+            next_slot = (first + slot_count) % total;
+            return first;
+        }
+    }
+    return boost::none;
+}
+
+
+auto ring::allocate(std::size_t size) -> boost::optional<msg::part>
+{
+    auto slot_size = map->header()->slot_size;
+    auto slot_count = slots_needed(std::max<std::size_t>(size, 1), slot_size);
+    auto first = reserve(slot_count);
+    if (!first) {
+        return boost::none;
+    }
+    return leased_part(map, *first * slot_size, size, *first, slot_count);
+}
+
+
+auto ring::free_slots() const -> std::size_t
+{
+    auto total = map->header()->slot_count;
+    auto counts = map->refs();
+    std::size_t available = 0;
+    for (uint32_t i = 0; i < total; ++i) {
+        if (counts[i].load(std::memory_order_acquire) == 0) {
+            ++available;
+        }
+    }
+    return available;
+}
+
+
+auto ring::export_part(msg::part & p, std::size_t threshold) -> void
+{
+    auto header = map->header();
+    auto slot_size = header->slot_size;
+    auto data = map->data();
+    auto source = p.data<char>();
+
+    if (p.size() > 0 && p.size() >= threshold) {
+        descriptor desc;
+        desc.region_id = header->region_id;
+        desc.pid = static_cast<uint32_t>(getpid());
+        desc.fd = fd;
+        desc.size = p.size();
+
+        bool exported = false;
+        if (source >= data && source < data + header->slot_count * slot_size) {
+            // The part was allocated in the ring, the receiver only
+            // needs another reference to its slots
+            desc.offset = source - data;
+            desc.first_slot = desc.offset / slot_size;
+            desc.slot_count = (desc.offset + desc.size - 1) / slot_size
+                - desc.first_slot + 1;
+            auto counts = map->refs();
+            for (uint32_t i = desc.first_slot;
+                 i < desc.first_slot + desc.slot_count;
+                 ++i) {
+                counts[i].fetch_add(1, std::memory_order_relaxed);
+            }
+            exported = true;
+        } else {
+            desc.slot_count = slots_needed(p.size(), slot_size);
+            auto first = reserve(desc.slot_count);
+            if (first) {
+                // The reference taken by reserve is handed over to
+                // the receiver
+                desc.first_slot = *first;
+                desc.offset = *first * slot_size;
+                std::memcpy(data + desc.offset, source, p.size());
+                exported = true;
+            }
+        }
+
+        if (exported) {
+            msg::part desc_part(1 + sizeof(desc));
+            auto dest = desc_part.data<char>();
+            dest[0] = static_cast<char>(kind::descriptor);
+            std::memcpy(dest + 1, &desc, sizeof(desc));
+            p = std::move(desc_part);
+            return;
+        }
+        // The ring is full, send the part inline instead
+    }
+
+    msg::part inlined(p.size() + 1);
+    auto dest = inlined.data<char>();
+    dest[0] = static_cast<char>(kind::inline_part);
+    std::memcpy(dest + 1, source, p.size());
+    p = std::move(inlined);
+}
+
+
+auto ring::export_sendable(msg::part_source && parts, std::size_t threshold)
+    -> msg::part_source
+{
+    return msg::modify_payload(std::move(parts), exporter{*this, threshold});
+}
+
+
+//////////////////// Importer
+
+auto importer::get_mapping(descriptor const & desc)
+    -> std::shared_ptr<mapping>
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    auto key = std::make_pair(desc.pid, desc.fd);
+    auto found = mappings.find(key);
+    if (found != mappings.end()
+        && found->second->header()->region_id == desc.region_id) {
+        return found->second;
+    }
+
+    // The ring can be reopened through the file descriptor table of
+    // the process that owns it
+    auto path = "/proc/" + std::to_string(desc.pid)
+        + "/fd/" + std::to_string(desc.fd);
+    auto fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        throw msg::exception::malformed("Unable to open shared memory of "
+                                        "the sender");
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0
+        || static_cast<std::size_t>(info.st_size) < sizeof(region_header)) {
+        close(fd);
+        throw msg::exception::malformed("Shared memory of the sender "
+                                        "is invalid");
+    }
+    std::shared_ptr<mapping> map;
+    try {
+        map = std::make_shared<mapping>(fd, info.st_size);
+    } catch (...) {
+        close(fd);
+        throw;
+    }
+    close(fd);
+
+    if (map->header()->magic != region_magic
+        || map->header()->region_id != desc.region_id) {
+        throw msg::exception::malformed("Shared memory of the sender "
+                                        "doesn't match the descriptor");
+    }
+    mappings[key] = map;
+    return map;
+}
+
+
+auto importer::import_part(msg::part & p) -> void
+{
+    using msg::exception::malformed;
+
+    if (p.size() < 1) {
+        throw malformed("Shared data part is missing its kind");
+    }
+    auto source = p.data<char>();
+    switch (static_cast<kind>(source[0])) {
+    case kind::inline_part: {
+        msg::part plain(source + 1, p.size() - 1);
+        p = std::move(plain);
+        return;
+    }
+    case kind::descriptor: {
+        if (p.size() != 1 + sizeof(descriptor)) {
+            throw malformed("Shared memory descriptor is malformed");
+        }
+        descriptor desc;
+        std::memcpy(&desc, source + 1, sizeof(desc));
+        auto map = get_mapping(desc);
+
+        // The header is written by the sender just like the
+        // descriptor, so only the size that was actually mapped is
+        // trusted. The checks are ordered so that none of them can
+        // overflow.
+        auto header = map->header();
+        auto mapped = static_cast<uint64_t>(map->size());
+        auto slot_size = header->slot_size;
+        auto slots_end = static_cast<uint64_t>(desc.first_slot)
+            + desc.slot_count;
+        if (slots_end > header->slot_count
+            || slots_end > (mapped - sizeof(region_header)) / sizeof(std::atomic<uint32_t>)
+            || header->data_offset > mapped
+            || desc.offset > mapped - header->data_offset
+            || desc.size > mapped - header->data_offset - desc.offset
+            || slot_size == 0
+            || desc.offset / slot_size < desc.first_slot
+            || (desc.offset + desc.size) / slot_size
+               + ((desc.offset + desc.size) % slot_size != 0) > slots_end) {
+            throw malformed("Shared memory descriptor is out of bounds");
+        }
+        // The sender took a reference for us, which is released once
+        // the part is destroyed
+        p = leased_part(map, desc.offset, desc.size,
+                        desc.first_slot, desc.slot_count);
+        return;
+    }
+    }
+    throw malformed("Shared data part is of an unknown kind");
+}
@@ -0,0 +1,263 @@
+/*
+  Copyright 2017 Kaan Genç
+
+  This file is part of DagBox.
+
+  DagBox is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  DagBox is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with DagBox.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <memory>
+#include <atomic>
+#include <string>
+#include <cstdint>
+#include <boost/optional.hpp>
+#include "message.hpp"
+
+
+/*! \file shm.hpp
+ * Shared memory transport for large data parts.
+ */
+
+
+
+/*! \brief Shared memory transport for large data parts.
+ *
+ * When all components run on the same host, large data parts can be
+ * passed through shared memory instead of being copied through the
+ * sockets. The sender keeps a [ring](\ref shm::ring) of shared
+ * memory, backed by a memfd. Large data parts are placed in the ring,
+ * and the message only carries a small descriptor in their place. The
+ * receiver maps the ring with an [importer](\ref shm::importer) and
+ * gets the data parts back without copying them. Once the receiver
+ * is done with a part, the slots it used in the ring are released.
+ *
+ * Like [compression](\ref compression), this is negotiated with a
+ * metadata flag. The assistant will import the parts of a flagged
+ * request, and export the parts of its reply through its own ring.
+ * The broker only forwards the descriptors, it never maps the rings.
+ *
+ * ```
+ * shm::ring ring;
+ * shm::importer importer;
+ *
+ * auto req = msg::request::make("datastore writer", {}, std::move(data));
+ * ring.export_parts(req);
+ * sock.send_multimsg(msg::send(std::move(req)));
+ *
+ * auto received = msg::read(sock.recv_multimsg());
+ * auto & rep = boost::get<msg::reply>(received);
+ * importer.import_parts(rep);
+ * ```
+ *
+ * The receiver opens the ring through `/proc`, so this only works on
+ * Linux, between processes of the same user. If a message carrying a
+ * descriptor is lost, the slots it points to are not released until
+ * the ring is destroyed.
+ */
+namespace shm
+{
+    /*! \brief The metadata part that marks a message as using shared memory. */
+    std::string const flag = "DGBX:shm";
+
+    /*! \brief Data parts smaller than this many bytes are sent inline. */
+    std::size_t const default_threshold = 256 * 1024;
+
+    /*! \brief Default size of the data area of a ring, in bytes. */
+    std::size_t const default_capacity = 64 * 1024 * 1024;
+
+    /*! \brief Default size of a slot in a ring, in bytes. */
+    std::size_t const default_slot_size = 64 * 1024;
+
+    namespace detail
+    {
+        enum class kind : uint8_t
+        {
+            inline_part = 0x00,
+            descriptor = 0x01,
+        };
+
+        // Sent in place of a data part that was placed in a ring
+        struct descriptor
+        {
+            uint64_t region_id;
+            uint32_t pid;
+            int32_t fd;
+            uint64_t offset;
+            uint64_t size;
+            uint32_t first_slot;
+            uint32_t slot_count;
+        };
+
+        // Placed at the start of the shared memory, followed by the
+        // reference counts of the slots and then the slots themselves
+        struct region_header
+        {
+            uint64_t magic;
+            uint64_t region_id;
+            uint64_t slot_size;
+            uint32_t slot_count;
+            uint64_t data_offset;
+        };
+
+        class mapping
+        {
+            char * base;
+            std::size_t size_;
+        public:
+            mapping(int fd, std::size_t size);
+            ~mapping();
+
+            mapping(mapping const &) = delete;
+            mapping(mapping &&) = delete;
+            auto operator=(mapping const &) -> mapping & = delete;
+            auto operator=(mapping &&) -> mapping & = delete;
+
+            auto size() const noexcept -> std::size_t { return size_; }
+            auto header() const noexcept -> region_header *;
+            auto refs() const noexcept -> std::atomic<uint32_t> *;
+            auto data() const noexcept -> char *;
+
+            auto release(uint32_t first_slot, uint32_t slot_count) -> void;
+        };
+
+        auto has_flag(msg::many_parts const & metadata) -> bool;
+    };
+
+
+    /*! \brief A ring of shared memory that data parts can be placed in.
+     *
+     * The ring is split into fixed size slots. A data part occupies
+     * as many consecutive slots as it needs, and each slot keeps a
+     * count of the parts referring to it, across all processes.
+     */
+    class ring
+    {
+        int fd;
+        std::shared_ptr<detail::mapping> map;
+        std::mutex lock;
+        uint32_t next_slot = 0;
+
+        auto reserve(uint32_t slot_count) -> boost::optional<uint32_t>;
+        auto export_part(msg::part & p, std::size_t threshold) -> void;
+    public:
+        /*! \brief Create a ring.
+         *
+         * \param capacity The size of the data area of the ring in
+         * bytes. It is rounded up to a multiple of the slot size.
+         * \param slot_size The size of each slot in bytes.
+         *
+         * \throws exception::fatal The shared memory could not be
+         * created.
+         */
+        ring(std::size_t capacity = default_capacity,
+             std::size_t slot_size = default_slot_size);
+        ~ring();
+
+        ring(ring const &) = delete;
+        ring(ring &&) = delete;
+        auto operator=(ring const &) -> ring & = delete;
+        auto operator=(ring &&) -> ring & = delete;
+
+        /*! \brief Allocate a message part inside the ring.
+         *
+         * Data written into the part can later be exported without
+         * being copied again.
+         *
+         * \returns A part of `size` bytes, or nothing if the ring
+         * doesn't have enough free space.
+         */
+        auto allocate(std::size_t size) -> boost::optional<msg::part>;
+
+        /*! \brief The number of slots that are not in use. */
+        auto free_slots() const -> std::size_t;
+
+        /*! \brief Move the large data parts of a message into the ring.
+         *
+         * The shared memory flag is added to the metadata of the
+         * message. Parts smaller than `threshold`, or that don't fit
+         * in the ring, are sent inline.
+         *
+         * \param msg A [request](\ref msg::request) or a
+         * [reply](\ref msg::reply).
+         * \param threshold Parts smaller than this many bytes will be
+         * sent inline.
+         */
+        template <class message>
+        auto export_parts(message & msg,
+                          std::size_t threshold = default_threshold)
+            -> void
+        {
+            if (!detail::has_flag(msg.metadata())) {
+                msg.metadata().push_back(msg::part(flag.data(), flag.size()));
+            }
+            for (auto & p : msg.data()) {
+                export_part(p, threshold);
+            }
+        }
+
+        /*! \brief Export the parts of a message that is ready to be sent.
+         *
+         * Requests and replies in `parts` are exported as with
+         * [export_parts](\ref export_parts), other messages are
+         * returned unchanged.
+         */
+        auto export_sendable(msg::part_source && parts,
+                             std::size_t threshold = default_threshold)
+            -> msg::part_source;
+    };
+
+
+    /*! \brief Maps the rings of other processes to import data parts.
+     *
+     * Rings are mapped the first time a part from them is imported,
+     * and stay mapped as long as the importer or any part imported
+     * from them exist.
+     */
+    class importer
+    {
+        std::mutex lock;
+        std::map<std::pair<uint32_t, int32_t>,
+                 std::shared_ptr<detail::mapping>> mappings;
+
+        auto get_mapping(detail::descriptor const & desc)
+            -> std::shared_ptr<detail::mapping>;
+        auto import_part(msg::part & p) -> void;
+    public:
+        /*! \brief Replace the descriptors in a message with their data.
+         *
+         * Messages that don't carry the shared memory flag are left
+         * as they are. The imported parts point directly into the
+         * shared memory, and must not be modified.
+         *
+         * \returns True if the message was flagged for shared memory.
+         *
+         * \throws msg::exception::malformed A descriptor is invalid,
+         * or the ring it points to can't be mapped.
+         */
+        template <class message>
+        auto import_parts(message & msg) -> bool
+        {
+            if (!detail::has_flag(msg.metadata())) {
+                return false;
+            }
+            for (auto & p : msg.data()) {
+                import_part(p);
+            }
+            return true;
+        }
+    };
+};
@@ -49,11 +49,16 @@ public:
     using socket_t::socket_t;
 
     /*! \brief Recieve a message that has multiple parts as a stream.
+     *
+     * \param flags Flags for receiving the first part, such as
+     * `ZMQ_DONTWAIT`. Once the first part has arrived, the rest of the
+     * message is always available.
      *
      * \returns Parts of the message that was received. If the socket
-     * was configured to time out, the vector may be empty.
+     * was configured to time out, or `ZMQ_DONTWAIT` was given and no
+     * message was waiting, the vector may be empty.
      */
-    auto recv_multimsg() -> std::vector<zmq::message_t>;
+    auto recv_multimsg(int flags = 0) -> std::vector<zmq::message_t>;
 
     /*! \brief Send a message that has multiple parts.
      *
@@ -0,0 +1,65 @@
+/*
+  Copyright 2017 Kaan Genç
+
+  This file is part of DagBox.
+
+  DagBox is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  DagBox is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with DagBox.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "stream.hpp"
+
+
+reply_stream::reply_stream(msg::request const & request, sender send, encoder encode)
+    : request(msg::copy_without_data(request)),
+      send_parts(std::move(send)),
+      encode(std::move(encode)),
+      credit(msg::partial::initial_credit)
+{
+    name_ = this->request.client().value_or("")
+        + msg::stream_suffix(this->request.metadata());
+}
+
+
+auto reply_stream::send_now(msg::many_parts && data) -> void
+{
+    --credit;
+    auto chunk = msg::partial::make(request, std::move(data));
+    send_parts(encode(msg::send(std::move(chunk))));
+}
+
+
+auto reply_stream::send(msg::many_parts && data) -> bool
+{
+    if (credit == 0 || !held.empty()) {
+        held.push_back(std::move(data));
+        return false;
+    }
+    send_now(std::move(data));
+    return credit > 0;
+}
+
+
+auto reply_stream::add_credit(uint32_t amount) -> void
+{
+    credit += amount;
+    while (credit > 0 && !held.empty()) {
+        send_now(std::move(held.front()));
+        held.pop_front();
+    }
+}
+
+
+auto reply_stream::name() const -> msg::address
+{
+    return name_;
+}
@@ -0,0 +1,132 @@
+/*
+  Copyright 2017 Kaan Genç
+
+  This file is part of DagBox.
+
+  DagBox is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  DagBox is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with DagBox.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <deque>
+#include <functional>
+#include <vector>
+#include <boost/optional.hpp>
+#include <zmq.hpp>
+#include "message.hpp"
+
+
+/*! \file stream.hpp
+ * Sending the result of a request in chunks.
+ */
+
+
+
+/*! \brief Sends the result of a request in chunks.
+ *
+ * Workers that can produce their results incrementally may accept a
+ * `reply_stream &` as a second argument of their `operator()`, and
+ * return a [producer](\ref reply_stream::producer) instead of their
+ * reply. The [assistant](\ref assistant) calls the producer right
+ * away, and again whenever the client allows more chunks to be sent.
+ * Each chunk is sent to the client as a
+ * [partial reply](\ref msg::partial). The producer completes the
+ * request by returning the final reply as usual.
+ *
+ * ```
+ * auto operator()(msg::request && request, reply_stream &)
+ *     -> reply_stream::producer {
+ *     auto state = std::make_shared<progress>(std::move(request));
+ *     return [state](reply_stream & stream)
+ *         -> boost::optional<std::vector<zmq::message_t>> {
+ *         while (state->has_more()) {
+ *             if (!stream.send(state->next_chunk())) {
+ *                 return boost::none; // Called again once there is credit
+ *             }
+ *         }
+ *         state->request.data().clear();
+ *         return msg::send(msg::reply::make(std::move(state->request)));
+ *     };
+ * }
+ * ```
+ *
+ * The client controls how many chunks may be sent with
+ * [credit](\ref msg::credit) messages. Nothing blocks while waiting
+ * for credit, the assistant keeps handling other messages, including
+ * the credits, in the meantime. If no credit arrives for a while, the
+ * assistant drops the producer and replies with an error.
+ */
+class reply_stream
+{
+public:
+    /*! \brief Prepares a message for sending, for example by compressing it. */
+    typedef std::function<msg::part_source(msg::part_source &&)> encoder;
+    /*! \brief Sends a message to the broker. */
+    typedef std::function<void(msg::part_source &&)> sender;
+    /*! \brief Produces the chunks of a stream while there is credit.
+     *
+     * Returns the final reply once every chunk has been sent, or
+     * nothing once [send](\ref reply_stream::send) returned false, to
+     * be called again when there is more credit.
+     */
+    typedef std::function<boost::optional<std::vector<zmq::message_t>>(reply_stream &)>
+        producer;
+
+private:
+    // The client and metadata of the request, for the partial replies
+    msg::request request;
+    msg::address name_;
+    sender send_parts;
+    encoder encode;
+    uint32_t credit;
+    // Chunks that were sent without credit
+    std::deque<msg::many_parts> held;
+
+    auto send_now(msg::many_parts && data) -> void;
+public:
+    /*! \brief Create a stream for replying to a request.
+     *
+     * \param request The request being replied to. Its data isn't
+     * needed, and may be moved away afterwards.
+     * \param send Sends the partial replies.
+     * \param encode Applied to every partial reply before sending it.
+     */
+    reply_stream(msg::request const & request, sender send, encoder encode);
+
+    /*! \brief Send a chunk of the reply.
+     *
+     * A chunk sent without credit is held back until credit arrives.
+     *
+     * \returns False if there is no credit left, in which case the
+     * producer should return and wait to be called again.
+     */
+    auto send(msg::many_parts && data) -> bool;
+
+    /*! \brief Allow more chunks to be sent, starting with those that
+     *  were held back.
+     */
+    auto add_credit(uint32_t amount) -> void;
+
+    /*! \brief The number of chunks that can be sent without waiting. */
+    auto remaining_credit() const noexcept -> uint32_t { return credit; }
+
+    /*! \brief The number of chunks waiting for credit. */
+    auto held_chunks() const noexcept -> std::size_t { return held.size(); }
+
+    /*! \brief The name of the stream, as credits for it carry it.
+     *
+     * This is the address of the client followed by a
+     * [stream suffix](\ref msg::stream_suffix).
+     */
+    auto name() const -> msg::address;
+};
@@ -17,6 +17,8 @@
   License along with DagBox.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include "datastore.hpp"
+#include <algorithm>
+#include <map>
 #include <sstream>
 #include <boost/uuid/uuid.hpp>
 #include <boost/uuid/uuid_io.hpp>
@@ -26,78 +28,503 @@ using namespace detail;
 namespace uuid=boost::uuids;
 
 
-storage::storage(filesystem::path const & directory)
-    : env(lmdb::env::create())
+storage::storage(filesystem::path const & directory,
+                 std::size_t map_size,
+                 unsigned int flags)
+    : env(lmdb::env::create()),
+      bucket_count(0),
+      open_flags(flags)
 {
     set_max_dbs(max_buckets);
-    open(directory.c_str());
+    if (map_size > 0) {
+        set_mapsize(map_size);
+    }
+    filesystem::create_directories(directory);
+    open(directory.c_str(), flags);
 }
 
 
 
 
 
+auto storage::find_bucket(std::string const & name) const noexcept
+    -> boost::optional<MDB_dbi>
+{
+    auto count = bucket_count.load(std::memory_order_acquire);
+    for (std::size_t i = 0; i < count; ++i) {
+        if (buckets[i].name == name) {
+            return buckets[i].handle;
+        }
+    }
+    return boost::none;
+}
+
+
+auto storage::lock_buckets() -> std::unique_lock<std::mutex>
+{
+    return std::unique_lock<std::mutex>(bucket_lock);
+}
+
+
+auto storage::open_bucket(std::string const & name, lmdb::txn & txn, unsigned int flags)
+    -> MDB_dbi
+{
+    return lmdb::dbi::open(txn, name.c_str(), flags).handle();
+}
+
+
+auto storage::publish_bucket(std::string const & name, MDB_dbi handle) -> void
+{
+    std::lock_guard<std::mutex> guard(bucket_lock);
+    // Only one thread adds buckets at a time, so the count can't
+    // change in between
+    auto count = bucket_count.load(std::memory_order_relaxed);
+    for (std::size_t i = 0; i < count; ++i) {
+        if (buckets[i].name == name) {
+            return;
+        }
+    }
+    if (count >= max_buckets) {
+        // LMDB would have refused to open it
+        return;
+    }
+    buckets[count] = {name, handle};
+    bucket_count.store(count + 1, std::memory_order_release);
+}
+
+
+auto storage::configure_bucket(std::string const & name, bucket_options options) -> void
+{
+    configured[name] = std::move(options);
+}
+
+
+auto storage::options(std::string const & name) const -> bucket_options const &
+{
+    auto found = configured.find(name);
+    if (found == configured.end()) {
+        return default_options;
+    }
+    return found->second;
+}
+
+
 datastore::datastore(storage & env)
     : env(env)
 {}
 
 
-auto datastore::get_open_bucket(std::string bucket_name, lmdb::txn & txn)
-    -> lmdb::dbi &
+auto datastore::get_open_bucket(std::string const & bucket_name, lmdb::txn & txn,
+                                unsigned int extra_flags)
+    -> lmdb::dbi
 {
+    // A transaction that started before the bucket was shared
+    // can't use its handle yet, and opens the bucket itself
+    auto shared = env.find_bucket(bucket_name);
+    unsigned int flags;
+    if (shared && mdb_dbi_flags(txn, *shared, &flags) == MDB_SUCCESS) {
+        return lmdb::dbi(*shared);
+    }
+    for (auto & bucket : opened) {
+        if (bucket.first == bucket_name) {
+            return lmdb::dbi(bucket.second);
+        }
+    }
+    if (!opening.owns_lock()) {
+        opening = env.lock_buckets();
+    }
+    MDB_dbi handle;
     try {
-        return buckets.at(bucket_name);
-    } catch (std::out_of_range) {
-        auto result = buckets.emplace(
-            bucket_name,
-            lmdb::dbi::open(
-                txn,
-                bucket_name.c_str(),
-                bucket_open_flags()));
-        return result.first->second; // first is the iterator, iterator's second is the dbi
+        handle = env.open_bucket(bucket_name, txn, bucket_open_flags() | extra_flags);
+    } catch (...) {
+        // A bucket that failed to open leaves nothing to be closed
+        if (opened.empty()) {
+            opening.unlock();
+        }
+        throw;
     }
+    opened.emplace_back(bucket_name, handle);
+    return lmdb::dbi(handle);
 }
 
 
-auto datastore::operator()(msg::request && request) -> std::vector<zmq::message_t>
+auto datastore::options(std::string const & bucket_name) const -> bucket_options const &
 {
-    auto txn = lmdb::txn::begin(env, nullptr, txn_begin_flags());
-    for (auto & data : request.data()) {
-        msgpack::object_handle req_obj = msgpack::unpack(data.data<char>(), data.size());
-        auto buffer = process_request(req_obj, txn);
-        // TODO: Create a subclass of zmq::message_t that can be used
-        // as a buffer for msgpack
-        data.rebuild(buffer.data(), buffer.size());
+    return env.options(bucket_name);
+}
+
+
+auto datastore::opened_buckets() const noexcept -> bool
+{
+    return !opened.empty();
+}
+
+
+auto datastore::publish_opened() -> void
+{
+    for (auto & bucket : opened) {
+        env.publish_bucket(bucket.first, bucket.second);
     }
+    opened.clear();
+}
+
+
+auto datastore::begin_txn() -> lmdb::txn
+{
+    return lmdb::txn::begin(env, nullptr, txn_begin_flags());
+}
+
+
+auto datastore::end_txn(lmdb::txn && txn) -> void
+{
     txn.commit();
+}
+
+
+auto datastore::start_txn() -> lmdb::txn
+{
+    opened.clear();
+    return begin_txn();
+}
+
+
+auto datastore::finish_txn(lmdb::txn && txn) -> void
+{
+    try {
+        end_txn(std::move(txn));
+    } catch (...) {
+        // LMDB frees a transaction that fails to commit
+        txn_aborted();
+        throw;
+    }
+    if (opening.owns_lock()) {
+        opening.unlock();
+    }
+    publish_opened();
+}
+
+
+auto datastore::txn_aborted() -> void
+{
+    opened.clear();
+    if (opening.owns_lock()) {
+        opening.unlock();
+    }
+}
+
+
+auto datastore::process_data(msg::many_parts const & data_parts, lmdb::txn & txn)
+    -> msg::many_parts
+{
+    msg::many_parts results;
+    for (auto & data : data_parts) {
+        msgpack::object_handle req_obj = msgpack::unpack(data.data<char>(), data.size());
+        results.push_back(process_request(req_obj, txn).release());
+    }
+    return results;
+}
+
+
+auto datastore::operator()(msg::request && request) -> std::vector<zmq::message_t>
+{
+    request.data() = process(std::move(request.data()));
     return msg::send(msg::reply::make(std::move(request)));
 }
 
 
-
+auto datastore::process(msg::many_parts && data_parts) -> msg::many_parts
+{
+    auto txn = start_txn();
+    msg::many_parts results;
+    try {
+        results = process_data(data_parts, txn);
+    } catch (...) {
+        txn.abort();
+        txn_aborted();
+        throw;
+    }
+    finish_txn(std::move(txn));
+    return results;
+}
+
+
+auto datastore::operator()(std::vector<msg::request> && requests)
+    -> std::vector<msg::part_source>
+{
+    std::vector<msg::many_parts> results;
+    try {
+        auto txn = start_txn();
+        for (auto & request : requests) {
+            results.push_back(process_data(request.data(), txn));
+        }
+        finish_txn(std::move(txn));
+    } catch (std::exception &) {
+        // The transaction was aborted when it went out of scope
+        txn_aborted();
+        // Don't let one bad request fail the others. Each is tried
+        // again in a transaction of its own, and only the ones that
+        // still fail are replied to with an error.
+        std::vector<msg::part_source> replies;
+        for (auto & request : requests) {
+            try {
+                replies.push_back((*this)(std::move(request)));
+            } catch (std::exception & e) {
+                replies.push_back(msg::send(msg::make_error_reply(std::move(request), e.what())));
+            }
+        }
+        return replies;
+    }
+    std::vector<msg::part_source> replies;
+    for (std::size_t i = 0; i < requests.size(); ++i) {
+        requests[i].data() = std::move(results[i]);
+        replies.push_back(msg::send(msg::reply::make(std::move(requests[i]))));
+    }
+    return replies;
+}
+
+
+
+
+
+reader::reader(storage & env, std::chrono::milliseconds max_staleness)
+    : datastore(env),
+      max_staleness(max_staleness),
+      reuse_txn(env.open_flags & MDB_NOTLS),
+      idle_txn(nullptr),
+      idle_live(false)
+{}
+
+
+auto reader::begin_txn() -> lmdb::txn
+{
+    // A transaction that failed was aborted rather than given back,
+    // so a new one is needed
+    if (!reuse_txn || idle_txn.handle() == nullptr) {
+        snapshot_time = std::chrono::steady_clock::now();
+        return datastore::begin_txn();
+    }
+    auto now = std::chrono::steady_clock::now();
+    if (!idle_live || now - snapshot_time >= max_staleness) {
+        if (idle_live) {
+            idle_txn.reset();
+        }
+        idle_txn.renew();
+        snapshot_time = now;
+    }
+    return std::move(idle_txn);
+}
+
+
+auto reader::end_txn(lmdb::txn && txn) -> void
+{
+    // Buckets opened by the transaction are closed unless it is
+    // committed, so it can't be kept
+    if (!reuse_txn || opened_buckets()) {
+        datastore::end_txn(std::move(txn));
+        return;
+    }
+    // The snapshot is only kept if it may still be read from,
+    // otherwise it is released right away
+    idle_live = std::chrono::steady_clock::now() - snapshot_time < max_staleness;
+    if (!idle_live) {
+        txn.reset();
+    }
+    idle_txn = std::move(txn);
+}
+
+
+auto reader::idle_interval() const -> std::chrono::milliseconds
+{
+    return reuse_txn ? max_staleness : std::chrono::milliseconds{0};
+}
+
+
+auto reader::idle() -> void
+{
+    if (!idle_live || idle_txn.handle() == nullptr) {
+        return;
+    }
+    if (std::chrono::steady_clock::now() - snapshot_time >= max_staleness) {
+        idle_txn.reset();
+        idle_live = false;
+    }
+}
+
+
+namespace
+{
+    // The value of a field of a map, or null if the object isn't a
+    // map or doesn't have the field
+    auto find_field(msgpack::object const & object, std::string const & name)
+        -> msgpack::object const *
+    {
+        if (object.type != msgpack::type::MAP) {
+            return nullptr;
+        }
+        auto & map = object.via.map;
+        for (uint32_t i = 0; i < map.size; ++i) {
+            auto & field = map.ptr[i].key;
+            if (field.type == msgpack::type::STR
+                && name.compare(0, std::string::npos, field.via.str.ptr, field.via.str.size) == 0) {
+                return &map.ptr[i].val;
+            }
+        }
+        return nullptr;
+    }
+
+
+    // Whether a request has the given field, which tells the kinds
+    // of requests apart
+    auto has_field(msgpack::object const & request, std::string const & name) -> bool
+    {
+        return find_field(request, name) != nullptr;
+    }
+
+
+    // Follow a path of fields separated by dots
+    auto find_path(msgpack::object const & object, std::string const & path)
+        -> msgpack::object const *
+    {
+        auto current = &object;
+        std::size_t start = 0;
+        while (current != nullptr) {
+            auto dot = path.find('.', start);
+            current = find_field(*current, path.substr(start, dot - start));
+            if (dot == std::string::npos) {
+                break;
+            }
+            start = dot + 1;
+        }
+        return current;
+    }
+
+
+    auto index_bucket(std::string const & bucket_name, std::string const & path)
+        -> std::string
+    {
+        return bucket_name + "#" + path;
+    }
+}
+
+
+auto reader::fetch(wanted_values & wanted, lmdb::txn & txn) -> void
+{
+    // Keys are sorted the same way as in LMDB, and a cursor that is
+    // already on the page of the next key doesn't search the tree
+    // again, so each bucket is read in a single pass
+    for (auto & in_bucket : wanted) {
+        lmdb::dbi bucket(0);
+        try {
+            bucket = get_open_bucket(in_bucket.first, txn);
+        } catch (lmdb::not_found_error &) {
+            // Nothing was written to the bucket yet, so all of its
+            // keys are missing
+            continue;
+        }
+        auto cursor = lmdb::cursor::open(txn, bucket.handle());
+        for (auto & with_key : in_bucket.second) {
+            lmdb::val key(with_key.first), value;
+            if (!cursor.get(key, value, MDB_SET_KEY)) {
+                // Missing keys are left empty
+                continue;
+            }
+            // The value stays in the memory map until the transaction
+            // ends, and is only copied when it is packed
+            boost::string_ref data(value.data(), value.size());
+            for (auto target : with_key.second) {
+                *target = data;
+            }
+        }
+    }
+}
+
+
+auto reader::find(index_request const & request, lmdb::txn & txn) -> index_reply
+{
+    // Indexes are keyed by the packed value of the field, so values
+    // only match if they have the same type
+    msg::buffer value;
+    msgpack::pack(value, request.value);
+    lmdb::val key(value.data(), value.size()), primary_key;
+
+    // An index is only created by the first write to its bucket, so
+    // until then there is nothing to find
+    index_reply reply;
+    lmdb::dbi index(0), bucket(0);
+    try {
+        index = get_open_bucket(index_bucket(request.bucket, request.index), txn,
+                                MDB_DUPSORT);
+        bucket = get_open_bucket(request.bucket, txn);
+    } catch (lmdb::not_found_error &) {
+        return reply;
+    }
+    auto index_cursor = lmdb::cursor::open(txn, index.handle());
+    auto cursor = lmdb::cursor::open(txn, bucket.handle());
+
+    // The keys of the records are sorted, so the bucket is read in a
+    // single pass
+    auto found = index_cursor.get(key, primary_key, MDB_SET_KEY);
+    for (; found; found = index_cursor.get(key, primary_key, MDB_NEXT_DUP)) {
+        if (request.limit > 0 && reply.entries.size() >= request.limit) {
+            break;
+        }
+        lmdb::val record_key(primary_key.data(), primary_key.size()), record;
+        if (cursor.get(record_key, record, MDB_SET_KEY)) {
+            reply.entries.push_back({{primary_key.data(), primary_key.size()},
+                                     {record.data(), record.size()}});
+        }
+    }
+    return reply;
+}
 
 
 auto reader::process_request(msgpack::object_handle & req, lmdb::txn & txn)
-    -> msgpack::sbuffer
-{
-    // An anonymous function, hidden here to avoid declaring it inside
-    // the header while still writing it recursively
-    std::function<void(read_request &)> process;
-    process = [&](read_request & request) {
-        auto & bucket = get_open_bucket(request.bucket, txn);
-        lmdb::val value, key(request.key);
-        auto status = bucket.get(txn, key, value);
-        request.data = std::string(value.data(), value.size());
-        assert(status); // TODO: Throw an exception if we can't find the key
-        for (auto & rel : request.relations) {
-            process(rel.second);
+    -> msg::buffer
+{
+    msg::buffer buffer;
+    wanted_values wanted;
+
+    if (has_field(req.get(), "index")) {
+        msgpack::pack(buffer, find(req.get().as<index_request>(), txn));
+        return buffer;
+    }
+
+    if (has_field(req.get(), "keys")) {
+        auto request = req.get().as<multi_get_request>();
+        multi_get_reply result;
+        result.values.resize(request.keys.size());
+        for (std::size_t i = 0; i < request.keys.size(); ++i) {
+            auto & wanted_key = request.keys[i];
+            wanted[wanted_key.bucket][wanted_key.key].push_back(&result.values[i]);
         }
-    };
+        fetch(wanted, txn);
+        msgpack::pack(buffer, result);
+        return buffer;
+    }
 
     auto request = req.get().as<read_request>();
-    process(request);
-    msgpack::sbuffer buffer;
-    msgpack::pack(buffer, request);
+    // Gather every node of the relation tree, grouped by bucket and
+    // key, so that a key wanted by several nodes is only read once
+    read_reply reply;
+    std::vector<std::pair<read_request const *, read_reply *>> pending = {{&request, &reply}};
+    while (!pending.empty()) {
+        auto node = pending.back().first;
+        auto out = pending.back().second;
+        pending.pop_back();
+        out->bucket = node->bucket;
+        out->key = node->key;
+        wanted[node->bucket][node->key].push_back(&out->data);
+        // The relations are all added before any of them is visited,
+        // since adding one moves the others
+        for (auto & rel : node->relations) {
+            out->relations.emplace(rel.first, read_reply());
+        }
+        for (auto & rel : node->relations) {
+            pending.push_back({&rel.second, &out->relations[rel.first]});
+        }
+    }
+    fetch(wanted, txn);
+    msgpack::pack(buffer, reply);
     return buffer;
 }
 
@@ -109,23 +536,335 @@ auto reader::txn_begin_flags() const -> unsigned int { return MDB_RDONLY; }
 
 
 
-auto writer::process_request(msgpack::object_handle & req, lmdb::txn & txn)
-    -> msgpack::sbuffer
+writer::writer(storage & env,
+               std::chrono::milliseconds batch_window,
+               std::size_t batch_bytes)
+    : datastore(env),
+      batch_window(batch_window),
+      batch_bytes(batch_bytes)
+{}
+
+
+namespace
 {
-    auto request = req.get().as<write_request>();
-    auto & bucket = get_open_bucket(request.bucket, txn);
-    auto key = key_generator();
-    std::stringstream sb;
-    sb << key;
-    auto s = sb.str();
+    // The key right after the given one, counting it as a big endian
+    // number
+    auto successor(std::string key) -> std::string
+    {
+        for (auto i = key.rbegin(); i != key.rend(); ++i) {
+            auto & byte = reinterpret_cast<unsigned char &>(*i);
+            if (++byte != 0) {
+                break;
+            }
+        }
+        return key;
+    }
+
+    // Binary keys are packed as msgpack bin, so clients don't try to
+    // read them as UTF-8 text
+    auto pack_key(msgpack::packer<msg::buffer> & packer, std::string const & key, key_mode mode)
+        -> void
+    {
+        if (mode == key_mode::uuid) {
+            packer.pack(key);
+            return;
+        }
+        packer.pack_bin(static_cast<uint32_t>(key.size()));
+        packer.pack_bin_body(key.data(), static_cast<uint32_t>(key.size()));
+    }
+}
+
+
+auto writer::new_key(std::string const & bucket_name, lmdb::dbi & bucket, lmdb::txn & txn)
+    -> std::pair<std::string, unsigned int>
+{
+    auto mode = options(bucket_name).keys;
+    if (mode == key_mode::uuid) {
+        std::stringstream sb;
+        sb << key_generator();
+        return {sb.str(), 0};
+    }
+
+    std::string key;
+    if (mode == key_mode::ulid) {
+        auto now = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        auto random = key_generator();
+        key.resize(16);
+        for (int i = 0; i < 6; ++i) {
+            key[i] = static_cast<char>(now >> (8 * (5 - i)));
+        }
+        std::copy(random.begin(), random.begin() + 10, key.begin() + 6);
+    } else {
+        key.assign(8, '\0');
+        key[7] = 1;
+    }
 
-    bucket.put(txn, s.c_str(), request.data.c_str());
+    // Only keys after the last one can be appended. Other writers
+    // may share the bucket and the clock may go back, so the key
+    // continues from the last one when it would be behind it.
+    auto cursor = lmdb::cursor::open(txn, bucket.handle());
+    lmdb::val last_key, last_value;
+    if (cursor.get(last_key, last_value, MDB_LAST)) {
+        std::string last(last_key.data(), last_key.size());
+        if (key <= last) {
+            if (last.size() != key.size()) {
+                // The bucket has keys from another mode
+                return {key, 0};
+            }
+            key = successor(last);
+        }
+    }
+    return {key, MDB_APPEND};
+}
+
+
+auto writer::put(write_request const & request, lmdb::txn & txn) -> std::string
+{
+    auto bucket = get_open_bucket(request.bucket, txn);
+    auto key = new_key(request.bucket, bucket, txn);
+
+    // Values may hold any bytes, including zeroes
+    lmdb::val key_val(key.first), data_val(request.data);
+    bucket.put(txn, key_val, data_val, key.second);
+    index(request, key.first, txn);
+    return key.first;
+}
 
-    msgpack::sbuffer buffer;
-    msgpack::pack(buffer, s);
+
+auto writer::index(write_request const & request, std::string const & key, lmdb::txn & txn)
+    -> void
+{
+    auto & indexes = options(request.bucket).indexes;
+    if (indexes.empty()) {
+        return;
+    }
+    msgpack::object_handle value;
+    try {
+        value = msgpack::unpack(request.data.data(), request.data.size());
+    } catch (msgpack::unpack_error &) {
+        // Not msgpack, so it has no fields to index
+        return;
+    }
+
+    for (auto & path : indexes) {
+        auto field = find_path(value.get(), path);
+        if (field == nullptr) {
+            continue;
+        }
+        msg::buffer packed;
+        msgpack::pack(packed, *field);
+        // LMDB would fail the put with MDB_BAD_VALSIZE, which doesn't
+        // tell which field is at fault
+        auto max_key = static_cast<std::size_t>(mdb_env_get_maxkeysize(mdb_txn_env(txn)));
+        if (packed.size() > max_key) {
+            throw exception::oversized_index(
+                "Field " + path + " of a record in bucket " + request.bucket
+                + " is too long to be indexed");
+        }
+        auto index = get_open_bucket(index_bucket(request.bucket, path), txn, MDB_DUPSORT);
+        lmdb::val index_key(packed.data(), packed.size()), index_value(key);
+        index.put(txn, index_key, index_value);
+    }
+}
+
+
+auto writer::process_request(msgpack::object_handle & req, lmdb::txn & txn)
+    -> msg::buffer
+{
+    msg::buffer buffer;
+    msgpack::packer<msg::buffer> packer(buffer);
+    if (has_field(req.get(), "records")) {
+        // A failing record fails the whole transaction, so either
+        // every record is written or none
+        auto request = req.get().as<multi_put_request>();
+        std::vector<std::string> keys;
+        for (auto & record : request.records) {
+            keys.push_back(put(record, txn));
+        }
+        // The records may be in buckets with different key modes
+        packer.pack_array(static_cast<uint32_t>(keys.size()));
+        for (std::size_t i = 0; i < keys.size(); ++i) {
+            pack_key(packer, keys[i], options(request.records[i].bucket).keys);
+        }
+        return buffer;
+    }
+    auto request = req.get().as<write_request>();
+    pack_key(packer, put(request, txn), options(request.bucket).keys);
     return buffer;
 }
 
 
 auto writer::bucket_open_flags() const -> unsigned int { return MDB_CREATE; }
 auto writer::txn_begin_flags() const -> unsigned int { return lmdb::txn::default_flags; }
+
+
+
+
+
+auto scanner::scan(scan_request const & request, lmdb::txn & txn,
+                   chunk_sender const & send_chunk)
+    -> scan_reply
+{
+    scan_reply result;
+    lmdb::dbi bucket(0);
+    try {
+        bucket = get_open_bucket(request.bucket, txn);
+    } catch (lmdb::not_found_error &) {
+        // Nothing was written to the bucket yet
+        return result;
+    }
+    auto cursor = lmdb::cursor::open(txn, bucket.handle());
+
+    auto from = request.start;
+    if (request.prefix && *request.prefix > from) {
+        from = *request.prefix;
+    }
+    bool resuming = request.resume && *request.resume >= from;
+    if (resuming) {
+        from = *request.resume;
+    }
+    lmdb::val key(from), value;
+    auto found = cursor.get(key, value, MDB_SET_RANGE);
+    if (found && resuming && from.compare(0, std::string::npos, key.data(), key.size()) == 0) {
+        // The resume key was already sent
+        found = cursor.get(key, value, MDB_NEXT);
+    }
+
+    // Keys and values stay in the memory map until the transaction
+    // ends, and are only copied when they are packed
+    boost::string_ref last;
+    std::size_t count = 0;
+    for (; found; found = cursor.get(key, value, MDB_NEXT)) {
+        boost::string_ref current(key.data(), key.size());
+        if (request.end && current.compare(*request.end) >= 0) {
+            break;
+        }
+        if (request.prefix && !current.starts_with(*request.prefix)) {
+            break;
+        }
+        if (request.limit > 0 && count >= request.limit) {
+            // There is more, continue after the last entry
+            result.resume = last.to_string();
+            return result;
+        }
+        result.entries.push_back({current, {value.data(), value.size()}});
+        last = current;
+        ++count;
+        if (send_chunk && result.entries.size() >= chunk_entries) {
+            if (!send_chunk(std::move(result.entries))) {
+                // The client stopped reading, it may resume later
+                result.entries.clear();
+                result.resume = last.to_string();
+                return result;
+            }
+            result.entries.clear();
+        }
+    }
+    return result;
+}
+
+
+auto scanner::process_request(msgpack::object_handle & req, lmdb::txn & txn)
+    -> msg::buffer
+{
+    auto result = scan(req.get().as<scan_request>(), txn, chunk_sender());
+    msg::buffer buffer;
+    msgpack::pack(buffer, result);
+    return buffer;
+}
+
+
+auto scanner::operator()(msg::request && request) -> std::vector<zmq::message_t>
+{
+    return datastore::operator()(std::move(request));
+}
+
+
+auto scanner::operator()(msg::request && request, reply_stream &)
+    -> reply_stream::producer
+{
+    // Where the scans of a request have got to, between the calls of
+    // the producer
+    struct progress
+    {
+        scanner & owner;
+        msg::request request;
+        std::vector<scan_request> scans;
+        std::size_t current;
+        msg::many_parts results;
+        lmdb::txn txn;
+
+        ~progress() {
+            // A stream that ended early aborts its transaction
+            if (txn.handle() != nullptr) {
+                txn.abort();
+                owner.txn_aborted();
+            }
+        }
+    };
+    std::vector<scan_request> scans;
+    for (auto & data : request.data()) {
+        msgpack::object_handle req_obj = msgpack::unpack(data.data<char>(), data.size());
+        scans.push_back(req_obj.get().as<scan_request>());
+    }
+
+    // The buckets are opened in a short transaction of their own, so
+    // that other workers can open buckets while the stream waits for
+    // credit
+    auto pre_open = start_txn();
+    try {
+        for (auto & scan_req : scans) {
+            try {
+                get_open_bucket(scan_req.bucket, pre_open);
+            } catch (lmdb::not_found_error &) {
+                // The scan will find nothing
+            }
+        }
+    } catch (...) {
+        pre_open.abort();
+        txn_aborted();
+        throw;
+    }
+    finish_txn(std::move(pre_open));
+
+    std::shared_ptr<progress> state(new progress{
+            *this, std::move(request), std::move(scans), 0, {}, start_txn()});
+
+    return [this, state](reply_stream & stream)
+        -> boost::optional<std::vector<zmq::message_t>> {
+        for (; state->current < state->scans.size(); ++state->current) {
+            auto & scan_req = state->scans[state->current];
+            std::size_t sent = 0;
+            bool paused = false;
+            auto send_chunk = [&](std::vector<scan_entry_ref> && entries) {
+                sent += entries.size();
+                scan_reply chunk = {std::move(entries), boost::none};
+                msg::buffer buffer;
+                msgpack::pack(buffer, chunk);
+                msg::many_parts parts;
+                parts.push_back(buffer.release());
+                // A scan that has reached its limit finishes without
+                // waiting for credit
+                paused = !stream.send(std::move(parts))
+                    && !(scan_req.limit > 0 && sent >= scan_req.limit);
+                return !paused;
+            };
+            auto result = scan(scan_req, state->txn, send_chunk);
+            if (paused) {
+                // Continue after the last entry that was sent
+                scan_req.resume = std::move(result.resume);
+                if (scan_req.limit > 0) {
+                    scan_req.limit -= static_cast<uint32_t>(sent);
+                }
+                return boost::none;
+            }
+            msg::buffer buffer;
+            msgpack::pack(buffer, result);
+            state->results.push_back(buffer.release());
+        }
+        finish_txn(std::move(state->txn));
+        state->request.data() = std::move(state->results);
+        return msg::send(msg::reply::make(std::move(state->request)));
+    };
+}
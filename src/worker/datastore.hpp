@@ -18,6 +18,14 @@
  */
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 #include <boost/optional.hpp>
 #include <boost/uuid/random_generator.hpp>
@@ -27,8 +35,12 @@
 #include <msgpack.hpp>
 #include "../msgpack_boost_flatmap.hpp"
 #include <msgpack/adaptor/boost/optional.hpp>
+#include <msgpack/adaptor/boost/string_ref.hpp>
 #include <lmdb++.h>
+#include "../buffer.hpp"
+#include "../exception.hpp"
 #include "../message.hpp"
+#include "../stream.hpp"
 
 namespace filesystem = boost::filesystem;
 
@@ -42,6 +54,17 @@ namespace filesystem = boost::filesystem;
  */
 namespace data
 {
+    /*! \brief Exceptions thrown by the datastore workers. */
+    namespace exception
+    {
+        using std::runtime_error;
+
+        /*! \brief The packed value of an indexed field of a record is
+         *  longer than the largest key LMDB allows.
+         */
+        EXCEPTION(oversized_index, runtime_error);
+    }
+
     namespace detail
     {
         namespace container=boost::container;
@@ -58,6 +81,18 @@ namespace data
             MSGPACK_DEFINE_MAP(bucket, key, data, relations);
         };
 
+        // The reply to a read_request, which points to the values in
+        // the memory map instead of copying them
+        struct read_reply
+        {
+            boost::string_ref bucket;
+            boost::string_ref key;
+            boost::optional<boost::string_ref> data;
+            container::flat_map<std::string, read_reply> relations;
+
+            MSGPACK_DEFINE_MAP(bucket, key, data, relations);
+        };
+
         struct write_request
         {
             std::string bucket;
@@ -65,26 +100,295 @@ namespace data
 
             MSGPACK_DEFINE_MAP(bucket, data);
         };
+
+        struct bucket_key
+        {
+            std::string bucket;
+            std::string key;
+
+            MSGPACK_DEFINE_MAP(bucket, key);
+        };
+
+        // Reads many keys at once, across buckets
+        struct multi_get_request
+        {
+            std::vector<bucket_key> keys;
+
+            MSGPACK_DEFINE_MAP(keys);
+        };
+
+        struct multi_get_result
+        {
+            // In the order of the keys, empty for missing keys
+            std::vector<boost::optional<std::string>> values;
+
+            MSGPACK_DEFINE_MAP(values);
+        };
+
+        // Packs the same as multi_get_result, without copying values
+        struct multi_get_reply
+        {
+            std::vector<boost::optional<boost::string_ref>> values;
+
+            MSGPACK_DEFINE_MAP(values);
+        };
+
+        // Writes many records at once, across buckets, all or none of
+        // them. Replied to with the keys of the records, in order.
+        struct multi_put_request
+        {
+            std::vector<write_request> records;
+
+            MSGPACK_DEFINE_MAP(records);
+        };
+
+        // Finds the records whose indexed field has a value
+        struct index_request
+        {
+            std::string bucket;
+            // The path of the field, as in bucket_options::indexes
+            std::string index;
+            msgpack::object value;
+            // The most records to reply with, 0 for no limit
+            uint32_t limit;
+
+            MSGPACK_DEFINE_MAP(bucket, index, value, limit);
+        };
+
+        struct index_entry
+        {
+            std::string key;
+            std::string data;
+
+            MSGPACK_DEFINE_MAP(key, data);
+        };
+
+        // In the order of their keys
+        struct index_result
+        {
+            std::vector<index_entry> entries;
+
+            MSGPACK_DEFINE_MAP(entries);
+        };
+
+        // Packs the same as index_result, without copying records
+        struct index_entry_ref
+        {
+            boost::string_ref key;
+            boost::string_ref data;
+
+            MSGPACK_DEFINE_MAP(key, data);
+        };
+
+        struct index_reply
+        {
+            std::vector<index_entry_ref> entries;
+
+            MSGPACK_DEFINE_MAP(entries);
+        };
+
+        struct scan_request
+        {
+            std::string bucket;
+            // The first key to include, and the first to leave out
+            std::string start;
+            boost::optional<std::string> end;
+            // Only include keys that start with this
+            boost::optional<std::string> prefix;
+            // The most entries to reply with, 0 for no limit
+            uint32_t limit;
+            // Continue after this key, as given in an earlier result
+            boost::optional<std::string> resume;
+
+            MSGPACK_DEFINE_MAP(bucket, start, end, prefix, limit, resume);
+        };
+
+        struct scan_entry
+        {
+            std::string key;
+            std::string data;
+
+            MSGPACK_DEFINE_MAP(key, data);
+        };
+
+        struct scan_result
+        {
+            std::vector<scan_entry> entries;
+            // Set if the limit was reached before the end of the
+            // range, pass it back to continue the scan
+            boost::optional<std::string> resume;
+
+            MSGPACK_DEFINE_MAP(entries, resume);
+        };
+
+        // Packs the same as scan_result, without copying entries
+        struct scan_entry_ref
+        {
+            boost::string_ref key;
+            boost::string_ref data;
+
+            MSGPACK_DEFINE_MAP(key, data);
+        };
+
+        struct scan_reply
+        {
+            std::vector<scan_entry_ref> entries;
+            boost::optional<std::string> resume;
+
+            MSGPACK_DEFINE_MAP(entries, resume);
+        };
     };
 
+    /*! \brief How a [writer](\ref writer) generates the keys of new
+     *  records.
+     *
+     * Writers reply with UUIDs as msgpack strings, and with the keys
+     * of the binary modes as msgpack bin. Requests may give keys of
+     * any mode as either.
+     */
+    enum class key_mode
+    {
+        /*! \brief Random UUIDs, as 36 characters of text. */
+        uuid,
+        /*! \brief 16 bytes, a timestamp in milliseconds followed by
+         *  random bytes as in ULIDs, so keys sort in the order they
+         *  were written.
+         */
+        ulid,
+        /*! \brief 8 byte big endian integers, counting up from 1. */
+        sequence,
+    };
+
+
+    /*! \brief Settings of a bucket, see
+     *  [configure_bucket](\ref storage::configure_bucket).
+     */
+    struct bucket_options
+    {
+        /*! \brief How keys are generated for new records. */
+        key_mode keys = key_mode::uuid;
+        /*! \brief The fields that records are indexed by.
+         *
+         * Each is a path of field names separated by dots, such as
+         * `address.city`, into the msgpack map stored as the value of
+         * a record. An index is kept in its own bucket, named
+         * `bucket#path`, which counts towards
+         * [max_buckets](\ref storage::max_buckets). A write fails
+         * with [oversized_index](\ref exception::oversized_index) if
+         * the packed value of an indexed field is longer than the
+         * largest key LMDB allows, 511 bytes by default, and none of
+         * the records of its request are written. Queries on an index
+         * nothing has been written to yet find no records.
+         */
+        std::vector<std::string> indexes;
+    };
+
+
     /*! \brief An LMDB storage environment.
      *
      * This class is a
      * [lmdb::env](http://lmdbxx.sourceforge.net/classlmdb_1_1env.html),
      * which opens itself automatically when created.
+     *
+     * The storage also keeps the buckets that have been opened, so
+     * that every worker using the storage shares the same handles.
+     * Finding a bucket that is already open takes no locks.
      */
     class storage : public lmdb::env
     {
     public:
         /*! \brief Maximum number of buckets that can be opened. */
         const static uint_fast8_t max_buckets = 32;
+
+    private:
+        struct bucket
+        {
+            std::string name;
+            MDB_dbi handle;
+        };
+
+        // Buckets are only ever added, and an entry is complete
+        // before it is counted, so they can be read without locking
+        std::array<bucket, max_buckets> buckets;
+        std::atomic<std::size_t> bucket_count;
+        // LMDB doesn't allow buckets to be opened by several
+        // transactions at once, which may happen when workers sharing
+        // a storage run on different threads. The lock is held until
+        // the transaction that opened a bucket is finished.
+        std::mutex bucket_lock;
+
+        std::unordered_map<std::string, bucket_options> configured;
+        bucket_options const default_options;
+
+    public:
         /*! \brief Create a data storage.
          *
          * \param directory The directory where data will be stored.
          * Will be automatically created if it is missing. The program
          * must have write permissions in the given directory.
+         * \param map_size The largest size the database may grow
+         * to, in bytes. If 0, LMDB's default is used.
+         * \param flags Flags for opening the environment, see
+         * [LMDB's documentation](http://www.lmdb.tech/doc/group__mdb.html#ga32a193c6bf4d7d5c5d579e71f22e9340).
+         * With `MDB_NOTLS`, read transactions aren't tied to the
+         * thread that started them, which lets
+         * [readers](\ref reader) keep their transactions between
+         * requests.
+         */
+        storage(filesystem::path const & directory,
+                std::size_t map_size = 0,
+                unsigned int flags = 0);
+
+        /*! \brief The flags the environment was opened with. */
+        unsigned int const open_flags;
+
+        /*! \brief Find a bucket that has been opened by any worker.
+         *
+         * \returns The handle of the bucket, or nothing if it hasn't
+         * been opened yet.
+         */
+        auto find_bucket(std::string const & name) const noexcept
+            -> boost::optional<MDB_dbi>;
+
+        /*! \brief Take the lock for opening buckets.
+         *
+         * LMDB only allows one transaction at a time to open buckets,
+         * until that transaction is committed or aborted. The lock
+         * has to be held for as long.
+         */
+        auto lock_buckets() -> std::unique_lock<std::mutex>;
+
+        /*! \brief Open a bucket within a transaction.
+         *
+         * The [lock](\ref storage::lock_buckets) must be held, until
+         * `txn` is finished. The handle may only be used by other
+         * transactions once `txn` is committed, after which it should
+         * be [published](\ref storage::publish_bucket).
+         *
+         * \param flags The flags to open the bucket with, see
+         * [LMDB's documentation](http://www.lmdb.tech/doc/group__mdb.html#gac08cad5b096925642ca359a6d6f0562a).
+         */
+        auto open_bucket(std::string const & name, lmdb::txn & txn, unsigned int flags)
+            -> MDB_dbi;
+
+        /*! \brief Share a bucket with every worker using the storage.
+         *
+         * Must only be called once the transaction that opened the
+         * bucket has been committed.
+         */
+        auto publish_bucket(std::string const & name, MDB_dbi handle) -> void;
+
+        /*! \brief Change the settings of a bucket.
+         *
+         * Must be called before any worker uses the storage, since
+         * the settings are read without locking.
+         */
+        auto configure_bucket(std::string const & name, bucket_options options) -> void;
+
+        /*! \brief The settings of a bucket, or the defaults if it
+         *  wasn't configured.
          */
-        storage(filesystem::path const & directory);
+        auto options(std::string const & name) const -> bucket_options const &;
     };
 
 
@@ -103,7 +407,13 @@ namespace data
     class datastore
     {
         storage & env;
-        std::unordered_map<std::string, lmdb::dbi> buckets;
+        // Buckets opened by the current transaction, which are shared
+        // once it is committed
+        std::vector<std::pair<std::string, MDB_dbi>> opened;
+        // Held once the current transaction has opened a bucket
+        std::unique_lock<std::mutex> opening;
+
+        auto publish_opened() -> void;
     protected:
         /*! \brief Get a bucket.
          *
@@ -114,15 +424,31 @@ namespace data
          * \param bucket_name The name of the requested bucket. Any
          * string may be used, subject to limitations of LMDB.
          * \param txn The current transaction.
+         * \param extra_flags Flags to open the bucket with, on top of
+         * the [usual ones](\ref datastore::bucket_open_flags).
+         */
+        auto get_open_bucket(std::string const & bucket_name, lmdb::txn & txn,
+                             unsigned int extra_flags = 0)
+            -> lmdb::dbi;
+
+        /*! \brief The settings of a bucket in the storage. */
+        auto options(std::string const & bucket_name) const -> bucket_options const &;
+
+        /*! \brief Whether the current transaction opened any buckets.
+         *
+         * Such a transaction has to be committed, otherwise LMDB
+         * closes the buckets again.
          */
-        auto get_open_bucket(std::string bucket_name, lmdb::txn & txn)
-            -> lmdb::dbi &;
+        auto opened_buckets() const noexcept -> bool;
         /*! \brief Process a request and return a response.
          *
          * Child classes must override this method to provide their
          * own request processing behaviour. The datastore will handle
          * details such as de-serializing of the request and opening
-         * an LMDB transaction.
+         * an LMDB transaction. The reply is packed into a buffer that
+         * becomes its message part without being copied, and the
+         * transaction is still open while packing, so values can be
+         * packed straight from the memory map.
          *
          * \param req The request that needs to be processed.
          * \param txn The current transaction that has been opened for
@@ -130,7 +456,7 @@ namespace data
          */
         auto virtual process_request(msgpack::object_handle & req,
                                      lmdb::txn & txn)
-            -> msgpack::sbuffer = 0;
+            -> msg::buffer = 0;
         /*! \brief The flags that should be used when opening buckets.
          *
          * The datastore will open LMDB databases using the flags
@@ -147,6 +473,48 @@ namespace data
          * for possible values this function may return.
          */
         auto virtual txn_begin_flags() const -> unsigned int = 0;
+
+        /*! \brief Start the transaction that requests are processed
+         *  in.
+         *
+         * Starts a new transaction with the flags from
+         * txn_begin_flags by default.
+         */
+        auto virtual begin_txn() -> lmdb::txn;
+        /*! \brief Finish a transaction once its requests have been
+         *  processed.
+         *
+         * Commits the transaction by default. Not called if
+         * processing failed, in which case the transaction is
+         * aborted.
+         */
+        auto virtual end_txn(lmdb::txn && txn) -> void;
+
+        /*! \brief Start the transaction for a request, with
+         *  begin_txn.
+         */
+        auto start_txn() -> lmdb::txn;
+        /*! \brief Finish the transaction of a request with end_txn,
+         *  and share the buckets it opened.
+         */
+        auto finish_txn(lmdb::txn && txn) -> void;
+        /*! \brief Note that the transaction of a request was aborted
+         *  instead of finished.
+         *
+         * Must be called once the transaction is gone. Lets other
+         * workers open buckets again, and forgets the buckets the
+         * transaction opened, which LMDB closed with it.
+         */
+        auto txn_aborted() -> void;
+
+        /*! \brief Process the data parts of a request.
+         *
+         * \returns The results for each data part, in order. The
+         * data parts are not modified, so they can be processed again
+         * if the transaction fails.
+         */
+        auto process_data(msg::many_parts const & data_parts, lmdb::txn & txn)
+            -> msg::many_parts;
     public:
         /*! \brief The name of the service.
         *
@@ -167,35 +535,226 @@ namespace data
          * requst, ready to be sent.
          */
         auto operator()(msg::request && request) -> std::vector<zmq::message_t>;
+        /*! \brief Process the data parts of a request in a
+         *  transaction of their own.
+         *
+         * Lets the [embedded dispatcher](\ref embedded::dispatcher)
+         * skip framing the request and reading the reply.
+         *
+         * \returns The results for each data part, in order. If
+         * processing fails, `data_parts` is left as it was.
+         */
+        auto process(msg::many_parts && data_parts) -> msg::many_parts;
+        /*! \brief Process several data storage requests at once.
+         *
+         * All requests are processed in a single transaction. If any
+         * of them fails, the transaction is aborted and the requests
+         * are processed again, each in its own transaction. Requests
+         * that still fail are replied to with an
+         * [error](\ref msg::make_error_reply).
+         *
+         * \param requests Request messages for data storage.
+         *
+         * \returns A reply message for each request, in the same
+         * order, ready to be sent.
+         */
+        auto operator()(std::vector<msg::request> && requests)
+            -> std::vector<msg::part_source>;
     };
 
 
     /*! \brief A datatore reader.
+     *
+     * A data part may also be a
+     * [multi-get](\ref detail::multi_get_request), which reads keys
+     * from any number of buckets at once. Each bucket is read with a
+     * single cursor, and keys that don't exist are returned empty,
+     * as are the keys of buckets that don't exist yet.
+     * Or it may [find records](\ref detail::index_request) by the
+     * value of an indexed field.
+     *
+     * If the storage was opened with `MDB_NOTLS`, the reader keeps
+     * its read transaction between requests instead of starting a
+     * new one for each. The transaction is reset after a request and
+     * renewed for the next one, which avoids taking a new slot in
+     * LMDB's reader table every time.
+     *
+     * A reader may also keep reading from the same snapshot for up
+     * to `max_staleness`, skipping even the renewal. Its replies may
+     * then miss writes made during that time. Old snapshots keep
+     * LMDB from reusing pages, so the staleness should be short, and
+     * a reader that stays idle lets go of its snapshot once it is
+     * stale, see idle.
      */
     class reader : public datastore
     {
+        std::chrono::milliseconds const max_staleness;
+        bool const reuse_txn;
+        // Kept between requests, either reset or still reading from
+        // the snapshot taken at `snapshot_time`
+        lmdb::txn idle_txn;
+        bool idle_live;
+        std::chrono::steady_clock::time_point snapshot_time;
+
+        // Where to put the value of each key, by bucket and key
+        typedef std::map<std::string,
+                         std::map<std::string,
+                                  std::vector<boost::optional<boost::string_ref> *>>>
+            wanted_values;
+
+        auto fetch(wanted_values & wanted, lmdb::txn & txn) -> void;
+        auto find(detail::index_request const & request, lmdb::txn & txn)
+            -> detail::index_reply;
         auto process_request(msgpack::object_handle & req, lmdb::txn & txn)
-            -> msgpack::sbuffer override;
+            -> msg::buffer override;
         auto bucket_open_flags() const -> unsigned int override;
         auto txn_begin_flags() const -> unsigned int override;
+        auto begin_txn() -> lmdb::txn override;
+        auto end_txn(lmdb::txn && txn) -> void override;
     public:
         std::string const service_name = "datastore reader";
-        using datastore::datastore;
+
+        /*! \brief Create a reader.
+         *
+         * \param env Storage that the reader will use.
+         * \param max_staleness How long the reader may keep reading
+         * from the same snapshot. Only used if the storage was opened
+         * with `MDB_NOTLS`.
+         */
+        reader(storage & env,
+               std::chrono::milliseconds max_staleness = std::chrono::milliseconds{0});
+
+        /*! \brief How often the reader needs to be told that it is
+         *  idle.
+         *
+         * Zero, unless the reader keeps its snapshot between
+         * requests.
+         */
+        auto idle_interval() const -> std::chrono::milliseconds;
+
+        /*! \brief Let go of the snapshot if it is stale.
+         *
+         * Called by the [assistant](\ref assistant) every
+         * idle_interval between requests, so that a snapshot is
+         * released at most `max_staleness` after it became stale even
+         * if no more requests arrive.
+         */
+        auto idle() -> void;
+    };
+
+
+    /*! \brief A datastore reader that scans ranges of keys.
+     *
+     * Each data part of a request is a scan, which reads the entries
+     * of a bucket in key order, between `start` and `end` or only
+     * those with a `prefix`. A scan stops after `limit` entries, and
+     * then returns a `resume` key which continues it in another
+     * request. For each scan, the reply has one part with the entries
+     * that weren't sent yet, and the key to resume from if any.
+     *
+     * Run by an [assistant](\ref assistant), the entries are sent as
+     * [partial replies](\ref reply_stream) of up to `chunk_entries`
+     * each while the scan goes on, so that neither side needs to hold
+     * a large range in memory. Otherwise every entry is in the final
+     * reply. Scans use the transactions of a [reader](\ref reader),
+     * and entries are packed straight from the memory map. A bucket
+     * that doesn't exist yet has no entries.
+     */
+    class scanner : public reader
+    {
+        typedef std::function<bool(std::vector<detail::scan_entry_ref> &&)> chunk_sender;
+
+        auto scan(detail::scan_request const & request, lmdb::txn & txn,
+                  chunk_sender const & send_chunk)
+            -> detail::scan_reply;
+        auto process_request(msgpack::object_handle & req, lmdb::txn & txn)
+            -> msg::buffer override;
+    public:
+        std::string const service_name = "datastore scanner";
+        /*! \brief The most entries sent in each partial reply. */
+        std::size_t const static chunk_entries = 256;
+
+        using reader::reader;
+
+        /*! \brief Scan, sending every entry in the reply. */
+        auto operator()(msg::request && request) -> std::vector<zmq::message_t>;
+        /*! \brief Scan, sending the entries in chunks as they are
+         *  read.
+         *
+         * The scans keep reading from the same transaction while
+         * the stream waits for credit.
+         */
+        auto operator()(msg::request && request, reply_stream & stream)
+            -> reply_stream::producer;
     };
 
 
     /*! \brief A datatore writer.
+     *
+     * A data part may also hold [many records](\ref detail::multi_put_request)
+     * for different buckets, which are written all together or not at
+     * all.
+     *
+     * Every commit waits for the data to reach the disk, so a writer
+     * can only commit so many times a second. Run by an
+     * [assistant](\ref assistant), the requests that are waiting
+     * together are written in a single transaction. With a batch
+     * window, the assistant also holds requests back for a while to
+     * let more of them share the commit:
+     *
+     * ```
+     * assistant<data::writer> w(ctx, addr, 500, std::ref(store),
+     *                           std::chrono::milliseconds{2}, 1 << 20);
+     * ```
+     *
+     * Replies are only sent once the transaction is committed.
+     *
+     * Keys are random UUIDs unless the bucket is configured with
+     * another [key_mode](\ref key_mode). Keys of the other modes only
+     * grow, so they are appended to the end of the bucket with
+     * `MDB_APPEND`, which fills its pages instead of splitting them.
+     * They are binary, and replied with as msgpack bin.
+     *
+     * Records of buckets with [indexes](\ref bucket_options::indexes)
+     * are also added to their indexes, in the same transaction. A
+     * record whose value isn't a msgpack map, or lacks an indexed
+     * field, isn't added to that index.
      */
     class writer : public datastore
     {
         boost::uuids::basic_random_generator<boost::mt19937> key_generator;
 
+        auto new_key(std::string const & bucket_name, lmdb::dbi & bucket, lmdb::txn & txn)
+            -> std::pair<std::string, unsigned int>;
+        auto put(detail::write_request const & request, lmdb::txn & txn) -> std::string;
+        auto index(detail::write_request const & request, std::string const & key,
+                   lmdb::txn & txn) -> void;
         auto process_request(msgpack::object_handle & req, lmdb::txn & txn)
-            -> msgpack::sbuffer override;
+            -> msg::buffer override;
         auto bucket_open_flags() const -> unsigned int override;
         auto txn_begin_flags() const -> unsigned int override;
     public:
         std::string const service_name = "datastore writer";
-        using datastore::datastore;
+        /*! \brief How long requests are held back to be committed
+         *  together, counted from the first one.
+         */
+        std::chrono::milliseconds const batch_window;
+        /*! \brief Commit early once the held back requests have this
+         *  many bytes of data. 0 for no limit.
+         */
+        std::size_t const batch_bytes;
+
+        /*! \brief Create a writer.
+         *
+         * \param env Storage that the writer will use.
+         * \param batch_window How long requests are held back to be
+         * committed together. 0 to commit as soon as there are no
+         * more requests waiting.
+         * \param batch_bytes Commit early once the held back requests
+         * have this many bytes of data. 0 for no limit.
+         */
+        writer(storage & env,
+               std::chrono::milliseconds batch_window = std::chrono::milliseconds{0},
+               std::size_t batch_bytes = 0);
     };
 };
@@ -21,7 +21,14 @@
 
 auto lock::lock::operator()(msg::request && request) -> std::vector<zmq::message_t>
 {
-    for (auto & data : request.data()) {
+    request.data() = process(std::move(request.data()));
+    return msg::send(msg::reply::make(std::move(request)));
+}
+
+
+auto lock::lock::process(msg::many_parts && data_parts) -> msg::many_parts
+{
+    for (auto & data : data_parts) {
         msgpack::object_handle req_obj = msgpack::unpack(data.data<char>(), data.size());
         auto req = req_obj.get().as<detail::lock_request>();
         bool status;
@@ -34,10 +41,9 @@ auto lock::lock::operator()(msg::request && request) -> std::vector<zmq::message
             status = result > 0;
         }
 
-        msgpack::sbuffer buffer;
+        msg::buffer buffer;
         msgpack::pack(buffer, status);
-        data.rebuild(buffer.data(), buffer.size());
+        data = buffer.release();
     }
-
-    return msg::send(msg::reply::make(std::move(request)));
+    return std::move(data_parts);
 }
@@ -20,6 +20,7 @@
 
 #include <unordered_set>
 #include <msgpack.hpp>
+#include "../buffer.hpp"
 #include "../message.hpp"
 
 
@@ -45,7 +46,16 @@ namespace lock
     public:
         /*! \brief Service name. */
         std::string const service_name = "lock";
+        /*! \brief The locks are held by the instance, so the service
+         *  can only have one.
+         */
+        static bool const single_instance = true;
         /*! \brief Process a request message containing a lock request. */
         auto operator()(msg::request && request) -> std::vector<zmq::message_t>;
+        /*! \brief Process the data parts of a request.
+         *
+         * \returns Whether each lock request succeeded, in order.
+         */
+        auto process(msg::many_parts && data_parts) -> msg::many_parts;
     };
 };
@@ -18,8 +18,14 @@
  */
 #pragma once
 
+#include <atomic>
+#include <future>
+#include <memory>
+#include <thread>
 #include "helpers.hpp"
 #include "../src/assistant.hpp"
+#include "../src/broker.hpp"
+#include "../src/pool_assistant.hpp"
 
 
 
@@ -33,7 +39,99 @@ struct test_worker_echo
 };
 
 
+// A worker that replies with its own name.
+struct test_worker_named
+{
+    std::string const service_name;
+    test_worker_named(std::string const & name = "test worker named")
+        : service_name(name) {}
+    auto operator()(msg::request && req) -> std::vector<zmq::message_t> {
+        req.data() = msg_vec({service_name});
+        return msg::send(msg::reply::make(std::move(req)));
+    }
+};
+
+
+// A worker that fails every request.
+struct test_worker_failing
+{
+    std::string const service_name = "test worker failing";
+    auto operator()(msg::request &&) -> std::vector<zmq::message_t> {
+        throw std::runtime_error("failed on purpose");
+    }
+};
+
+
+// A worker that takes a while to reply.
+struct test_worker_slow
+{
+    std::string const service_name = "test worker slow";
+    auto operator()(msg::request && req) -> std::vector<zmq::message_t> {
+        std::this_thread::sleep_for(std::chrono::milliseconds{100});
+        return msg::send(msg::reply::make(std::move(req)));
+    }
+};
+
+
+// A worker that counts how often it was told it is idle.
+struct test_worker_idle
+{
+    std::string const service_name = "test worker idle";
+    std::atomic<int> * idled;
+    test_worker_idle(std::atomic<int> * idled) : idled(idled) {}
+    auto operator()(msg::request && req) -> std::vector<zmq::message_t> {
+        return msg::send(msg::reply::make(std::move(req)));
+    }
+    auto idle_interval() const -> std::chrono::milliseconds {
+        return std::chrono::milliseconds{20};
+    }
+    auto idle() -> void {
+        ++*idled;
+    }
+};
+
+
+// A worker that replies with the size of the batch each request
+// was processed in.
+struct test_worker_batched
+{
+    std::string const service_name = "test worker batched";
+    std::chrono::milliseconds const batch_window{200};
+    std::size_t const batch_bytes = 12;
+    auto operator()(msg::request && req) -> std::vector<zmq::message_t> {
+        std::vector<msg::request> single;
+        single.push_back(std::move(req));
+        return std::move((*this)(std::move(single))[0]);
+    }
+    auto operator()(std::vector<msg::request> && reqs) -> std::vector<msg::part_source> {
+        std::vector<msg::part_source> replies;
+        auto size = std::to_string(reqs.size());
+        for (auto & req : reqs) {
+            req.data() = msg_vec({size});
+            replies.push_back(msg::send(msg::reply::make(std::move(req))));
+        }
+        return replies;
+    }
+};
+
+
 auto test_assistant() -> void {
+    describe("multi service worker", [](){
+        multi_service<test_worker_echo, test_worker_named> multi(std::string("named"));
+
+        it("lists the services of all workers", [&](){
+            AssertThat(service_names(multi), HasLength(2));
+            AssertThat(service_names(multi)[0], Equals("test worker echo"));
+            AssertThat(service_names(multi)[1], Equals("named"));
+        });
+
+        it("passes requests to the worker of their service", [&](){
+            auto msg = msg::read(multi(msg::request::make("named", {}, msg_vec({"data"}))));
+            auto & rep = boost::get<msg::reply>(msg);
+            AssertThat(msg2str(rep.data()[0]), Equals("named"));
+        });
+    });
+
     describe("assistant", [](){
         zmq::context_t ctx;
         std::string addr = "inproc://test_assistant";
@@ -49,4 +147,328 @@ auto test_assistant() -> void {
             sock.send_multimsg(msg::send(reg));
         });
     });
+
+    describe("assistant with a failing worker", [](){
+        zmq::context_t ctx;
+        std::string addr = "inproc://test_assistant_failing";
+        class socket sock(ctx, zmq::socket_type::router);
+        sock.setsockopt(ZMQ_RCVTIMEO, 4000); // in ms
+        sock.bind(addr);
+
+        component<assistant<test_worker_failing>> failing(ctx, addr, 500);
+
+        msg::address worker_addr;
+
+        it("registers itself", [&](){
+            auto msg = msg::read(sock.recv_multimsg());
+            worker_addr = *boost::get<msg::registration>(msg).address();
+        });
+
+        it("replies with an error and keeps running", [&](){
+            for (auto i = 0; i < 2; ++i) {
+                auto req = msg::request::make("test worker failing",
+                                              msg_vec({"id"}), msg_vec({"data"}));
+                req.address(worker_addr);
+                sock.send_multimsg(msg::send(std::move(req)));
+                auto msg = msg::read(sock.recv_multimsg());
+                while (!boost::get<msg::reply>(&msg)) {
+                    // A heartbeat
+                    msg = msg::read(sock.recv_multimsg());
+                }
+                auto & rep = boost::get<msg::reply>(msg);
+                AssertThat(msg::is_error(rep.metadata()), Equals(true));
+                AssertThat(msg2str(rep.metadata()[0]), Equals("id"));
+                AssertThat(msg2str(rep.data()[0]), Equals("failed on purpose"));
+            }
+        });
+    });
+
+    describe("assistant receiving a corrupt request", [](){
+        zmq::context_t ctx;
+        std::string addr = "inproc://test_assistant_corrupt";
+        class socket sock(ctx, zmq::socket_type::router);
+        sock.setsockopt(ZMQ_RCVTIMEO, 4000); // in ms
+        sock.bind(addr);
+
+        component<assistant<test_worker_named>> named(ctx, addr, 500);
+
+        msg::address worker_addr;
+        auto receive_reply = [&](){
+            auto msg = msg::read(sock.recv_multimsg());
+            while (!boost::get<msg::reply>(&msg)) {
+                // A heartbeat
+                msg = msg::read(sock.recv_multimsg());
+            }
+            return std::move(boost::get<msg::reply>(msg));
+        };
+
+        it("registers itself", [&](){
+            auto msg = msg::read(sock.recv_multimsg());
+            worker_addr = *boost::get<msg::registration>(msg).address();
+        });
+
+        it("replies with an error and keeps running", [&](){
+            auto corrupt = msg::request::make("test worker named",
+                                              msg_vec({compression::flag}),
+                                              msg_vec({"\x7f" "garbage"}));
+            corrupt.address(worker_addr);
+            sock.send_multimsg(msg::send(std::move(corrupt)));
+            auto rep = receive_reply();
+            AssertThat(msg::is_error(rep.metadata()), Equals(true));
+            // The error is encoded like the request
+            AssertThat(compression::decompress(rep), Equals(true));
+            AssertThat(msg2str(rep.data()[0]), Contains("unknown method"));
+
+            auto req = msg::request::make("test worker named", {}, msg_vec({"data"}));
+            compression::compress(req);
+            req.address(worker_addr);
+            sock.send_multimsg(msg::send(std::move(req)));
+            auto named_rep = receive_reply();
+            AssertThat(msg::is_error(named_rep.metadata()), Equals(false));
+            compression::decompress(named_rep);
+            AssertThat(msg2str(named_rep.data()[0]), Equals("test worker named"));
+        });
+    });
+
+    describe("assistant with an idle worker", [](){
+        zmq::context_t ctx;
+        std::string addr = "inproc://test_assistant_idle";
+        class socket sock(ctx, zmq::socket_type::router);
+        sock.bind(addr);
+
+        std::atomic<int> idled(0);
+        std::atomic<int> pool_idled(0);
+
+        it("tells the worker every idle interval", [&](){
+            component<assistant<test_worker_idle>> idle(ctx, addr, 500, &idled);
+            std::this_thread::sleep_for(std::chrono::milliseconds{110});
+            AssertThat(idled.load(), IsGreaterThan(2));
+        });
+
+        it("tells each worker of a pool", [&](){
+            component<pool_assistant<test_worker_idle>> pool(ctx, addr, 500, 2, &pool_idled);
+            std::this_thread::sleep_for(std::chrono::milliseconds{110});
+            // Both threads are idle the whole time
+            AssertThat(pool_idled.load(), IsGreaterThan(5));
+        });
+    });
+
+    describe("assistant with a batch window", [](){
+        zmq::context_t ctx;
+        std::string addr = "inproc://test_assistant_batched";
+        class socket sock(ctx, zmq::socket_type::router);
+        sock.setsockopt(ZMQ_RCVTIMEO, 4000); // in ms
+        sock.bind(addr);
+
+        component<assistant<test_worker_batched>> batched(ctx, addr, 500);
+
+        msg::address worker_addr;
+
+        it("registers itself", [&](){
+            auto msg = msg::read(sock.recv_multimsg());
+            worker_addr = *boost::get<msg::registration>(msg).address();
+        });
+
+        auto send_request = [&](std::string const & data) {
+            auto req = msg::request::make("test worker batched", {}, msg_vec({data}));
+            req.address(worker_addr);
+            sock.send_multimsg(msg::send(std::move(req)));
+        };
+
+        auto receive_sizes = [&](std::size_t count) {
+            std::vector<std::string> sizes;
+            while (sizes.size() < count) {
+                auto msg = msg::read(sock.recv_multimsg());
+                auto rep = boost::get<msg::reply>(&msg);
+                if (rep) {
+                    sizes.push_back(msg2str(rep->data()[0]));
+                }
+            }
+            return sizes;
+        };
+
+        it("holds requests back to process them together", [&](){
+            for (auto i = 0; i < 3; ++i) {
+                send_request("data");
+                std::this_thread::sleep_for(std::chrono::milliseconds{10});
+            }
+            for (auto & size : receive_sizes(3)) {
+                AssertThat(size, Equals("3"));
+            }
+        });
+
+        it("processes a batch early once it has enough data", [&](){
+            send_request("eight by");
+            send_request("four");
+            send_request("more");
+            // The first two requests fill the batch
+            auto sizes = receive_sizes(3);
+            AssertThat(sizes[0], Equals("2"));
+            AssertThat(sizes[2], Equals("1"));
+        });
+    });
+
+    describe("assistant with a batch window behind a broker", [](){
+        zmq::context_t ctx;
+        std::string addr = "inproc://test_assistant_broker";
+        component<broker> broker_component(ctx, addr, std::chrono::milliseconds{1000});
+        std::unique_ptr<component<assistant<test_worker_batched>>> batched(
+            new component<assistant<test_worker_batched>>(ctx, addr, 500));
+
+        class socket sock(ctx, zmq::socket_type::dealer);
+        sock.setsockopt(ZMQ_RCVTIMEO, 4000); // in ms
+        sock.connect(addr);
+        // Give the worker time to register
+        std::this_thread::sleep_for(std::chrono::milliseconds{50});
+
+        auto send_request = [&](){
+            sock.send_multimsg(msg::send(msg::request::make("test worker batched", {},
+                                                            msg_vec({"data"}))));
+        };
+        auto receive_size = [&](){
+            auto msg = msg::read(sock.recv_multimsg());
+            return msg2str(boost::get<msg::reply>(msg).data()[0]);
+        };
+
+        it("is sent more requests while a batch is held back", [&](){
+            for (auto i = 0; i < 3; ++i) {
+                send_request();
+                std::this_thread::sleep_for(std::chrono::milliseconds{10});
+            }
+            for (auto i = 0; i < 3; ++i) {
+                AssertThat(receive_size(), Equals("3"));
+            }
+        });
+
+        it("processes the batch it holds back when stopped", [&](){
+            send_request();
+            std::this_thread::sleep_for(std::chrono::milliseconds{20});
+            auto start = detail_time::time_now();
+            batched.reset();
+            // Without waiting for the rest of the window
+            auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                detail_time::time_now() - start);
+            AssertThat(elapsed.count(), IsLessThan(150));
+            AssertThat(receive_size(), Equals("1"));
+        });
+    });
+
+    describe("pool assistant", [](){
+        zmq::context_t ctx;
+        std::string addr = "inproc://test_pool_assistant";
+        class socket sock(ctx, zmq::socket_type::router);
+        sock.setsockopt(ZMQ_RCVTIMEO, 4000); // in ms
+        sock.bind(addr);
+
+        component<pool_assistant<test_worker_echo>> echo_pool(ctx, addr, 500, 2);
+
+        msg::address pool_addr;
+
+        it("registers itself with its concurrency", [&](){
+            auto msg = msg::read(sock.recv_multimsg());
+            auto & reg = boost::get<msg::registration>(msg);
+            AssertThat(reg.concurrency(), Equals<uint32_t>(2));
+            pool_addr = *reg.address();
+        });
+
+        it("processes requests on its threads", [&](){
+            for (auto i = 0; i < 4; ++i) {
+                auto req = msg::request::make("test worker echo",
+                                              msg_vec({}),
+                                              msg_vec({"data"}));
+                req.address(pool_addr);
+                sock.send_multimsg(msg::send(std::move(req)));
+            }
+            auto echoed = 0;
+            while (echoed < 4) {
+                auto msg = msg::read(sock.recv_multimsg());
+                auto req = boost::get<msg::request>(&msg);
+                if (!req) {
+                    // A heartbeat
+                    continue;
+                }
+                AssertThat(msg2str(req->data()[0]), Equals("data"));
+                ++echoed;
+            }
+        });
+    });
+
+    describe("pool assistant that is stopped", [](){
+        zmq::context_t ctx;
+        std::string addr = "inproc://test_pool_assistant_stopped";
+        class socket sock(ctx, zmq::socket_type::router);
+        sock.setsockopt(ZMQ_RCVTIMEO, 4000); // in ms
+        sock.bind(addr);
+
+        std::unique_ptr<component<pool_assistant<test_worker_slow>>> slow_pool(
+            new component<pool_assistant<test_worker_slow>>(ctx, addr, 500, 2));
+
+        msg::address pool_addr;
+
+        it("registers itself", [&](){
+            auto msg = msg::read(sock.recv_multimsg());
+            pool_addr = *boost::get<msg::registration>(msg).address();
+        });
+
+        it("withdraws and replies to the requests in flight", [&](){
+            for (auto i = 0; i < 3; ++i) {
+                auto req = msg::request::make("test worker slow",
+                                              msg_vec({}), msg_vec({"data"}));
+                req.address(pool_addr);
+                sock.send_multimsg(msg::send(std::move(req)));
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds{20});
+            auto stopped = std::async(std::launch::async, [&](){ slow_pool.reset(); });
+
+            auto replies = 0;
+            auto withdrawn = false;
+            while (replies < 3 || !withdrawn) {
+                auto msg = msg::read(sock.recv_multimsg());
+                if (boost::get<msg::reply>(&msg)) {
+                    ++replies;
+                    continue;
+                }
+                auto reg = boost::get<msg::registration>(&msg);
+                if (reg) {
+                    AssertThat(reg->concurrency(), Equals<uint32_t>(0));
+                    withdrawn = true;
+                    // Confirm, as the broker would
+                    sock.send_multimsg(msg::send(std::move(*reg)));
+                }
+            }
+            stopped.get();
+        });
+    });
+
+    describe("pool assistant with a failing worker", [](){
+        zmq::context_t ctx;
+        std::string addr = "inproc://test_pool_assistant_failing";
+        class socket sock(ctx, zmq::socket_type::router);
+        sock.setsockopt(ZMQ_RCVTIMEO, 4000); // in ms
+        sock.bind(addr);
+
+        component<pool_assistant<test_worker_failing>> failing_pool(ctx, addr, 500, 2);
+
+        msg::address pool_addr;
+
+        it("registers itself", [&](){
+            auto msg = msg::read(sock.recv_multimsg());
+            pool_addr = *boost::get<msg::registration>(msg).address();
+        });
+
+        it("replies with an error", [&](){
+            auto req = msg::request::make("test worker failing",
+                                          msg_vec({"id"}), msg_vec({"data"}));
+            req.address(pool_addr);
+            sock.send_multimsg(msg::send(std::move(req)));
+            auto msg = msg::read(sock.recv_multimsg());
+            while (!boost::get<msg::reply>(&msg)) {
+                // A heartbeat
+                msg = msg::read(sock.recv_multimsg());
+            }
+            auto & rep = boost::get<msg::reply>(msg);
+            AssertThat(msg::is_error(rep.metadata()), Equals(true));
+            AssertThat(msg2str(rep.data()[0]), Equals("failed on purpose"));
+        });
+    });
 };
@@ -59,5 +59,182 @@ auto test_broker = [](){
             auto rep = msg::read(sock.recv_multimsg());
             boost::get<msg::reply>(rep);
         });
+
+        it("forwards partial replies and credits", [&](){
+            sock.send_multimsg(msg::send(msg::request::make("test_service",
+                                                            msg_vec({"meta"}),
+                                                            msg_vec({"data"}))));
+            auto req = msg::read(sock.recv_multimsg());
+            auto & sent_request = boost::get<msg::request>(req);
+
+            sock.send_multimsg(msg::send(msg::partial::make(sent_request,
+                                                            msg_vec({"chunk"}))));
+            auto part = msg::read(sock.recv_multimsg());
+            auto & received_part = boost::get<msg::partial>(part);
+            AssertThat(msg2str(received_part.data()[0]), Equals("chunk"));
+
+            sock.send_multimsg(msg::send(msg::credit::make(*received_part.stream(), 2)));
+            auto cred = msg::read(sock.recv_multimsg());
+            AssertThat(boost::get<msg::credit>(cred).amount(), Equals<uint32_t>(2));
+
+            sock.send_multimsg(msg::send(msg::reply::make(std::move(sent_request))));
+            auto rep = msg::read(sock.recv_multimsg());
+            boost::get<msg::reply>(rep);
+        });
+
+        it("keeps the streams of several requests apart", [&](){
+            class socket streamer(ctx, zmq::socket_type::dealer);
+            streamer.setsockopt(ZMQ_RCVTIMEO, 500); // in ms
+            streamer.connect(br_addr);
+            streamer.send_multimsg(msg::send(msg::registration::make("stream_service", 2)));
+            auto reg = msg::read(streamer.recv_multimsg());
+            boost::get<msg::registration>(reg);
+
+            std::vector<msg::any_message> requests;
+            std::vector<msg::address> streams;
+            for (uint64_t id = 1; id <= 2; ++id) {
+                msg::many_parts metadata;
+                metadata.push_back(msg::make_request_id(id));
+                sock.send_multimsg(msg::send(msg::request::make("stream_service",
+                                                                std::move(metadata),
+                                                                msg_vec({"data"}))));
+                requests.push_back(msg::read(streamer.recv_multimsg()));
+                auto & sent_request = boost::get<msg::request>(requests.back());
+                streamer.send_multimsg(msg::send(msg::partial::make(sent_request,
+                                                                    msg_vec({"chunk"}))));
+                auto part = msg::read(sock.recv_multimsg());
+                streams.push_back(*boost::get<msg::partial>(part).stream());
+            }
+            AssertThat(streams[0] == streams[1], Equals(false));
+
+            // Once the first stream ends, only the second takes credit
+            auto & first = boost::get<msg::request>(requests[0]);
+            streamer.send_multimsg(msg::send(msg::reply::make(std::move(first))));
+            auto first_reply = msg::read(sock.recv_multimsg());
+            boost::get<msg::reply>(first_reply);
+            sock.send_multimsg(msg::send(msg::credit::make(streams[0], 1)));
+            sock.send_multimsg(msg::send(msg::credit::make(streams[1], 2)));
+            auto cred = msg::read(streamer.recv_multimsg());
+            auto & credit = boost::get<msg::credit>(cred);
+            AssertThat(credit.amount(), Equals<uint32_t>(2));
+            msg::many_parts second_metadata;
+            second_metadata.push_back(msg::make_request_id(2));
+            auto name = credit.stream();
+            AssertThat(name.substr(name.size() - msg::stream_suffix_size),
+                       Equals(msg::stream_suffix(second_metadata)));
+
+            auto & second = boost::get<msg::request>(requests[1]);
+            streamer.send_multimsg(msg::send(msg::reply::make(std::move(second))));
+            auto second_reply = msg::read(sock.recv_multimsg());
+            boost::get<msg::reply>(second_reply);
+        });
+
+        it("assigns several requests to workers with concurrency", [&](){
+            class socket pool(ctx, zmq::socket_type::dealer);
+            pool.setsockopt(ZMQ_RCVTIMEO, 500); // in ms
+            pool.connect(br_addr);
+            pool.send_multimsg(msg::send(msg::registration::make("pool_service", 2)));
+            auto reg = msg::read(pool.recv_multimsg());
+            boost::get<msg::registration>(reg);
+
+            for (auto i = 0; i < 2; ++i) {
+                sock.send_multimsg(msg::send(msg::request::make("pool_service",
+                                                                msg_vec({}),
+                                                                msg_vec({"data"}))));
+            }
+            // Both requests arrive before either has been replied to
+            auto first = msg::read(pool.recv_multimsg());
+            auto second = msg::read(pool.recv_multimsg());
+            for (auto req : {&first, &second}) {
+                auto & sent_request = boost::get<msg::request>(*req);
+                pool.send_multimsg(msg::send(msg::reply::make(std::move(sent_request))));
+                auto rep = msg::read(sock.recv_multimsg());
+                boost::get<msg::reply>(rep);
+            }
+        });
+
+        it("routes several services to a single worker", [&](){
+            class socket multi(ctx, zmq::socket_type::dealer);
+            multi.setsockopt(ZMQ_RCVTIMEO, 500); // in ms
+            multi.connect(br_addr);
+            multi.send_multimsg(msg::send(msg::registration::make(
+                                              std::vector<std::string>{"first_service",
+                                                                       "second_service"})));
+            auto reg = msg::read(multi.recv_multimsg());
+            boost::get<msg::registration>(reg);
+
+            for (auto service : {"first_service", "second_service"}) {
+                sock.send_multimsg(msg::send(msg::request::make(service,
+                                                                msg_vec({}),
+                                                                msg_vec({"data"}))));
+                auto req = msg::read(multi.recv_multimsg());
+                auto & sent_request = boost::get<msg::request>(req);
+                AssertThat(sent_request.service(), Equals(service));
+                multi.send_multimsg(msg::send(msg::reply::make(std::move(sent_request))));
+                auto rep = msg::read(sock.recv_multimsg());
+                boost::get<msg::reply>(rep);
+            }
+        });
+
+        it("shares the concurrency of a worker between its services", [&](){
+            class socket multi(ctx, zmq::socket_type::dealer);
+            multi.setsockopt(ZMQ_RCVTIMEO, 200); // in ms
+            multi.connect(br_addr);
+            multi.send_multimsg(msg::send(msg::registration::make(
+                                              std::vector<std::string>{"third_service",
+                                                                       "fourth_service"})));
+            auto reg = msg::read(multi.recv_multimsg());
+            boost::get<msg::registration>(reg);
+
+            for (auto service : {"third_service", "fourth_service"}) {
+                sock.send_multimsg(msg::send(msg::request::make(service,
+                                                                msg_vec({}),
+                                                                msg_vec({"data"}))));
+            }
+            auto first = msg::read(multi.recv_multimsg());
+            // The second request waits until the first is replied to
+            AssertThat(multi.recv_multimsg(), HasLength(0));
+            multi.send_multimsg(msg::send(msg::reply::make(
+                                              std::move(boost::get<msg::request>(first)))));
+            auto second = msg::read(multi.recv_multimsg());
+            AssertThat(boost::get<msg::request>(second).service(), Equals("fourth_service"));
+        });
+
+        it("keeps a worker busy while it waits for requests of its own", [&](){
+            class socket busy(ctx, zmq::socket_type::dealer);
+            busy.setsockopt(ZMQ_RCVTIMEO, 200); // in ms
+            busy.connect(br_addr);
+            busy.send_multimsg(msg::send(msg::registration::make("busy_service")));
+            auto reg = msg::read(busy.recv_multimsg());
+            boost::get<msg::registration>(reg);
+
+            for (auto i = 0; i < 2; ++i) {
+                sock.send_multimsg(msg::send(msg::request::make("busy_service",
+                                                                msg_vec({}),
+                                                                msg_vec({"data"}))));
+            }
+            auto first = msg::read(busy.recv_multimsg());
+            // The worker asks another service for help
+            busy.send_multimsg(msg::send(msg::request::make("test_service",
+                                                            msg_vec({}),
+                                                            msg_vec({"help"}))));
+            auto help = msg::read(sock.recv_multimsg());
+            sock.send_multimsg(msg::send(msg::reply::make(
+                                             std::move(boost::get<msg::request>(help)))));
+            auto helped = msg::read(busy.recv_multimsg());
+            boost::get<msg::reply>(helped);
+
+            // The second request waits until the first is replied to
+            AssertThat(busy.recv_multimsg(), HasLength(0));
+            busy.send_multimsg(msg::send(msg::reply::make(
+                                             std::move(boost::get<msg::request>(first)))));
+            auto first_reply = msg::read(sock.recv_multimsg());
+            boost::get<msg::reply>(first_reply);
+            auto second = msg::read(busy.recv_multimsg());
+            busy.send_multimsg(msg::send(msg::reply::make(
+                                             std::move(boost::get<msg::request>(second)))));
+            auto second_reply = msg::read(sock.recv_multimsg());
+            boost::get<msg::reply>(second_reply);
+        });
     });
 };
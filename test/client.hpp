@@ -0,0 +1,135 @@
+/*
+  Copyright 2017 Kaan Genç
+
+  This file is part of DagBox.
+
+  DagBox is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  DagBox is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with DagBox.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <future>
+#include <thread>
+#include "helpers.hpp"
+#include "../src/client.hpp"
+#include "../src/broker.hpp"
+#include "../src/assistant.hpp"
+#include "../src/worker/lock.hpp"
+
+
+auto test_client = [](){
+    describe("client", [](){
+        zmq::context_t ctx;
+        std::string addr = "inproc://test_client";
+        component<broker> broker_component(ctx, addr, std::chrono::milliseconds{1000});
+        component<assistant<lock::lock>> lock_component(ctx, addr, 500);
+
+        dagbox::client c(ctx, addr);
+
+        auto lock_request = [](std::string const & key) {
+            lock::detail::lock_request lreq = {
+                .key = key,
+                .lock = true,
+            };
+            return msg::request::make("lock", {}, msg_vec({dumps(lreq)}));
+        };
+
+        it("gets the reply to a request", [&](){
+            auto reply = c.request(lock_request("test client key")).get();
+            AssertThat(reply.data(), HasLength(1));
+            AssertThat(loads<bool>(reply.data()[0]), Equals(true));
+        });
+
+        it("matches replies to many requests in flight", [&](){
+            std::vector<std::future<msg::reply>> replies;
+            for (auto i = 0; i < 16; ++i) {
+                replies.push_back(c.request(lock_request("test client " + std::to_string(i))));
+            }
+            // Every key is new, so every lock must succeed
+            for (auto & reply : replies) {
+                AssertThat(loads<bool>(reply.get().data()[0]), Equals(true));
+            }
+            AssertThat(c.pending(), Equals<std::size_t>(0));
+        });
+
+        it("accepts requests from several threads", [&](){
+            std::vector<std::thread> threads;
+            std::atomic<int> locked(0);
+            for (auto i = 0; i < 4; ++i) {
+                threads.emplace_back([&, i](){
+                    auto key = "test client thread " + std::to_string(i);
+                    auto first = c.request(lock_request(key));
+                    auto second = c.request(lock_request(key));
+                    // Only one of the requests can take the lock
+                    if (loads<bool>(first.get().data()[0])) { ++locked; }
+                    if (loads<bool>(second.get().data()[0])) { ++locked; }
+                });
+            }
+            for (auto & t : threads) {
+                t.join();
+            }
+            AssertThat(locked.load(), Equals(4));
+        });
+
+        it("coalesces small requests to a service", [&](){
+            dagbox::client coalescing(ctx, addr);
+            coalescing.coalesce("lock", 8, std::chrono::microseconds{100});
+            std::vector<std::future<msg::reply>> replies;
+            for (auto i = 0; i < 20; ++i) {
+                replies.push_back(coalescing.request(lock_request("test coalesced " + std::to_string(i))));
+            }
+            lock::detail::lock_request first = {"test coalesced 0", true};
+            lock::detail::lock_request other = {"test coalesced other", true};
+            auto two = coalescing.request(msg::request::make(
+                                              "lock", {}, msg_vec({dumps(first), dumps(other)})));
+            for (auto & reply : replies) {
+                auto rep = reply.get();
+                AssertThat(rep.data(), HasLength(1));
+                AssertThat(loads<bool>(rep.data()[0]), Equals(true));
+            }
+            // Each caller gets the parts of the reply for its own parts
+            auto rep = two.get();
+            AssertThat(rep.data(), HasLength(2));
+            AssertThat(loads<bool>(rep.data()[0]), Equals(false));
+            AssertThat(loads<bool>(rep.data()[1]), Equals(true));
+            AssertThat(coalescing.pending(), Equals<std::size_t>(0));
+        });
+
+        it("handles replies while a coalesced request waits", [&](){
+            dagbox::client lingering(ctx, addr);
+            lingering.coalesce("lock", 8, std::chrono::microseconds{300000});
+            auto start = detail_time::time_now();
+            auto held = lingering.request(lock_request("test lingering held"));
+            // Requests with metadata are sent right away
+            lock::detail::lock_request direct = {"test lingering direct", true};
+            auto sent = lingering.request(msg::request::make(
+                                              "lock", msg_vec({"meta"}), msg_vec({dumps(direct)})));
+            AssertThat(loads<bool>(sent.get().data()[0]), Equals(true));
+            auto waited = std::chrono::duration_cast<std::chrono::milliseconds>(
+                detail_time::time_now() - start);
+            AssertThat(waited.count(), IsLessThan(200));
+
+            AssertThat(loads<bool>(held.get().data()[0]), Equals(true));
+            waited = std::chrono::duration_cast<std::chrono::milliseconds>(
+                detail_time::time_now() - start);
+            AssertThat(waited.count(), IsGreaterThan(250));
+        });
+
+        it("fails requests that are never replied to", [&](){
+            dagbox::client impatient(ctx, addr, std::chrono::milliseconds{20}, 1);
+            auto reply = impatient.request(msg::request::make("test client missing",
+                                                              {}, msg_vec({"data"})));
+            AssertThrows(dagbox::exception::timeout, reply.get());
+        });
+    });
+};
@@ -0,0 +1,96 @@
+/*
+  Copyright 2017 Kaan Genç
+
+  This file is part of DagBox.
+
+  DagBox is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  DagBox is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with DagBox.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include "helpers.hpp"
+#include "../src/compression.hpp"
+
+
+auto test_compression = [](){
+    describe("compression", [](){
+        // Repetitive enough to compress well, and larger than the threshold
+        std::string large(4 * compression::default_threshold, 'x');
+
+        it("marks compressed messages in metadata", [&](){
+            auto req = msg::request::make("service",
+                                          msg_vec({"meta"}),
+                                          msg_vec({"data"}));
+            compression::compress(req);
+
+            AssertThat(req.metadata(), HasLength(2));
+            AssertThat(msg2str(req.metadata()[0]), Equals("meta"));
+            AssertThat(msg2str(req.metadata()[1]), Equals(compression::flag));
+        });
+
+        it("compresses only the large data parts", [&](){
+            auto req = msg::request::make("service", {},
+                                          msg_vec({"small", large}));
+            compression::compress(req);
+
+            // Small parts are only prefixed with the method
+            AssertThat(req.data()[0].size(), Equals<unsigned int>(6));
+            AssertThat(req.data()[1].size(), IsLessThan<unsigned int>(large.size()));
+        });
+
+        it("restores the data parts when decompressed", [&](){
+            auto req = msg::request::make("service", {},
+                                          msg_vec({"small", large}));
+            compression::compress(req);
+            auto received = msg::read(msg::send(std::move(req)));
+            auto & message = boost::get<msg::request>(received);
+
+            AssertThat(compression::decompress(message), Equals(true));
+            AssertThat(msg2str(message.data()[0]), Equals("small"));
+            AssertThat(msg2str(message.data()[1]), Equals(large));
+        });
+
+        it("leaves messages without the flag alone", [&](){
+            auto req = msg::request::make("service", {},
+                                          msg_vec({"data"}));
+
+            AssertThat(compression::decompress(req), Equals(false));
+            AssertThat(msg2str(req.data()[0]), Equals("data"));
+        });
+
+        it("compresses replies that are ready to be sent", [&](){
+            auto req = msg::request::make("service", {},
+                                          msg_vec({large}));
+            compression::compress(req);
+            compression::decompress(req);
+            auto parts = compression::compress_parts(
+                msg::send(msg::reply::make(std::move(req))));
+            auto received = msg::read(std::move(parts));
+            auto & rep = boost::get<msg::reply>(received);
+
+            // The flag is kept, so it must not be added a second time
+            AssertThat(rep.metadata(), HasLength(1));
+            AssertThat(compression::decompress(rep), Equals(true));
+            AssertThat(msg2str(rep.data()[0]), Equals(large));
+        });
+
+        it("throws on corrupt parts", [&](){
+            auto req = msg::request::make("service",
+                                          msg_vec({compression::flag}),
+                                          msg_vec({"\x7f" "garbage"}));
+
+            AssertThrows(msg::exception::malformed,
+                         compression::decompress(req));
+        });
+    });
+};
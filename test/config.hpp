@@ -0,0 +1,106 @@
+/*
+  Copyright 2017 Kaan Genç
+
+  This file is part of DagBox.
+
+  DagBox is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  DagBox is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with DagBox.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <sstream>
+#include "helpers.hpp"
+#include "../daemon/config.hpp"
+
+
+auto test_config = [](){
+    describe("server configuration", [](){
+        it("reads the topology", [&](){
+            std::stringstream input(
+                "[broker]\n"
+                "bind = tcp://127.0.0.1:5555 inproc://test\n"
+                "connect = inproc://test\n"
+                "worker_timeout = 2000\n"
+                "[storage]\n"
+                "directory = /tmp/dagbox\n"
+                "map_size = 1048576\n"
+                "notls = true\n"
+                "[workers]\n"
+                "readers = 4\n"
+                "locks = 0\n"
+                "batch_window = 5\n"
+                "[keys]\n"
+                "events = ulid\n"
+                "[indexes]\n"
+                "users = email address.city\n"
+                "[placement]\n"
+                "pin = true\n");
+            auto conf = dagboxd::read_config(input);
+
+            AssertThat(conf.broker_bind, HasLength(2));
+            AssertThat(conf.broker_bind[1], Equals("inproc://test"));
+            AssertThat(conf.worker_timeout.count(), Equals(2000));
+            AssertThat(conf.heartbeat.count(), Equals(1000));
+            AssertThat(conf.storage_directory, Equals("/tmp/dagbox"));
+            AssertThat(conf.map_size, Equals(1048576u));
+            AssertThat(conf.notls, Equals(true));
+            AssertThat(conf.read_staleness.count(), Equals(0));
+            AssertThat(conf.readers, Equals(4u));
+            AssertThat(conf.writers, Equals(1u));
+            AssertThat(conf.locks, Equals(0u));
+            AssertThat(conf.batch_window.count(), Equals(5));
+            AssertThat(conf.batch_bytes, Equals(0u));
+            AssertThat(conf.bucket_keys["events"], Equals("ulid"));
+            AssertThat(conf.bucket_indexes["users"], HasLength(2));
+            AssertThat(conf.bucket_indexes["users"][1], Equals("address.city"));
+            AssertThat(conf.pin, Equals(true));
+        });
+
+        it("requires a directory to run storage workers", [&](){
+            std::stringstream input("[workers]\nreaders = 1\n");
+
+            AssertThrows(dagboxd::exception::invalid_config,
+                         dagboxd::read_config(input));
+        });
+
+        it("rejects values of the wrong type", [&](){
+            std::stringstream input("[workers]\nlocks = many\n");
+
+            AssertThrows(dagboxd::exception::invalid_config,
+                         dagboxd::read_config(input));
+        });
+
+        it("rejects unknown key modes", [&](){
+            std::stringstream input(
+                "[storage]\n"
+                "directory = /tmp/dagbox\n"
+                "[keys]\n"
+                "events = random\n");
+
+            AssertThrows(dagboxd::exception::invalid_config,
+                         dagboxd::read_config(input));
+        });
+
+        it("rejects workers connecting to a missing inproc broker", [&](){
+            std::stringstream input(
+                "[broker]\n"
+                "bind =\n"
+                "[workers]\n"
+                "readers = 0\n"
+                "writers = 0\n");
+
+            AssertThrows(dagboxd::exception::invalid_config,
+                         dagboxd::read_config(input));
+        });
+    });
+};
@@ -18,6 +18,10 @@
  */
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <future>
+#include <thread>
 #include "helpers.hpp"
 #include "../src/worker/datastore.hpp"
 
@@ -67,6 +71,586 @@ auto test_datastore = [](){
                 AssertThat(read_reply.key, Equals(key));
                 AssertThat(*read_reply.data, Equals("test_data"));
             });
+
+            it("shares the buckets it opened", [&](){
+                AssertThat(bool(store.find_bucket("users")), Equals(true));
+                AssertThat(bool(store.find_bucket("missing")), Equals(false));
+
+                // Another worker uses the bucket without opening it
+                data::writer other(store);
+                data::detail::write_request wreq = {
+                    .bucket = "users",
+                    .data = "other",
+                };
+                auto write_msg = msg::read(other(msg::request::make(
+                                                     "datastore writer", {},
+                                                     msg_vec({dumps(wreq)}))));
+                AssertThat(boost::get<msg::reply>(write_msg).data(), HasLength(1));
+            });
+
+            it("can process requests in batches", [&](){
+                std::vector<msg::request> writes;
+                for (auto data : {"first", "second"}) {
+                    data::detail::write_request wreq = {
+                        .bucket = "users",
+                        .data = data,
+                    };
+                    writes.push_back(msg::request::make("datastore writer", {},
+                                                        msg_vec({dumps(wreq)})));
+                }
+                auto write_replies = writer(std::move(writes));
+                AssertThat(write_replies, HasLength(2));
+
+                std::vector<msg::request> reads;
+                for (auto & sent : write_replies) {
+                    auto write_msg = msg::read(std::move(sent));
+                    auto & write_reply = boost::get<msg::reply>(write_msg);
+                    data::detail::read_request rreq = {
+                        .bucket = "users",
+                        .key = loads<std::string>(write_reply.data()[0]),
+                        .data = boost::none,
+                        .relations = {},
+                    };
+                    reads.push_back(msg::request::make("datastore reader", {},
+                                                       msg_vec({dumps(rreq)})));
+                }
+                auto read_replies = reader(std::move(reads));
+                AssertThat(read_replies, HasLength(2));
+
+                auto first_msg = msg::read(std::move(read_replies[0]));
+                auto first = loads<data::detail::read_request>(
+                    boost::get<msg::reply>(first_msg).data()[0]);
+                AssertThat(*first.data, Equals("first"));
+                auto second_msg = msg::read(std::move(read_replies[1]));
+                auto second = loads<data::detail::read_request>(
+                    boost::get<msg::reply>(second_msg).data()[0]);
+                AssertThat(*second.data, Equals("second"));
+            });
+
+            it("replies with an error only to the requests of a batch that fail", [&](){
+                std::vector<msg::request> writes;
+                // Bucket names longer than the largest LMDB key can't
+                // be opened
+                for (auto bucket : {std::string("users"), std::string(1024, 'b')}) {
+                    data::detail::write_request wreq = {
+                        .bucket = bucket,
+                        .data = "data",
+                    };
+                    writes.push_back(msg::request::make("datastore writer", {},
+                                                        msg_vec({dumps(wreq)})));
+                }
+                auto write_replies = writer(std::move(writes));
+                AssertThat(write_replies, HasLength(2));
+
+                auto written = msg::read(std::move(write_replies[0]));
+                AssertThat(msg::is_error(boost::get<msg::reply>(written).metadata()), Equals(false));
+                auto failed = msg::read(std::move(write_replies[1]));
+                AssertThat(msg::is_error(boost::get<msg::reply>(failed).metadata()), Equals(true));
+            });
+
+            it("reads related keys", [&](){
+                auto write = [&](std::string const & bucket, std::string const & data) {
+                    data::detail::write_request wreq = {
+                        .bucket = bucket,
+                        .data = data,
+                    };
+                    auto write_msg = msg::read(writer(msg::request::make(
+                                                          "datastore writer", {},
+                                                          msg_vec({dumps(wreq)}))));
+                    return loads<std::string>(boost::get<msg::reply>(write_msg).data()[0]);
+                };
+                auto user = write("users", "author");
+                auto post = write("posts", "post");
+
+                auto node = [](std::string const & bucket, std::string const & key) {
+                    data::detail::read_request rreq = {
+                        .bucket = bucket,
+                        .key = key,
+                        .data = boost::none,
+                        .relations = {},
+                    };
+                    return rreq;
+                };
+                // The author is reached twice, once directly and once
+                // through the post
+                auto rreq = node("users", user);
+                auto related_post = node("posts", post);
+                related_post.relations["author"] = node("users", user);
+                rreq.relations["post"] = related_post;
+                rreq.relations["self"] = node("users", user);
+
+                auto read_msg = msg::read(reader(msg::request::make(
+                                                     "datastore reader", {},
+                                                     msg_vec({dumps(rreq)}))));
+                auto read = loads<data::detail::read_request>(
+                    boost::get<msg::reply>(read_msg).data()[0]);
+                AssertThat(*read.data, Equals("author"));
+                AssertThat(*read.relations["self"].data, Equals("author"));
+                AssertThat(*read.relations["post"].data, Equals("post"));
+                AssertThat(*read.relations["post"].relations["author"].data, Equals("author"));
+            });
+
+            it("keeps values with zero bytes", [&](){
+                std::string binary("zero\0bytes", 10);
+                data::detail::write_request wreq = {
+                    .bucket = "users",
+                    .data = binary,
+                };
+                auto write_msg = msg::read(writer(msg::request::make(
+                                                      "datastore writer", {},
+                                                      msg_vec({dumps(wreq)}))));
+                data::detail::read_request rreq = {
+                    .bucket = "users",
+                    .key = loads<std::string>(boost::get<msg::reply>(write_msg).data()[0]),
+                    .data = boost::none,
+                    .relations = {},
+                };
+                auto read_msg = msg::read(reader(msg::request::make(
+                                                     "datastore reader", {},
+                                                     msg_vec({dumps(rreq)}))));
+                auto read = loads<data::detail::read_request>(
+                    boost::get<msg::reply>(read_msg).data()[0]);
+                AssertThat(*read.data, Equals(binary));
+            });
+
+            it("writes and reads many keys at once", [&](){
+                data::detail::multi_put_request put;
+                put.records = {
+                    {.bucket = "users", .data = "many user"},
+                    {.bucket = "posts", .data = "many post"},
+                };
+                auto write_msg = msg::read(writer(msg::request::make(
+                                                      "datastore writer", {},
+                                                      msg_vec({dumps(put)}))));
+                auto keys = loads<std::vector<std::string>>(
+                    boost::get<msg::reply>(write_msg).data()[0]);
+                AssertThat(keys, HasLength(2));
+
+                data::detail::multi_get_request get;
+                get.keys = {
+                    {.bucket = "posts", .key = keys[1]},
+                    {.bucket = "users", .key = "missing"},
+                    {.bucket = "users", .key = keys[0]},
+                };
+                auto read_msg = msg::read(reader(msg::request::make(
+                                                     "datastore reader", {},
+                                                     msg_vec({dumps(get)}))));
+                auto read = loads<data::detail::multi_get_result>(
+                    boost::get<msg::reply>(read_msg).data()[0]);
+                AssertThat(read.values, HasLength(3));
+                AssertThat(*read.values[0], Equals("many post"));
+                AssertThat(bool(read.values[1]), Equals(false));
+                AssertThat(*read.values[2], Equals("many user"));
+            });
+
+            it("reads keys of missing buckets as empty", [&](){
+                data::detail::multi_get_request get;
+                get.keys = {
+                    {.bucket = "never written", .key = "key"},
+                    {.bucket = "users", .key = "missing"},
+                };
+                auto read_msg = msg::read(reader(msg::request::make(
+                                                     "datastore reader", {},
+                                                     msg_vec({dumps(get)}))));
+                auto & read_reply = boost::get<msg::reply>(read_msg);
+                AssertThat(msg::is_error(read_reply.metadata()), Equals(false));
+                auto read = loads<data::detail::multi_get_result>(read_reply.data()[0]);
+                AssertThat(read.values, HasLength(2));
+                AssertThat(bool(read.values[0]), Equals(false));
+                AssertThat(bool(read.values[1]), Equals(false));
+            });
+
+            it("generates ordered keys for configured buckets", [&](){
+                data::bucket_options ulid, sequence;
+                ulid.keys = data::key_mode::ulid;
+                sequence.keys = data::key_mode::sequence;
+                store.configure_bucket("events", ulid);
+                store.configure_bucket("counted", sequence);
+
+                auto write = [&](std::string const & bucket, std::string const & data) {
+                    data::detail::write_request wreq = {
+                        .bucket = bucket,
+                        .data = data,
+                    };
+                    auto write_msg = msg::read(writer(msg::request::make(
+                                                          "datastore writer", {},
+                                                          msg_vec({dumps(wreq)}))));
+                    auto & key = boost::get<msg::reply>(write_msg).data()[0];
+                    // Binary keys are replied with as bin, not str
+                    auto key_obj = msgpack::unpack(key.data<char>(), key.size());
+                    AssertThat(key_obj.get().type, Equals(msgpack::type::BIN));
+                    return key_obj.get().as<std::string>();
+                };
+                // Even within the same millisecond, the keys grow
+                auto first = write("events", "first");
+                auto second = write("events", "second");
+                AssertThat(first, HasLength(16));
+                AssertThat(second, HasLength(16));
+                AssertThat(first < second, Equals(true));
+
+                AssertThat(write("counted", "one"), Equals(std::string("\0\0\0\0\0\0\0\1", 8)));
+                AssertThat(write("counted", "two"), Equals(std::string("\0\0\0\0\0\0\0\2", 8)));
+
+                data::detail::read_request rreq = {
+                    .bucket = "events",
+                    .key = second,
+                    .data = boost::none,
+                    .relations = {},
+                };
+                auto read_msg = msg::read(reader(msg::request::make(
+                                                     "datastore reader", {},
+                                                     msg_vec({dumps(rreq)}))));
+                auto read = loads<data::detail::read_request>(
+                    boost::get<msg::reply>(read_msg).data()[0]);
+                AssertThat(*read.data, Equals("second"));
+            });
+
+            it("finds records by their indexed fields", [&](){
+                data::bucket_options options;
+                options.indexes = {"email", "address.city"};
+                store.configure_bucket("people", options);
+
+                auto person = [](std::string const & email, std::string const & city) {
+                    msgpack::sbuffer value;
+                    msgpack::packer<msgpack::sbuffer> packer(value);
+                    packer.pack_map(2);
+                    packer.pack(std::string("email"));
+                    packer.pack(email);
+                    packer.pack(std::string("address"));
+                    packer.pack_map(1);
+                    packer.pack(std::string("city"));
+                    packer.pack(city);
+                    return std::string(value.data(), value.size());
+                };
+                data::detail::multi_put_request put;
+                put.records = {
+                    {.bucket = "people", .data = person("ada@example.com", "London")},
+                    {.bucket = "people", .data = person("alan@example.com", "London")},
+                    {.bucket = "people", .data = person("kurt@example.com", "Vienna")},
+                    // Not a map, so it isn't indexed
+                    {.bucket = "people", .data = "unstructured"},
+                };
+                auto write_msg = msg::read(writer(msg::request::make(
+                                                      "datastore writer", {},
+                                                      msg_vec({dumps(put)}))));
+                auto keys = loads<std::vector<std::string>>(
+                    boost::get<msg::reply>(write_msg).data()[0]);
+
+                auto find = [&](std::string const & index, std::string const & value,
+                                uint32_t limit) {
+                    msgpack::zone zone;
+                    data::detail::index_request ireq = {
+                        .bucket = "people",
+                        .index = index,
+                        .value = msgpack::object(value, zone),
+                        .limit = limit,
+                    };
+                    auto read_msg = msg::read(reader(msg::request::make(
+                                                         "datastore reader", {},
+                                                         msg_vec({dumps(ireq)}))));
+                    return loads<data::detail::index_result>(
+                        boost::get<msg::reply>(read_msg).data()[0]).entries;
+                };
+
+                auto londoners = find("address.city", "London", 0);
+                AssertThat(londoners, HasLength(2));
+                std::sort(keys.begin(), keys.begin() + 2);
+                AssertThat(londoners[0].key, Equals(keys[0]));
+                AssertThat(londoners[1].key, Equals(keys[1]));
+                AssertThat(find("address.city", "London", 1), HasLength(1));
+
+                auto kurt = find("email", "kurt@example.com", 0);
+                AssertThat(kurt, HasLength(1));
+                AssertThat(kurt[0].key, Equals(keys[2]));
+                AssertThat(kurt[0].data, Equals(person("kurt@example.com", "Vienna")));
+                AssertThat(find("email", "nobody@example.com", 0), HasLength(0));
+            });
+
+            it("rejects records whose indexed field is too long", [&](){
+                data::bucket_options options;
+                options.indexes = {"email"};
+                store.configure_bucket("long_emails", options);
+
+                msgpack::sbuffer value;
+                msgpack::packer<msgpack::sbuffer> packer(value);
+                packer.pack_map(1);
+                packer.pack(std::string("email"));
+                packer.pack(std::string(1024, 'e'));
+                data::detail::write_request wreq = {
+                    .bucket = "long_emails",
+                    .data = std::string(value.data(), value.size()),
+                };
+                AssertThrows(data::exception::oversized_index,
+                             writer(msg::request::make("datastore writer", {},
+                                                       msg_vec({dumps(wreq)}))));
+                AssertThat(bool(store.find_bucket("long_emails")), Equals(false));
+            });
+
+            it("finds nothing in an index that was never written to", [&](){
+                data::bucket_options options;
+                options.indexes = {"email"};
+                store.configure_bucket("nobody", options);
+
+                msgpack::zone zone;
+                data::detail::index_request ireq = {
+                    .bucket = "nobody",
+                    .index = "email",
+                    .value = msgpack::object(std::string("ada@example.com"), zone),
+                    .limit = 0,
+                };
+                auto read_msg = msg::read(reader(msg::request::make(
+                                                     "datastore reader", {},
+                                                     msg_vec({dumps(ireq)}))));
+                auto & read_reply = boost::get<msg::reply>(read_msg);
+                AssertThat(msg::is_error(read_reply.metadata()), Equals(false));
+                AssertThat(loads<data::detail::index_result>(read_reply.data()[0]).entries,
+                           HasLength(0));
+            });
+
+            it("writes none of the records if one fails", [&](){
+                // Bucket names longer than the largest LMDB key can't
+                // be opened
+                data::detail::multi_put_request put;
+                put.records = {
+                    {.bucket = "atomic", .data = "written"},
+                    {.bucket = std::string(1024, 'b'), .data = "failed"},
+                };
+                AssertThrows(std::exception,
+                             writer(msg::request::make("datastore writer", {},
+                                                       msg_vec({dumps(put)}))));
+                AssertThat(bool(store.find_bucket("atomic")), Equals(false));
+            });
+
+            it("lets other workers open buckets after a failed write", [&](){
+                // The failed writes above had opened buckets
+                auto opened = std::async(std::launch::async, [&](){
+                        data::writer other(store);
+                        data::detail::write_request wreq = {
+                            .bucket = "after_failure",
+                            .data = "written",
+                        };
+                        other(msg::request::make("datastore writer", {},
+                                                 msg_vec({dumps(wreq)})));
+                    });
+                AssertThat(opened.wait_for(std::chrono::seconds{2}),
+                           Equals(std::future_status::ready));
+                AssertThat(bool(store.find_bucket("after_failure")), Equals(true));
+            });
+
+            it("opens buckets from writers on several threads", [&](){
+                // As the threads of a pool assistant do
+                std::vector<std::thread> threads;
+                std::atomic<int> failed(0);
+                for (auto i = 0; i < 4; ++i) {
+                    threads.emplace_back([&, i](){
+                        data::writer own(store);
+                        for (auto j = 0; j < 2; ++j) {
+                            data::detail::write_request wreq = {
+                                .bucket = "threaded_" + std::to_string(i * 2 + j),
+                                .data = "written",
+                            };
+                            auto written = msg::read(own(msg::request::make(
+                                                             "datastore writer", {},
+                                                             msg_vec({dumps(wreq)}))));
+                            if (msg::is_error(boost::get<msg::reply>(written).metadata())) {
+                                ++failed;
+                            }
+                        }
+                    });
+                }
+                for (auto & t : threads) {
+                    t.join();
+                }
+                AssertThat(failed.load(), Equals(0));
+                for (auto i = 0; i < 8; ++i) {
+                    AssertThat(bool(store.find_bucket("threaded_" + std::to_string(i))),
+                               Equals(true));
+                }
+            });
+        });
+
+        describe("scanner", [](){
+            auto testdir = filesystem::temp_directory_path() / filesystem::unique_path("DagBox-test-%%%%-%%%%-%%%%-%%%%");
+            filesystem::create_directory(testdir);
+
+            data::storage store(testdir);
+            data::writer writer(store);
+            data::scanner scanner(store);
+
+            std::vector<std::string> keys;
+            for (auto i = 0; i < 5; ++i) {
+                data::detail::write_request wreq = {
+                    .bucket = "scanned",
+                    .data = "record " + std::to_string(i),
+                };
+                auto write_msg = msg::read(writer(msg::request::make(
+                                                      "datastore writer", {},
+                                                      msg_vec({dumps(wreq)}))));
+                keys.push_back(loads<std::string>(boost::get<msg::reply>(write_msg).data()[0]));
+            }
+            std::sort(keys.begin(), keys.end());
+
+            auto scan = [&](data::detail::scan_request const & sreq) {
+                auto scan_msg = msg::read(scanner(msg::request::make(
+                                                      "datastore scanner", {},
+                                                      msg_vec({dumps(sreq)}))));
+                auto & reply = boost::get<msg::reply>(scan_msg);
+                AssertThat(reply.data(), HasLength(1));
+                return loads<data::detail::scan_result>(reply.data()[0]);
+            };
+
+            it("reads a range in key order, in pages", [&](){
+                data::detail::scan_request sreq = {
+                    .bucket = "scanned",
+                    .start = "",
+                    .end = boost::none,
+                    .prefix = boost::none,
+                    .limit = 2,
+                    .resume = boost::none,
+                };
+                std::vector<std::string> scanned;
+                for (auto page = 0; page < 3; ++page) {
+                    auto result = scan(sreq);
+                    for (auto & entry : result.entries) {
+                        scanned.push_back(entry.key);
+                    }
+                    sreq.resume = result.resume;
+                }
+                AssertThat(bool(sreq.resume), Equals(false));
+                AssertThat(scanned, Equals(keys));
+            });
+
+            it("stops at the end of the range", [&](){
+                data::detail::scan_request sreq = {
+                    .bucket = "scanned",
+                    .start = keys[1],
+                    .end = keys[3],
+                    .prefix = boost::none,
+                    .limit = 0,
+                    .resume = boost::none,
+                };
+                auto result = scan(sreq);
+                AssertThat(result.entries, HasLength(2));
+                AssertThat(result.entries[0].key, Equals(keys[1]));
+                AssertThat(result.entries[1].key, Equals(keys[2]));
+            });
+
+            it("reads only the keys with a prefix", [&](){
+                auto prefix = keys[2].substr(0, 1);
+                data::detail::scan_request sreq = {
+                    .bucket = "scanned",
+                    .start = "",
+                    .end = boost::none,
+                    .prefix = prefix,
+                    .limit = 0,
+                    .resume = boost::none,
+                };
+                auto result = scan(sreq);
+                auto expected = std::count_if(keys.begin(), keys.end(),
+                                              [&](std::string const & key) {
+                                                  return key.compare(0, 1, prefix) == 0;
+                                              });
+                AssertThat(result.entries.size(), Equals(std::size_t(expected)));
+                for (auto & entry : result.entries) {
+                    AssertThat(entry.key.substr(0, 1), Equals(prefix));
+                }
+            });
+
+            it("finds nothing in a bucket that doesn't exist yet", [&](){
+                data::detail::scan_request sreq = {
+                    .bucket = "never written",
+                    .start = "",
+                    .end = boost::none,
+                    .prefix = boost::none,
+                    .limit = 0,
+                    .resume = boost::none,
+                };
+                auto scan_msg = msg::read(scanner(msg::request::make(
+                                                      "datastore scanner", {},
+                                                      msg_vec({dumps(sreq)}))));
+                auto & reply = boost::get<msg::reply>(scan_msg);
+                AssertThat(msg::is_error(reply.metadata()), Equals(false));
+                auto result = loads<data::detail::scan_result>(reply.data()[0]);
+                AssertThat(result.entries, HasLength(0));
+                AssertThat(bool(result.resume), Equals(false));
+            });
+        });
+
+        describe("reader reusing its transaction", [](){
+            auto testdir = filesystem::temp_directory_path() / filesystem::unique_path("DagBox-test-%%%%-%%%%-%%%%-%%%%");
+            filesystem::create_directory(testdir);
+
+            data::storage store(testdir, 0, MDB_NOTLS);
+            data::writer writer(store);
+
+            auto write = [&](std::string const & data) {
+                data::detail::write_request wreq = {
+                    .bucket = "users",
+                    .data = data,
+                };
+                auto write_msg = msg::read(writer(msg::request::make(
+                                                      "datastore writer", {},
+                                                      msg_vec({dumps(wreq)}))));
+                return loads<std::string>(boost::get<msg::reply>(write_msg).data()[0]);
+            };
+
+            auto read = [&](data::reader & reader, std::string const & key) {
+                data::detail::read_request rreq = {
+                    .bucket = "users",
+                    .key = key,
+                    .data = boost::none,
+                    .relations = {},
+                };
+                auto read_msg = msg::read(reader(msg::request::make(
+                                                     "datastore reader", {},
+                                                     msg_vec({dumps(rreq)}))));
+                auto reply = loads<data::detail::read_request>(
+                    boost::get<msg::reply>(read_msg).data()[0]);
+                return *reply.data;
+            };
+
+            it("sees writes made between requests", [&](){
+                data::reader reader(store);
+                AssertThat(read(reader, write("first")), Equals("first"));
+                AssertThat(read(reader, write("second")), Equals("second"));
+            });
+
+            it("takes a new snapshot once the old one is stale", [&](){
+                data::reader reader(store, std::chrono::milliseconds{20});
+                AssertThat(read(reader, write("first")), Equals("first"));
+                auto key = write("second");
+                std::this_thread::sleep_for(std::chrono::milliseconds{30});
+                AssertThat(read(reader, key), Equals("second"));
+            });
+
+            // Readers that hold a snapshot, reset transactions are
+            // listed without a transaction ID
+            auto live_snapshots = [&](){
+                int count = 0;
+                mdb_reader_list(store.handle(), [](char const * line, void * ctx) -> int {
+                        std::string text(line);
+                        if (text.find("txnid") == std::string::npos
+                            && text.find("no active readers") == std::string::npos
+                            && text.find(" -") == std::string::npos) {
+                            ++*static_cast<int *>(ctx);
+                        }
+                        return 0;
+                    }, &count);
+                return count;
+            };
+
+            it("lets go of a stale snapshot while idle", [&](){
+                data::reader reader(store, std::chrono::milliseconds{20});
+                AssertThat(reader.idle_interval().count(), Equals(20));
+                AssertThat(read(reader, write("first")), Equals("first"));
+                reader.idle();
+                AssertThat(live_snapshots(), Equals(1));
+
+                std::this_thread::sleep_for(std::chrono::milliseconds{30});
+                reader.idle();
+                AssertThat(live_snapshots(), Equals(0));
+                AssertThat(read(reader, write("second")), Equals("second"));
+            });
         });
     });
 };
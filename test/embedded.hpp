@@ -0,0 +1,135 @@
+/*
+  Copyright 2017 Kaan Genç
+
+  This file is part of DagBox.
+
+  DagBox is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  DagBox is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with DagBox.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <thread>
+#include "helpers.hpp"
+#include "../src/embedded.hpp"
+#include "../src/worker/lock.hpp"
+
+
+// A worker that sends the request back instead of replying
+struct test_embedded_echo
+{
+    std::string const service_name = "test embedded echo";
+    auto operator()(msg::request && req) -> std::vector<zmq::message_t> {
+        return msg::send(req);
+    }
+};
+
+
+// A worker that replies with the number of requests it has processed
+struct test_embedded_counter
+{
+    std::string const service_name = "test embedded counter";
+    int count = 0;
+    auto operator()(msg::request && req) -> std::vector<zmq::message_t> {
+        ++count;
+        req.data() = msg_vec({dumps(count)});
+        return msg::send(msg::reply::make(std::move(req)));
+    }
+};
+
+
+// A worker that processes data parts without the request being framed
+struct test_embedded_process
+{
+    std::string const service_name = "test embedded process";
+    int framed = 0;
+    auto process(msg::many_parts && data_parts) -> msg::many_parts {
+        return std::move(data_parts);
+    }
+    auto operator()(msg::request && req) -> std::vector<zmq::message_t> {
+        ++framed;
+        req.data() = msg_vec({dumps(framed)});
+        return msg::send(msg::reply::make(std::move(req)));
+    }
+};
+
+
+auto test_embedded = [](){
+    describe("embedded dispatcher", [](){
+        embedded::dispatcher db;
+        db.add<lock::lock>(1);
+        db.add<test_embedded_echo>(1);
+        db.add<test_embedded_counter>(2);
+        db.add<test_embedded_process>(2);
+
+        it("calls workers directly", [&](){
+            lock::detail::lock_request lreq = {
+                .key = "test_key",
+                .lock = true,
+            };
+
+            auto first = db.call("lock", msg_vec({dumps(lreq)}));
+            AssertThat(first, HasLength(1));
+            AssertThat(loads<bool>(first[0]), Equals(true));
+
+            auto second = db.call("lock", msg_vec({dumps(lreq)}));
+            AssertThat(loads<bool>(second[0]), Equals(false));
+        });
+
+        it("keeps the metadata of requests", [&](){
+            auto reply = db.call(msg::request::make("test embedded counter",
+                                                    msg_vec({"meta"}),
+                                                    msg_vec({"data"})));
+            AssertThat(reply.metadata(), HasLength(1));
+            AssertThat(msg2str(reply.metadata()[0]), Equals("meta"));
+        });
+
+        it("skips framing for workers that process data parts", [&](){
+            auto reply = db.call("test embedded process", msg_vec({"data"}));
+            AssertThat(reply, HasLength(1));
+            AssertThat(msg2str(reply[0]), Equals("data"));
+        });
+
+        it("rejects extra instances of workers that keep a state", [&](){
+            embedded::dispatcher other;
+            AssertThrows(embedded::exception::single_instance,
+                         other.add<lock::lock>(2));
+            AssertThrows(embedded::exception::single_instance,
+                         db.add<lock::lock>(1));
+        });
+
+        it("rejects unknown services", [&](){
+            AssertThat(db.provides("missing"), Equals(false));
+            AssertThrows(embedded::exception::unknown_service,
+                         db.call("missing", msg_vec({"data"})));
+        });
+
+        it("rejects workers that don't reply", [&](){
+            AssertThrows(embedded::exception::unexpected_reply,
+                         db.call("test embedded echo", msg_vec({"data"})));
+        });
+
+        it("can be called from several threads", [&](){
+            std::vector<std::thread> threads;
+            for (auto i = 0; i < 4; ++i) {
+                threads.emplace_back([&](){
+                        for (auto j = 0; j < 100; ++j) {
+                            db.call("test embedded counter", msg_vec({"data"}));
+                        }
+                    });
+            }
+            for (auto & thread : threads) {
+                thread.join();
+            }
+        });
+    });
+};
@@ -26,47 +26,4 @@
 using namespace bandit;
 using namespace snowhouse;
 
-#include <zmq.hpp>
-#include <msgpack.hpp>
-
-
-
-auto msg2str(zmq::message_t const & msg) -> std::string
-{
-    return std::string(msg.data<char>(), msg.size());
-}
-
-
-auto msg_vec(std::initializer_list<std::string> msgs)
-    -> std::vector<zmq::message_t>
-{
-    std::vector<zmq::message_t> vec;
-    for (auto msg : msgs) {
-        if (msg.size() == 0) {
-            vec.push_back(zmq::message_t());
-        } else {
-            vec.push_back(zmq::message_t(msg.data(), msg.size()));
-        }
-    }
-    return vec;
-}
-
-
-// Turn an object to a string using msgpack
-template <class T>
-auto dumps(T t) -> std::string
-{
-    std::stringstream s;
-    msgpack::pack(s, t);
-    return s.str();
-}
-
-
-template <class T, class S>
-auto loads(S & str_like) -> T
-{
-    msgpack::object_handle h = msgpack::unpack(
-        static_cast<char *>(str_like.data()),
-        str_like.size());
-    return h.get().as<T>();
-}
+#include "message_helpers.hpp"
@@ -0,0 +1,89 @@
+/*
+  Copyright 2017 Kaan Genç
+
+  This file is part of DagBox.
+
+  DagBox is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  DagBox is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with DagBox.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include "helpers.hpp"
+#include "../src/ingest.hpp"
+#include "../src/broker.hpp"
+#include "../src/assistant.hpp"
+#include "../src/worker/datastore.hpp"
+
+
+auto test_ingest = [](){
+    describe("ingest", [](){
+        auto testdir = filesystem::temp_directory_path() / filesystem::unique_path("DagBox-test-%%%%-%%%%-%%%%-%%%%");
+        filesystem::create_directory(testdir);
+        data::storage store(testdir);
+
+        zmq::context_t ctx;
+        std::string addr = "inproc://test_ingest";
+        component<broker> broker_component(ctx, addr, std::chrono::milliseconds{1000});
+        component<assistant<data::writer>> writer_component(ctx, addr, 500, std::ref(store));
+
+        dagbox::client c(ctx, addr, std::chrono::milliseconds{5000}, 0);
+
+        it("acknowledges every record in order", [&](){
+            std::vector<std::string> keys;
+            std::vector<std::string> written;
+            {
+                dagbox::ingest load(c, "datastore writer", 16, 4,
+                                    [&](msg::many_parts && parts) {
+                                        for (auto & p : parts) {
+                                            keys.push_back(loads<std::string>(p));
+                                        }
+                                    });
+                for (auto i = 0; i < 103; ++i) {
+                    data::detail::write_request wreq = {
+                        .bucket = "ingest",
+                        .data = "record " + std::to_string(i),
+                    };
+                    written.push_back(wreq.data);
+                    load.add(std::move(msg_vec({dumps(wreq)})[0]));
+                }
+                load.finish();
+                AssertThat(load.acknowledged(), Equals<std::size_t>(103));
+            }
+            AssertThat(keys, HasLength(103));
+
+            // Each key belongs to the record at the same position
+            data::reader reader(store);
+            for (auto i : {0, 50, 102}) {
+                data::detail::read_request rreq = {
+                    .bucket = "ingest",
+                    .key = keys[i],
+                    .data = boost::none,
+                    .relations = {},
+                };
+                auto read_msg = msg::read(reader(msg::request::make(
+                                                     "datastore reader", {},
+                                                     msg_vec({dumps(rreq)}))));
+                auto & reply = boost::get<msg::reply>(read_msg);
+                auto read = loads<data::detail::read_request>(reply.data()[0]);
+                AssertThat(*read.data, Equals(written[i]));
+            }
+        });
+
+        it("reports chunks that fail", [&](){
+            dagbox::client impatient(ctx, addr, std::chrono::milliseconds{20}, 0);
+            dagbox::ingest load(impatient, "test ingest missing", 4, 2);
+            load.add(std::move(msg_vec({"record"})[0]));
+            AssertThrows(dagbox::exception::timeout, load.finish());
+        });
+    });
+};
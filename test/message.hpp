@@ -19,6 +19,7 @@
 #pragma once
 
 #include "helpers.hpp"
+#include "../src/buffer.hpp"
 #include "../src/message.hpp"
 
 
@@ -178,6 +179,29 @@ auto test_message = [](){
             auto recv_msg = msg::read(msg::send(msg::registration::make("file")));
             auto & message = boost::get<msg::registration>(recv_msg);
             AssertThat(message.service(), Equals("file"));
+            AssertThat(message.concurrency(), Equals<uint32_t>(1));
+        });
+        it("can carry a concurrency", [](){
+            auto send = msg::send(msg::registration::make("file", 8));
+            AssertThat(send, HasLength(5));
+
+            auto recv_msg = msg::read(std::move(send));
+            auto & message = boost::get<msg::registration>(recv_msg);
+            AssertThat(message.service(), Equals("file"));
+            AssertThat(message.concurrency(), Equals<uint32_t>(8));
+        });
+        it("can carry several services", [](){
+            auto send = msg::send(msg::registration::make(
+                                      std::vector<std::string>{"file", "lock"}));
+            // The concurrency is sent even though it is the default
+            AssertThat(send, HasLength(6));
+
+            auto recv_msg = msg::read(std::move(send));
+            auto & message = boost::get<msg::registration>(recv_msg);
+            AssertThat(message.service(), Equals("file"));
+            AssertThat(message.services(), HasLength(2));
+            AssertThat(message.services()[1], Equals("lock"));
+            AssertThat(message.concurrency(), Equals<uint32_t>(1));
         });
     });
 
@@ -219,6 +243,44 @@ auto test_message = [](){
         });
     });
 
+    describe("partial reply messages", [](){
+        it("share the metadata of the request", [](){
+            auto req = msg::request::make("service",
+                                          msg_vec({"meta"}),
+                                          msg_vec({"data"}));
+            auto part = msg::partial::make(req, msg_vec({"chunk"}));
+
+            AssertThat(msg2str(part.metadata()[0]), Equals("meta"));
+            AssertThat(msg2str(part.data()[0]), Equals("chunk"));
+            // The request can still be turned into the final reply
+            AssertThat(msg2str(req.metadata()[0]), Equals("meta"));
+        });
+        it("can be sent and received", [](){
+            auto req = msg::request::make("service",
+                                          msg_vec({"meta"}),
+                                          msg_vec({"data"}));
+            auto send = msg::send(msg::partial::make(req, msg_vec({"chunk"})));
+            AssertThat((uint)*send[2].data<uint8_t>(), Equals<uint>(0x07));
+
+            auto received = msg::read(std::move(send));
+            auto & message = boost::get<msg::partial>(received);
+            AssertThat(msg2str(message.data()[0]), Equals("chunk"));
+        });
+    });
+
+    describe("credit messages", [](){
+        it("can be sent and received", [](){
+            auto send = msg::send(msg::credit::make("stream", 300));
+            AssertThat(send, HasLength(5));
+            AssertThat((uint)*send[2].data<uint8_t>(), Equals<uint>(0x08));
+
+            auto received = msg::read(std::move(send));
+            auto & message = boost::get<msg::credit>(received);
+            AssertThat(message.stream(), Equals("stream"));
+            AssertThat(message.amount(), Equals<uint32_t>(300));
+        });
+    });
+
     describe("request messages", [](){
         it("can be created", [](){
             auto req = msg::request::make("service",
@@ -263,4 +325,42 @@ auto test_message = [](){
             AssertThat(msg2str(rep.metadata()[0]), Equals("meta"));
         });
     });
+
+    describe("error replies", [](){
+        it("carry the description of the failure", [](){
+            auto req = msg::request::make("service", msg_vec({"meta"}), msg_vec({"data"}));
+            auto rep = msg::read(msg::send(msg::make_error_reply(std::move(req), "failed")));
+            auto & error = boost::get<msg::reply>(rep);
+            AssertThat(msg::is_error(error.metadata()), Equals(true));
+            AssertThat(error.data(), HasLength(1));
+            AssertThat(msg2str(error.data()[0]), Equals("failed"));
+        });
+
+        it("aren't confused with other replies", [](){
+            auto req = msg::request::make("service", msg_vec({"meta"}), msg_vec({"data"}));
+            auto rep = msg::reply::make(std::move(req));
+            AssertThat(msg::is_error(rep.metadata()), Equals(false));
+        });
+    });
+
+    describe("message buffers", [](){
+        it("become message parts", [](){
+            msg::buffer buffer;
+            msgpack::pack(buffer, std::string(1000, 'x'));
+            auto size = buffer.size();
+            auto part = buffer.release();
+            AssertThat(part.size(), Equals(size));
+            AssertThat(loads<std::string>(part), Equals(std::string(1000, 'x')));
+            AssertThat(buffer.size(), Equals(0u));
+        });
+
+        it("can be used again after being released", [](){
+            msg::buffer buffer;
+            msgpack::pack(buffer, 1);
+            buffer.release();
+            msgpack::pack(buffer, 2);
+            auto part = buffer.release();
+            AssertThat(loads<int>(part), Equals(2));
+        });
+    });
 };
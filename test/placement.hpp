@@ -0,0 +1,133 @@
+/*
+  Copyright 2017 Kaan Genç
+
+  This file is part of DagBox.
+
+  DagBox is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  DagBox is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with DagBox.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <atomic>
+#include <pthread.h>
+#include "helpers.hpp"
+#include "../src/helpers.hpp"
+#include "../src/placement.hpp"
+
+
+// A component that records the name of the thread it was created on
+class test_named_component
+{
+public:
+    test_named_component(std::string & name)
+    {
+        char buffer[16] = {};
+        pthread_getname_np(pthread_self(), buffer, sizeof(buffer));
+        name = buffer;
+    }
+    auto attach(reactor &) -> void {}
+};
+
+
+// A component that counts how many instances were created
+class test_counted_component
+{
+public:
+    test_counted_component(std::atomic<int> & count) { ++count; }
+    auto attach(reactor &) -> void {}
+};
+
+
+// A component that takes a while to finish its work
+class test_slow_drain_component
+{
+public:
+    auto attach(reactor &) -> void {}
+    auto drain() -> void {
+        std::this_thread::sleep_for(std::chrono::milliseconds{100});
+    }
+};
+
+
+auto test_placement = [](){
+    describe("placement", [](){
+        it("names the threads of components", [&](){
+            std::string name;
+            placement::thread_placement where;
+            where.name = "test-thread";
+            {
+                component<test_named_component> c(placed, where, std::ref(name));
+            }
+
+            AssertThat(name, Equals("test-thread"));
+        });
+
+        it("pins threads to allowed CPUs", [&](){
+            auto cpus = placement::allowed_cpus();
+            AssertThat(cpus.empty(), Equals(false));
+            placement::thread_placement where;
+            where.cpus = {cpus.back()};
+
+            std::thread pinned([&](){
+                    placement::apply(where);
+                    AssertThat(placement::allowed_cpus(), Equals(where.cpus));
+                });
+            pinned.join();
+        });
+
+        it("rejects CPUs that are out of range", [&](){
+            placement::thread_placement where;
+            where.cpus = {-1};
+
+            AssertThrows(placement::exception::invalid,
+                         component<test_named_component>(placed, where, std::ref(where.name)));
+        });
+
+        it("isolates the broker from the workers", [&](){
+            auto layout = placement::isolate_broker(3, "reader");
+
+            AssertThat(layout.workers.size(), Equals(3u));
+            AssertThat(layout.workers[2].name, Equals("reader-2"));
+            auto cpus = placement::allowed_cpus();
+            if (!cpus.empty()) {
+                // Away from the CPUs that handle interrupts
+                AssertThat(layout.broker.cpus, Equals(std::vector<int>{cpus.back()}));
+            }
+            if (cpus.size() > 1) {
+                for (auto & worker : layout.workers) {
+                    AssertThat(worker.cpus == layout.broker.cpus, Equals(false));
+                }
+            }
+        });
+
+        it("runs one instance for each placement", [&](){
+            std::atomic<int> count(0);
+            {
+                component_pool<test_counted_component> pool(4, std::ref(count));
+                AssertThat(pool.size(), Equals(4u));
+            }
+
+            AssertThat(count.load(), Equals(4));
+        });
+
+        it("drains the instances of a pool at the same time", [&](){
+            auto start = detail_time::time_now();
+            {
+                component_pool<test_slow_drain_component> pool(4);
+            }
+            auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                detail_time::time_now() - start);
+            AssertThat(elapsed.count(), IsLessThan(300));
+        });
+    });
+};
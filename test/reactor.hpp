@@ -0,0 +1,133 @@
+/*
+  Copyright 2017 Kaan Genç
+
+  This file is part of DagBox.
+
+  DagBox is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  DagBox is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with DagBox.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <thread>
+#include "helpers.hpp"
+#include "../src/helpers.hpp"
+#include "../src/reactor.hpp"
+#include "../src/heartbeat.hpp"
+#include "../src/socket.hpp"
+
+
+auto test_reactor = [](){
+    describe("reactor", [](){
+        zmq::context_t ctx;
+
+        it("handles messages on sockets", [&](){
+            reactor loop;
+            class socket server(ctx, zmq::socket_type::pair);
+            class socket client(ctx, zmq::socket_type::pair);
+            server.bind("inproc://test-reactor");
+            client.connect("inproc://test-reactor");
+
+            std::string received;
+            loop.add_socket(server, [&](){
+                    auto msgs = server.recv_multimsg(ZMQ_DONTWAIT);
+                    received = msg2str(msgs[0]);
+                });
+            client.send_multimsg(msg_vec({"hello"}));
+            loop.run_once(std::chrono::milliseconds{1000});
+
+            AssertThat(received, Equals("hello"));
+        });
+
+        it("runs timers", [&](){
+            reactor loop;
+            int count = 0;
+            loop.add_timer(std::chrono::milliseconds{1}, [&](){
+                    ++count;
+                    if (count == 3) {
+                        loop.stop();
+                    }
+                });
+            loop.run();
+
+            AssertThat(count, Equals(3));
+        });
+
+        it("doesn't run cancelled timers", [&](){
+            reactor loop;
+            bool called = false;
+            auto id = loop.add_timer(std::chrono::milliseconds{1}, [&](){
+                    called = true;
+                });
+            loop.cancel_timer(id);
+            loop.run_once(std::chrono::milliseconds{5});
+
+            AssertThat(called, Equals(false));
+        });
+
+        it("restarts cancelled timers that are reset", [&](){
+            reactor loop;
+            int count = 0;
+            auto id = loop.add_timer(std::chrono::milliseconds{1000}, [&](){
+                    ++count;
+                });
+            loop.cancel_timer(id);
+            loop.reset_timer(id, std::chrono::milliseconds{0});
+            loop.run_once(std::chrono::milliseconds{5});
+
+            AssertThat(count, Equals(1));
+        });
+
+        it("can postpone a timer once", [&](){
+            reactor loop;
+            int count = 0;
+            auto id = loop.add_timer(std::chrono::milliseconds{1}, [&](){
+                    ++count;
+                });
+            loop.reset_timer(id, std::chrono::milliseconds{1000});
+            loop.run_once(std::chrono::milliseconds{5});
+
+            AssertThat(count, Equals(0));
+        });
+
+        it("skips heartbeats while messages are being sent", [&](){
+            reactor loop;
+            heartbeat beat(std::chrono::milliseconds{20});
+            int pings = 0;
+            beat.attach(loop, [&](){ ++pings; });
+            auto until = detail_time::time_now() + std::chrono::milliseconds{60};
+            while (detail_time::time_now() < until) {
+                beat.sent();
+                loop.run_once(std::chrono::milliseconds{1});
+            }
+            AssertThat(pings, Equals(0));
+
+            until = detail_time::time_now() + std::chrono::milliseconds{60};
+            while (detail_time::time_now() < until) {
+                loop.run_once(std::chrono::milliseconds{5});
+            }
+            AssertThat(pings, IsGreaterThan(0));
+        });
+
+        it("stops immediately when stopped from another thread", [&](){
+            reactor loop;
+            auto start = detail_time::time_now();
+            std::thread runner([&](){ loop.run(); });
+            std::this_thread::sleep_for(std::chrono::milliseconds{10});
+            loop.stop();
+            runner.join();
+            auto elapsed = detail_time::time_now() - start;
+
+            AssertThat(elapsed < std::chrono::milliseconds{500}, Equals(true));
+        });
+    });
+};
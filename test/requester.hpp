@@ -0,0 +1,99 @@
+/*
+  Copyright 2017 Kaan Genç
+
+  This file is part of DagBox.
+
+  DagBox is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  DagBox is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with DagBox.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <thread>
+#include "helpers.hpp"
+#include "../src/requester.hpp"
+
+
+auto test_requester = [](){
+    describe("requester", [](){
+        std::vector<msg::part_source> sent;
+        std::vector<msg::reply> replied;
+        requester req([&](msg::part_source && parts) {
+                sent.push_back(std::move(parts));
+            },
+            [&](msg::reply && reply) {
+                replied.push_back(std::move(reply));
+            });
+
+        it("replaces request IDs in metadata", [&](){
+            auto metadata = msg_vec({"meta"});
+            msg::set_request_id(metadata, 1);
+            msg::set_request_id(metadata, 2);
+
+            AssertThat(metadata, HasLength(2));
+            AssertThat(msg2str(metadata[0]), Equals("meta"));
+            AssertThat(*msg::find_request_id(metadata), Equals<uint64_t>(2));
+            AssertThat(bool(msg::find_request_id(msg_vec({"meta"}))), IsFalse());
+        });
+
+        it("matches replies to their requests", [&](){
+            std::vector<std::string> results;
+            for (auto data : {"first", "second"}) {
+                req.send(msg::request::make("service", {}, msg_vec({data})),
+                         [&](msg::reply && reply) {
+                             results.push_back(msg2str(reply.data()[0]));
+                         });
+            }
+            AssertThat(sent, HasLength(2));
+            AssertThat(req.pending(), Equals<std::size_t>(2));
+
+            // Answer the requests out of order
+            for (auto i : {1, 0}) {
+                auto received = msg::read(std::move(sent[i]));
+                auto & request = boost::get<msg::request>(received);
+                AssertThat(req.resolve(msg::reply::make(std::move(request))),
+                           Equals(true));
+            }
+            AssertThat(results, Equals(std::vector<std::string>({"second", "first"})));
+            AssertThat(req.pending(), Equals<std::size_t>(0));
+        });
+
+        it("ignores replies to unknown requests", [&](){
+            auto request = msg::request::make("service", {}, msg_vec({"data"}));
+            AssertThat(req.resolve(msg::reply::make(std::move(request))), Equals(false));
+        });
+
+        it("answers requests that expire with an error", [&](){
+            requester impatient([&](msg::part_source &&) {},
+                                [&](msg::reply &&) {},
+                                std::chrono::milliseconds{10});
+            std::vector<bool> errors;
+            impatient.send(msg::request::make("service", {}, msg_vec({"data"})),
+                           [&](msg::reply && reply) {
+                               errors.push_back(msg::is_error(reply.metadata()));
+                           });
+            impatient.expire();
+            AssertThat(errors, HasLength(0));
+
+            std::this_thread::sleep_for(std::chrono::milliseconds{20});
+            impatient.expire();
+            AssertThat(errors, Equals(std::vector<bool>({true})));
+            AssertThat(impatient.pending(), Equals<std::size_t>(0));
+        });
+
+        it("sends the replies of the worker", [&](){
+            auto request = msg::request::make("service", {}, msg_vec({"data"}));
+            req.reply(msg::reply::make(std::move(request)));
+            AssertThat(replied, HasLength(1));
+        });
+    });
+};
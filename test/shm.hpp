@@ -0,0 +1,120 @@
+/*
+  Copyright 2017 Kaan Genç
+
+  This file is part of DagBox.
+
+  DagBox is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  DagBox is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with DagBox.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <cstring>
+#include <limits>
+#include "helpers.hpp"
+#include "../src/shm.hpp"
+
+
+auto test_shm = [](){
+    describe("shared memory", [](){
+        std::size_t const slot_size = 4096;
+        std::string large(3 * slot_size, 'x');
+
+        it("moves large data parts through the ring", [&](){
+            shm::ring ring(16 * slot_size, slot_size);
+            shm::importer importer;
+
+            auto req = msg::request::make("service", {},
+                                          msg_vec({"small", large}));
+            ring.export_parts(req, slot_size);
+
+            AssertThat(msg2str(req.metadata()[0]), Equals(shm::flag));
+            // Only a descriptor is left of the large part
+            AssertThat(req.data()[1].size(), IsLessThan<unsigned int>(slot_size));
+
+            auto received = msg::read(msg::send(std::move(req)));
+            auto & message = boost::get<msg::request>(received);
+            AssertThat(importer.import_parts(message), Equals(true));
+            AssertThat(msg2str(message.data()[0]), Equals("small"));
+            AssertThat(msg2str(message.data()[1]), Equals(large));
+        });
+
+        it("releases slots once the imported parts are destroyed", [&](){
+            shm::ring ring(16 * slot_size, slot_size);
+            shm::importer importer;
+
+            {
+                auto req = msg::request::make("service", {},
+                                              msg_vec({large}));
+                ring.export_parts(req, slot_size);
+                AssertThat(ring.free_slots(), Equals<unsigned int>(13));
+                importer.import_parts(req);
+                AssertThat(ring.free_slots(), Equals<unsigned int>(13));
+            }
+            AssertThat(ring.free_slots(), Equals<unsigned int>(16));
+        });
+
+        it("exports parts allocated in the ring without copying", [&](){
+            shm::ring ring(16 * slot_size, slot_size);
+            shm::importer importer;
+
+            auto part = ring.allocate(large.size());
+            AssertThat(bool(part), Equals(true));
+            std::memcpy(part->data(), large.data(), large.size());
+            msg::many_parts data;
+            data.push_back(std::move(*part));
+            auto req = msg::request::make("service", {}, std::move(data));
+
+            ring.export_parts(req, slot_size);
+            AssertThat(ring.free_slots(), Equals<unsigned int>(13));
+            importer.import_parts(req);
+            AssertThat(msg2str(req.data()[0]), Equals(large));
+        });
+
+        it("rejects descriptors outside of the ring", [&](){
+            shm::ring ring(16 * slot_size, slot_size);
+            shm::importer importer;
+
+            auto tampered = [&](uint64_t offset, uint64_t size) {
+                auto req = msg::request::make("service", {},
+                                              msg_vec({large}));
+                ring.export_parts(req, slot_size);
+                shm::detail::descriptor desc;
+                std::memcpy(&desc, req.data()[0].data<char>() + 1, sizeof(desc));
+                desc.offset = offset;
+                desc.size = size;
+                std::memcpy(req.data()[0].data<char>() + 1, &desc, sizeof(desc));
+                return req;
+            };
+
+            // The end of the part wraps around
+            auto wrapping = tampered(std::numeric_limits<uint64_t>::max() - 10, 100);
+            AssertThrows(msg::exception::malformed, importer.import_parts(wrapping));
+            // The part is larger than the memory that is mapped
+            auto oversized = tampered(0, 1024 * slot_size);
+            AssertThrows(msg::exception::malformed, importer.import_parts(oversized));
+        });
+
+        it("sends parts inline when the ring is full", [&](){
+            shm::ring ring(2 * slot_size, slot_size);
+            shm::importer importer;
+
+            auto req = msg::request::make("service", {},
+                                          msg_vec({large}));
+            ring.export_parts(req, slot_size);
+            AssertThat(req.data()[0].size(), Equals<unsigned int>(large.size() + 1));
+
+            importer.import_parts(req);
+            AssertThat(msg2str(req.data()[0]), Equals(large));
+        });
+    });
+};
@@ -0,0 +1,200 @@
+/*
+  Copyright 2017 Kaan Genç
+
+  This file is part of DagBox.
+
+  DagBox is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  DagBox is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with DagBox.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+#include "helpers.hpp"
+#include "../src/assistant.hpp"
+#include "../src/stream.hpp"
+
+
+// A worker that streams as many chunks as its request asks for.
+struct test_worker_streaming
+{
+    std::string const service_name = "test worker streaming";
+    auto operator()(msg::request && req) -> std::vector<zmq::message_t> {
+        return msg::send(msg::reply::make(std::move(req)));
+    }
+    auto operator()(msg::request && req, reply_stream &) -> reply_stream::producer {
+        auto count = std::stoi(msg2str(req.data()[0]));
+        auto request = std::make_shared<msg::request>(std::move(req));
+        auto sent = std::make_shared<int>(0);
+        return [request, count, sent](reply_stream & stream)
+            -> boost::optional<std::vector<zmq::message_t>> {
+            while (*sent < count) {
+                ++*sent;
+                if (!stream.send(msg_vec({std::to_string(*sent)}))) {
+                    return boost::none;
+                }
+            }
+            request->data() = msg_vec({"done"});
+            return msg::send(msg::reply::make(std::move(*request)));
+        };
+    }
+};
+
+
+auto test_stream = [](){
+    describe("reply stream", [](){
+        auto request = msg::request::make("service", {}, msg_vec({"data"}));
+        std::vector<std::string> sent;
+        reply_stream stream(request,
+                            [&](msg::part_source && parts) {
+                                auto message = msg::read(std::move(parts));
+                                auto & chunk = boost::get<msg::partial>(message);
+                                sent.push_back(msg2str(chunk.data()[0]));
+                            },
+                            [](msg::part_source && parts) { return std::move(parts); });
+
+        it("sends chunks while there is credit", [&](){
+            for (uint32_t i = 1; i < msg::partial::initial_credit; ++i) {
+                AssertThat(stream.send(msg_vec({"chunk"})), Equals(true));
+            }
+            // The last chunk uses up the credit
+            AssertThat(stream.send(msg_vec({"last"})), Equals(false));
+            AssertThat(sent, HasLength(msg::partial::initial_credit));
+            AssertThat(stream.remaining_credit(), Equals<uint32_t>(0));
+        });
+
+        it("holds chunks back until there is credit", [&](){
+            AssertThat(stream.send(msg_vec({"held"})), Equals(false));
+            AssertThat(stream.held_chunks(), Equals<std::size_t>(1));
+            AssertThat(sent, HasLength(msg::partial::initial_credit));
+
+            stream.add_credit(2);
+            AssertThat(stream.held_chunks(), Equals<std::size_t>(0));
+            AssertThat(sent.back(), Equals("held"));
+            AssertThat(stream.remaining_credit(), Equals<uint32_t>(1));
+        });
+    });
+
+    describe("assistant streaming a reply", [](){
+        zmq::context_t ctx;
+        std::string addr = "inproc://test_stream";
+        class socket sock(ctx, zmq::socket_type::router);
+        sock.setsockopt(ZMQ_RCVTIMEO, 4000); // in ms
+        sock.bind(addr);
+
+        // Streams stall after 10 heartbeats without credit
+        component<assistant<test_worker_streaming>> streaming(ctx, addr, 50);
+
+        msg::address worker_addr;
+        msg::many_parts metadata;
+        metadata.push_back(msg::make_request_id(7));
+        // Without a broker, the request has no client
+        auto stream_name = msg::stream_suffix(metadata);
+
+        // Skips the heartbeats of the worker
+        auto receive = [&](){
+            while (true) {
+                auto message = msg::read(sock.recv_multimsg());
+                if (!boost::get<msg::ping>(&message)) {
+                    return message;
+                }
+            }
+        };
+        // Whether anything but heartbeats arrives in the meantime
+        auto quiet_for = [&](int ms){
+            auto deadline = detail_time::time_now() + std::chrono::milliseconds{ms};
+            while (detail_time::time_now() < deadline) {
+                zmq::pollitem_t item = {static_cast<void *>(sock), 0, ZMQ_POLLIN, 0};
+                zmq::poll(&item, 1, 10);
+                if (item.revents & ZMQ_POLLIN) {
+                    auto message = msg::read(sock.recv_multimsg());
+                    if (!boost::get<msg::ping>(&message)) {
+                        return false;
+                    }
+                }
+            }
+            return true;
+        };
+        auto send_request = [&](std::string const & count) {
+            msg::many_parts request_metadata;
+            request_metadata.push_back(msg::make_request_id(7));
+            auto req = msg::request::make("test worker streaming",
+                                          std::move(request_metadata), msg_vec({count}));
+            req.address(worker_addr);
+            sock.send_multimsg(msg::send(std::move(req)));
+        };
+        auto send_credit = [&](uint32_t amount) {
+            auto credit = msg::credit::make(stream_name, amount);
+            credit.address(worker_addr);
+            sock.send_multimsg(msg::send(std::move(credit)));
+        };
+
+        it("registers itself", [&](){
+            auto message = msg::read(sock.recv_multimsg());
+            worker_addr = *boost::get<msg::registration>(message).address();
+        });
+
+        it("sends no more chunks than the credit window", [&](){
+            send_request("10");
+            for (uint32_t i = 1; i <= msg::partial::initial_credit; ++i) {
+                auto message = receive();
+                auto & chunk = boost::get<msg::partial>(message);
+                AssertThat(msg2str(chunk.data()[0]), Equals(std::to_string(i)));
+            }
+            AssertThat(quiet_for(100), Equals(true));
+        });
+
+        it("handles other messages while waiting for credit", [&](){
+            auto ping = msg::ping::make();
+            ping.address(worker_addr);
+            sock.send_multimsg(msg::send(std::move(ping)));
+            auto message = receive();
+            boost::get<msg::pong>(message);
+        });
+
+        it("continues once credit arrives", [&](){
+            send_credit(1);
+            auto ninth = receive();
+            AssertThat(msg2str(boost::get<msg::partial>(ninth).data()[0]), Equals("9"));
+            AssertThat(quiet_for(100), Equals(true));
+
+            send_credit(5);
+            auto tenth = receive();
+            AssertThat(msg2str(boost::get<msg::partial>(tenth).data()[0]), Equals("10"));
+            auto last = receive();
+            auto & reply = boost::get<msg::reply>(last);
+            AssertThat(msg::is_error(reply.metadata()), Equals(false));
+            AssertThat(msg2str(reply.data()[0]), Equals("done"));
+        });
+
+        it("ends a stream that stalls with an error", [&](){
+            send_request("20");
+            for (uint32_t i = 1; i <= msg::partial::initial_credit; ++i) {
+                auto message = receive();
+                boost::get<msg::partial>(message);
+            }
+            auto start = detail_time::time_now();
+            auto message = receive();
+            auto & reply = boost::get<msg::reply>(message);
+            AssertThat(msg::is_error(reply.metadata()), Equals(true));
+            auto waited = std::chrono::duration_cast<std::chrono::milliseconds>(
+                detail_time::time_now() - start);
+            AssertThat(waited.count(), IsGreaterThan(300));
+
+            // Credit for the stream that ended is dropped
+            send_credit(5);
+            AssertThat(quiet_for(100), Equals(true));
+        });
+    });
+};
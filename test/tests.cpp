@@ -19,20 +19,40 @@
 #include <string>
 #include <bandit/bandit.h>
 #include "socket.hpp"
+#include "reactor.hpp"
+#include "placement.hpp"
 #include "message.hpp"
+#include "compression.hpp"
+#include "shm.hpp"
+#include "stream.hpp"
+#include "requester.hpp"
+#include "embedded.hpp"
 #include "broker.hpp"
 #include "assistant.hpp"
+#include "client.hpp"
+#include "ingest.hpp"
 #include "datastore.hpp"
 #include "lock.hpp"
+#include "config.hpp"
 
 
 go_bandit([](){
     test_socket();
+    test_reactor();
+    test_placement();
     test_message();
+    test_compression();
+    test_shm();
+    test_stream();
+    test_requester();
+    test_embedded();
     test_broker();
     test_assistant();
+    test_client();
+    test_ingest();
     test_datastore();
     test_lock();
+    test_config();
 });
 
 